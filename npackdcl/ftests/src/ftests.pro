@@ -26,7 +26,14 @@ SOURCES += main.cpp \
     ..\..\..\wpmcpp\src\detectfile.cpp \
     ..\..\..\wpmcpp\src\downloader.cpp \
     ..\..\..\wpmcpp\src\commandline.cpp \
-    ..\..\..\wpmcpp\src\repositoryxmlhandler.cpp \
+    ..\..\..\wpmcpp\src\repositoryxmlparser.cpp \
+    ..\..\..\wpmcpp\src\repositorysnapshot.cpp \
+    ..\..\..\wpmcpp\src\pipebuffer.cpp \
+    ..\..\..\wpmcpp\src\reversedependencies.cpp \
+    ..\..\..\wpmcpp\src\dependencysolver.cpp \
+    ..\..\..\wpmcpp\src\operationexecutor.cpp \
+    ..\..\..\wpmcpp\src\downloadprefetcher.cpp \
+    ..\..\..\wpmcpp\src\downloadstate.cpp \
     ..\..\..\wpmcpp\src\mysqlquery.cpp \
     ..\..\..\wpmcpp\src\wellknownprogramsthirdpartypm.cpp \
     ..\..\..\wpmcpp\src\abstractthirdpartypm.cpp \
@@ -57,7 +64,14 @@ HEADERS += \
     ..\..\..\wpmcpp\src\detectfile.h \
     ..\..\..\wpmcpp\src\downloader.h \
     ..\..\..\wpmcpp\src\commandline.h \
-    ..\..\..\wpmcpp\src\repositoryxmlhandler.h \
+    ..\..\..\wpmcpp\src\repositoryxmlparser.h \
+    ..\..\..\wpmcpp\src\repositorysnapshot.h \
+    ..\..\..\wpmcpp\src\pipebuffer.h \
+    ..\..\..\wpmcpp\src\reversedependencies.h \
+    ..\..\..\wpmcpp\src\dependencysolver.h \
+    ..\..\..\wpmcpp\src\operationexecutor.h \
+    ..\..\..\wpmcpp\src\downloadprefetcher.h \
+    ..\..\..\wpmcpp\src\downloadstate.h \
     ..\..\..\wpmcpp\src\mysqlquery.h \
     ..\..\..\wpmcpp\src\wellknownprogramsthirdpartypm.h \
     ..\..\..\wpmcpp\src\abstractthirdpartypm.h \
@@ -14,6 +14,7 @@
 #include "installedpackageversion.h"
 #include "abstractrepository.h"
 #include "dbrepository.h"
+#include "mysqlquery.h"
 #include "hrtimer.h"
 
 static bool compareByPackageTitle(const QPair<PackageVersion*, QString>& e1,
@@ -75,6 +76,7 @@ int App::process()
             "status", false);
     cl.add("bare-format", 'b', "bare format (no heading or summary)",
             "", false);
+    cl.add("all", 'a', "all packages that can be updated", "", false);
     cl.add("query", 'q', "search terms (e.g. editor)",
             "search terms", false);
     cl.add("debug", 'd', "turn on the debug output", "", false);
@@ -82,6 +84,9 @@ int App::process()
     cl.add("end-process", 'e',
         "list of ways to close running applications (c=close, k=kill). The default value is 'c'.",
         "[c][k]", false);
+    cl.add("sql-stats", 0,
+        "print statistics for the executed SQL statements at the end. Query plans are shown for statements slower than 100 ms.",
+        "", false);
 
     QString err = cl.parse();
     if (!err.isEmpty()) {
@@ -94,6 +99,11 @@ int App::process()
         clp.setUpdateRate(0);
     }
 
+    if (cl.isPresent("sql-stats")) {
+        MySQLQuery::setStatisticsEnabled(true);
+        MySQLQuery::setSlowQueryThreshold(100);
+    }
+
     QStringList fr = cl.getFreeArguments();
 
     int r = 0;
@@ -178,6 +188,11 @@ int App::process()
         }
     }
 
+    if (cl.isPresent("sql-stats")) {
+        WPMUtils::outputTextConsole(MySQLQuery::dumpStatistics() +
+                DBRepository::getDefault()->dumpStatementCacheStatistics());
+    }
+
     QCoreApplication::instance()->exit(r);
 
     return r;
@@ -225,9 +240,11 @@ void App::usage()
         "        if only one is installed.",
         "        Short package names can be used here",
         "        (e.g. App instead of com.example.App)",
-        "    ncl update (--package=<package>)+ [--end-process=<types>]",
+        "    ncl update ((--package=<package>)+ | --all) [--end-process=<types>]",
         "        updates packages by uninstalling the currently installed",
         "        and installing the newest version. ",
+        "        --all updates all installed packages with a newer version.",
+        "        All updates are planned together.",
         "        Short package names can be used here",
         "        (e.g. App instead of com.example.App)",
         "    ncl list [--status=installed | all] [--bare-format]",
@@ -802,9 +819,10 @@ QString App::update()
     }
 
     QStringList packages_ = cl.getAll("package");
+    bool all = cl.isPresent("all");
 
     if (job->shouldProceed()) {
-        if (packages_.size() == 0) {
+        if (packages_.size() == 0 && !all) {
             job->setErrorMessage("Missing option: --package");
         }
     }
@@ -849,6 +867,31 @@ QString App::update()
         }
     }
 
+    if (job->shouldProceed() && all) {
+        QString err;
+        QStringList names = rep->findPackages(Package::UPDATEABLE, true, "",
+                -1, -1, &err);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else {
+            QList<Package*> packages = rep->findPackages(names);
+            for (int i = 0; i < packages.count(); i++) {
+                Package* p = packages.at(i);
+                bool found = false;
+                for (int j = 0; j < toUpdate.count(); j++) {
+                    if (toUpdate.at(j)->name == p->name) {
+                        found = true;
+                        break;
+                    }
+                }
+                if (found)
+                    delete p;
+                else
+                    toUpdate.append(p);
+            }
+        }
+    }
+
     QList<InstallOperation*> ops;
     bool up2date = false;
     if (job->shouldProceed()) {
@@ -1466,7 +1509,8 @@ QString App::info()
 
         if (!pv) {
             QString versions;
-            QList<PackageVersion*> pvs = rep->getPackageVersions_(p->name, &r);
+            QList<PackageVersion*> pvs = rep->getPackageVersionHeaders_(
+                    p->name, &r);
             for (int i = 0; i < pvs.count(); i++) {
                 PackageVersion* opv = pvs.at(i);
                 if (i != 0)
@@ -4,6 +4,18 @@
 #include <QRegExp>
 #include <QScopedPointer>
 #include <QProcess>
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QStringList>
+#include <QThread>
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QTemporaryFile>
+#include <QFileInfo>
+#include <QSemaphore>
+#include <QTcpServer>
+#include <QTcpSocket>
 
 #include "app.h"
 #include "wpmutils.h"
@@ -14,6 +26,214 @@
 #include "abstractrepository.h"
 #include "dbrepository.h"
 #include "hrtimer.h"
+#include "packageversion.h"
+#include "repositoryxmlparser.h"
+#include "repositorysnapshot.h"
+#include "pipebuffer.h"
+#include "reversedependencies.h"
+#include "installoperation.h"
+#include "dependencysolver.h"
+#include "operationexecutor.h"
+#include "downloadprefetcher.h"
+#include "downloadstate.h"
+
+/**
+ * @brief writes data into a pipe in small chunks
+ */
+class PipeWriterThread: public QThread
+{
+public:
+    PipeBuffer* pipe;
+    QByteArray data;
+
+    void run()
+    {
+        for (int i = 0; i < data.size(); i += 100) {
+            if (pipe->write(data.constData() + i,
+                    qMin(100, data.size() - i)) < 0)
+                break;
+        }
+        pipe->closeWrite();
+    }
+};
+
+/**
+ * @brief a minimal HTTP server for one file. The first response is cut
+ *     after "cut" bytes to simulate a broken connection. Range and If-Range
+ *     requests are supported. The thread ends after the whole file was
+ *     sent or if no connection was made for 10 seconds.
+ */
+class TestHTTPServer: public QThread
+{
+public:
+    /** content of the file */
+    QByteArray data;
+
+    /** ETag of the file */
+    QByteArray etag;
+
+    /** the first response is cut after this number of bytes */
+    int cut;
+
+    /** the port is available after this semaphore was released */
+    QSemaphore ready;
+
+    /** port of the server */
+    int port;
+
+    /** values of the Range headers ("" if missing) for every request */
+    QStringList ranges;
+
+    TestHTTPServer()
+    {
+        cut = 0;
+        port = 0;
+    }
+
+    void run()
+    {
+        QTcpServer server;
+        server.listen(QHostAddress::LocalHost, 0);
+        port = server.serverPort();
+        ready.release();
+
+        bool done = false;
+        while (!done && server.waitForNewConnection(10000)) {
+            QTcpSocket* s = server.nextPendingConnection();
+            QByteArray request;
+            while (!request.contains("\r\n\r\n") &&
+                    s->waitForReadyRead(10000)) {
+                request.append(s->readAll());
+            }
+
+            QString range, ifRange;
+            QStringList lines = QString::fromLatin1(request).split("\r\n");
+            for (int i = 1; i < lines.count(); i++) {
+                QString line = lines.at(i);
+                if (line.startsWith("Range:", Qt::CaseInsensitive))
+                    range = line.mid(6).trimmed();
+                else if (line.startsWith("If-Range:", Qt::CaseInsensitive))
+                    ifRange = line.mid(9).trimmed();
+            }
+            ranges.append(range);
+
+            int start = 0;
+            QRegExp re("bytes=(\\d+)-");
+            if (re.exactMatch(range) && ifRange == etag)
+                start = re.cap(1).toInt();
+
+            QByteArray body = data.mid(start);
+            QByteArray response;
+            if (start > 0) {
+                response.append("HTTP/1.1 206 Partial Content\r\n");
+                response.append(QString("Content-Range: bytes %1-%2/%3\r\n").
+                        arg(start).arg(data.size() - 1).arg(data.size()).
+                        toLatin1());
+            } else {
+                response.append("HTTP/1.1 200 OK\r\n");
+            }
+            response.append("Content-Type: application/octet-stream\r\n");
+            response.append("Content-Length: " +
+                    QByteArray::number(body.size()) + "\r\n");
+            response.append("ETag: " + etag + "\r\n");
+            response.append("Connection: close\r\n\r\n");
+
+            if (ranges.count() == 1 && cut > 0)
+                body = body.left(cut);
+            else
+                done = true;
+            response.append(body);
+
+            s->write(response);
+            s->waitForBytesWritten(10000);
+            s->disconnectFromHost();
+            if (s->state() != QAbstractSocket::UnconnectedState)
+                s->waitForDisconnected(10000);
+            delete s;
+        }
+    }
+};
+
+/**
+ * @brief simulates installations and records the order of the operations
+ */
+class TestOperationExecutor: public OperationExecutor
+{
+    QMutex mutex;
+    int running;
+protected:
+    void processOperation(Job* job, InstallOperation* op,
+            PackageVersion* pv)
+    {
+        Q_UNUSED(pv);
+
+        mutex.lock();
+        started.append(op->package);
+        running++;
+        maxRunning = qMax(maxRunning, running);
+        mutex.unlock();
+
+        QThread::msleep(100);
+
+        mutex.lock();
+        running--;
+        done.append(op->package);
+        mutex.unlock();
+
+        job->completeWithProgress();
+    }
+public:
+    /** full package names in the order the operations were started */
+    QStringList started;
+
+    /** full package names in the order the operations were finished */
+    QStringList done;
+
+    /** maximum number of operations running at the same time */
+    int maxRunning;
+
+    TestOperationExecutor(const QList<InstallOperation*>& ops,
+            const QList<PackageVersion*>& pvs): OperationExecutor(ops, pvs)
+    {
+        running = 0;
+        maxRunning = 0;
+    }
+};
+
+/**
+ * @brief adds a package version with a download URL to a repository
+ * @param r a repository
+ * @param package full package name
+ * @param version version number
+ * @param dependency full package name of the dependency or ""
+ * @param versions versions for the dependency like "[1, 2)"
+ * @return [ownership:r] the new package version
+ */
+static PackageVersion* addTestPackageVersion(Repository* r,
+        const QString& package, const QString& version,
+        const QString& dependency=QString(), const QString& versions=QString())
+{
+    PackageVersion* pv = new PackageVersion(package, Version(version));
+    pv->download.setUrl("http://www.example.com/" + package + ".exe");
+    if (!dependency.isEmpty()) {
+        Dependency* d = new Dependency();
+        d->package = dependency;
+        d->setVersions(versions);
+        pv->dependencies.append(d);
+    }
+    r->packageVersions.append(pv);
+    r->package2versions.insert(package, pv);
+    return pv;
+}
+
+static void addTestDependency(PackageVersion* pv, const QString& package,
+        const QString& versions)
+{
+    Dependency* d = new Dependency();
+    d->package = package;
+    d->setVersions(versions);
+    pv->dependencies.append(d);
+}
 
 void App::test()
 {
@@ -63,6 +283,133 @@ void App::test()
     QVERIFY(a.isNormalized());
 
     QVERIFY(Version("2.8.7.4.8.9") > Version("2.8.6.4.8.8"));
+
+    QVERIFY(Version("1.2").getSortKey() == Version("1.2.0.0").getSortKey());
+    QVERIFY(Version("1.2").getSortKey() < Version("1.2.0.1").getSortKey());
+    QVERIFY(Version("1.10").getSortKey() > Version("1.9.5").getSortKey());
+    QVERIFY(Version("1.256").getSortKey() > Version("1.255.7").getSortKey());
+    QVERIFY(Version("0").getSortKey() < Version("0.0.1").getSortKey());
+    QVERIFY(Version("1.2").getSortKey().size() == 5);
+    QVERIFY(Version("-1").getSortKey() < Version("0").getSortKey());
+    QVERIFY(Version("-2").getSortKey() < Version("-1").getSortKey());
+    QVERIFY(Version("-2147483648").getSortKey() <
+            Version("-1.5").getSortKey());
+    QVERIFY(Version::EMPTY.getSortKey() < Version("0").getSortKey());
+    QVERIFY(Version("1.2.-1").getSortKey() < Version("1.2").getSortKey());
+    QVERIFY(Version("1.2.0.-1").getSortKey() < Version("1.2").getSortKey());
+    QVERIFY(Version("1.2.0.-1").getSortKey() >
+            Version("1.2.-1").getSortKey());
+    QVERIFY(Version("1.2").getSortKey() < Version("1.2.0.1").getSortKey());
+    QVERIFY(Version("1.-1").getSortKey() > Version("0.5").getSortKey());
+
+    QVERIFY(!a.setVersion("1..2"));
+    QVERIFY(!a.setVersion("1.2."));
+    QVERIFY(!a.setVersion("  "));
+    QVERIFY(!a.setVersion("1.99999999999"));
+    QVERIFY(a.getVersionString() == "8.4");
+    QVERIFY(a.setVersion(" 1 .2"));
+    QVERIFY(a == Version(1, 2));
+    QVERIFY(a.setVersion("1.2.3.4.5.6.7.8.9.10.11.12.13"));
+    QVERIFY(a.getVersionString() == "1.2.3.4.5.6.7.8.9.10.11.12.13");
+    QVERIFY(a.getVersionString(2) == "1.2");
+    QVERIFY(Version(1, 2).getVersionString(4) == "1.2.0.0");
+    QVERIFY(Version::EMPTY.getVersionString() == "-1.-1");
+
+    // invalid versions do not change the current value, also if it is
+    // stored on the heap
+    QVERIFY(!a.setVersion(""));
+    QVERIFY(!a.setVersion("1."));
+    QVERIFY(!a.setVersion("."));
+    QVERIFY(!a.setVersion("1.2.3.4.5.6.7.x"));
+    QVERIFY(a.getVersionString() == "1.2.3.4.5.6.7.8.9.10.11.12.13");
+    QVERIFY(a.getNParts() == 13);
+
+    // signs and whitespace are accepted like by QString::toInt()
+    QVERIFY(a.setVersion(" 1 . 2 "));
+    QVERIFY(a == Version(1, 2));
+    QVERIFY(a.getNParts() == 2);
+    QVERIFY(a.setVersion("+3"));
+    QVERIFY(a.getVersionString() == "3");
+    QVERIFY(a.setVersion("-1"));
+    QVERIFY(a.getVersionString() == "-1");
+    QVERIFY(a < Version("0"));
+    QVERIFY(!a.setVersion("1.-"));
+    QVERIFY(!a.setVersion("1.2 3"));
+    QVERIFY(a.getVersionString() == "-1");
+
+    // the range of int
+    QVERIFY(a.setVersion("2147483647"));
+    QVERIFY(a.getVersionString() == "2147483647");
+    QVERIFY(a.setVersion("-2147483648.1"));
+    QVERIFY(a.getVersionString() == "-2147483648.1");
+    QVERIFY(!a.setVersion("2147483648"));
+    QVERIFY(!a.setVersion("1.-2147483649"));
+    QVERIFY(a.getVersionString() == "-2147483648.1");
+
+    // versions with more than 6 parts are stored on the heap
+    QVERIFY(a.setVersion("1.2.3.4.5.6.7"));
+    QVERIFY(a.getNParts() == 7);
+    QVERIFY(a.getVersionString() == "1.2.3.4.5.6.7");
+    QVERIFY(a > Version("1.2.3.4.5.6"));
+    QVERIFY(a.setVersion("0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.1"));
+    QVERIFY(a.getNParts() == 25);
+    QVERIFY(a > Version("0"));
+    QVERIFY(a.setVersion("4.0.0.0.0.0.0.0"));
+    QVERIFY(a == Version("4"));
+    QVERIFY(a.getVersionString() == "4.0.0.0.0.0.0.0");
+
+    // only the specified characters are parsed
+    QString text("v1.2.3-beta");
+    QVERIFY(a.setVersion(text.constData() + 1, 5));
+    QVERIFY(a.getVersionString() == "1.2.3");
+    QVERIFY(!a.setVersion(text.constData() + 1, 6));
+    QVERIFY(!a.setVersion(text.constData() + 1, 0));
+    QVERIFY(a.getVersionString() == "1.2.3");
+    QVERIFY(a.setVersion(text.constData() + 3, 1));
+    QVERIFY(a.getVersionString() == "2");
+}
+
+void App::benchmarkVersion()
+{
+    const int N = 1000000;
+
+    QStringList texts;
+    texts.reserve(N);
+    for (int i = 0; i < N; i++) {
+        texts.append(QString("%1.%2.%3.%4").arg(i % 7).arg(i % 13).
+                arg(i % 101).arg(i));
+    }
+
+    QVector<Version> versions(N);
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < N; i++) {
+        versions[i].setVersion(texts.at(i));
+    }
+    qint64 parseMs = timer.restart();
+
+    int less = 0;
+    for (int i = 1; i < N; i++) {
+        if (versions.at(i - 1).compare(versions.at(i)) < 0)
+            less++;
+    }
+    qint64 compareMs = timer.restart();
+
+    int equal = 0;
+    for (int i = 0; i < N; i++) {
+        if (versions.at(i).getVersionString() == texts.at(i))
+            equal++;
+    }
+    qint64 formatMs = timer.restart();
+
+    QVERIFY(less > 0);
+    QVERIFY(equal == N);
+
+    qDebug() << "Versions per second: parse" <<
+            (parseMs > 0 ? N * 1000.0 / parseMs : 0) << "compare" <<
+            (compareMs > 0 ? N * 1000.0 / compareMs : 0) << "format" <<
+            (formatMs > 0 ? N * 1000.0 / formatMs : 0);
 }
 
 void App::testCommandLine()
@@ -77,3 +424,791 @@ void App::testCommandLine()
     QVERIFY2(params.at(0) == "C:\\Program Files (x86)\\InstallShield Installation Information\\{96D0B6C6-5A72-4B47-8583-A87E55F5FE81}\\setup.exe",
             qPrintable(params.at(0)));
 }
+
+void App::testPackageVersionBinary()
+{
+    PackageVersion pv("com.example.Test", Version("1.2.3.4.5.6"));
+    pv.type = 1;
+    pv.sha1 = "5f36b2ea290645ee34d943220a14b54ee5ea5be5";
+    pv.download.setUrl("http://www.example.com/test.exe");
+    pv.msiGUID = "{1d2c96c3-a3f3-49e7-b839-95279ded837f}";
+    pv.importantFiles.append("test.exe");
+    pv.importantFilesTitles.append("Test");
+    pv.files.append(new PackageVersionFile(".Npackd\\Install.bat",
+            "echo %PATH%"));
+    Dependency* d = new Dependency();
+    d->package = "com.example.Lib";
+    d->setVersions("[1.1, 2)");
+    d->var = "LIB";
+    pv.dependencies.append(d);
+
+    QByteArray data = pv.toBinary();
+    QVERIFY(PackageVersion::isBinary(data));
+    QVERIFY(!PackageVersion::isBinary(pv.serialize().toUtf8()));
+
+    QString err;
+    QScopedPointer<PackageVersion> r(PackageVersion::fromBinary(data, &err));
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r->package == pv.package);
+    QVERIFY(r->version == pv.version);
+    QVERIFY(r->type == 1);
+    QVERIFY(r->sha1 == pv.sha1);
+    QVERIFY(r->hashSumType == QCryptographicHash::Sha1);
+    QVERIFY(r->download == pv.download);
+    QVERIFY(r->msiGUID == pv.msiGUID);
+    QVERIFY(r->importantFilesTitles == pv.importantFilesTitles);
+    QVERIFY(r->files.count() == 1);
+    QVERIFY(r->files.at(0)->content == pv.files.at(0)->content);
+    QVERIFY(r->dependencies.count() == 1);
+    QVERIFY(r->dependencies.at(0)->versionsToString() == "[1.1, 2)");
+    QVERIFY(r->dependencies.at(0)->var == "LIB");
+
+    QScopedPointer<PackageVersion> r2(PackageVersion::fromBinary(
+            data.left(data.size() - 2), &err));
+    QVERIFY(!err.isEmpty());
+    QVERIFY(r2.isNull());
+
+    // the number of parts in the upper bound of the dependency is 0. The
+    // data ends with the number of parts, one part and the variable.
+    QByteArray corrupt = data;
+    int offset = corrupt.size() - 4 - 4 - (4 + 3 * 2);
+    for (int i = 0; i < 4; i++) {
+        corrupt[offset + i] = 0;
+    }
+    QScopedPointer<PackageVersion> r5(PackageVersion::fromBinary(corrupt,
+            &err));
+    QVERIFY(!err.isEmpty());
+    QVERIFY(r5.isNull());
+
+    // only the header is decoded, the rest is decoded on demand
+    QScopedPointer<PackageVersion> r3(PackageVersion::fromBinary(data, &err,
+            true));
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(!r3->isMaterialized());
+    QVERIFY(r3->version == pv.version);
+    QVERIFY(r3->download == pv.download);
+    QVERIFY(r3->files.count() == 0);
+    QVERIFY(r3->toBinary() == data);
+
+    QScopedPointer<PackageVersion> r4(r3->clone());
+    QVERIFY(!r4->isMaterialized());
+
+    err = r3->materialize();
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r3->isMaterialized());
+    QVERIFY(r3->files.count() == 1);
+    QVERIFY(r3->dependencies.count() == 1);
+    QVERIFY(r3->dependencies.at(0)->var == "LIB");
+    QVERIFY(r3->toBinary() == data);
+
+    err = r4->materialize();
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r4->files.at(0)->content == pv.files.at(0)->content);
+}
+
+void App::benchmarkRepositoryXMLParser()
+{
+    const int NPACKAGES = 5000;
+    const int NVERSIONS = 4;
+
+    QByteArray xml;
+    xml.append("<?xml version=\"1.0\"?>\n<root>\n"
+            "<spec-version>3</spec-version>\n"
+            "<license name=\"org.gnu.GPLv3\"><title>GPLv3</title>"
+            "<url>http://www.gnu.org/licenses/gpl-3.0.html</url></license>\n");
+    for (int i = 0; i < NPACKAGES; i++) {
+        QByteArray name = "com.example.Package" + QByteArray::number(i);
+        xml.append("<package name=\"" + name + "\">"
+                "<title>Package " + QByteArray::number(i) + "</title>"
+                "<url>http://www.example.com/</url>"
+                "<description>Test package number " + QByteArray::number(i) +
+                " used to measure the speed of the parser</description>"
+                "<icon>http://www.example.com/icon.png</icon>"
+                "<license>org.gnu.GPLv3</license>"
+                "<category>Development</category>"
+                "<link rel=\"changelog\" href=\"http://www.example.com/c\"/>"
+                "</package>\n");
+        for (int j = 0; j < NVERSIONS; j++) {
+            xml.append("<version name=\"1." + QByteArray::number(j) +
+                    "\" package=\"" + name + "\">"
+                    "<important-file path=\"test.exe\" title=\"Test\"/>"
+                    "<file path=\".Npackd\\Install.bat\">"
+                    "if %errorlevel% neq 0 exit %errorlevel%\n"
+                    "echo installed</file>"
+                    "<url>http://www.example.com/test-1." +
+                    QByteArray::number(j) + ".zip</url>"
+                    "<sha1>5f36b2ea290645ee34d943220a14b54ee5ea5be5</sha1>"
+                    "<dependency package=\"com.microsoft.Windows\" "
+                    "versions=\"[6.1, 7)\"><variable>WIN</variable>"
+                    "</dependency>"
+                    "<detect-file><path>test.exe</path>"
+                    "<sha1>5f36b2ea290645ee34d943220a14b54ee5ea5be5</sha1>"
+                    "</detect-file>"
+                    "</version>\n");
+        }
+    }
+    xml.append("</root>\n");
+
+    QBuffer buffer(&xml);
+
+    Repository r;
+    RepositoryXMLParser parser(&r);
+
+    QElapsedTimer timer;
+    timer.start();
+    QString err = parser.parse(&buffer);
+    qint64 ms = timer.elapsed();
+
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r.packages.count() == NPACKAGES);
+    QVERIFY(r.packageVersions.count() == NPACKAGES * NVERSIONS);
+    QVERIFY(r.licenses.count() == 1);
+
+    PackageVersion* pv = r.packageVersions.at(1);
+    QVERIFY(pv->version == Version(1, 1));
+    QVERIFY(pv->download.toString() == "http://www.example.com/test-1.1.zip");
+    QVERIFY(pv->files.count() == 1);
+    QVERIFY(pv->dependencies.count() == 1);
+    QVERIFY(pv->dependencies.at(0)->var == "WIN");
+    QVERIFY(pv->detectFiles.count() == 1);
+    QVERIFY(r.packages.at(0)->categories.count() == 1);
+
+    double mb = xml.size() / (1024.0 * 1024.0);
+    qDebug() << "Parsed" << mb << "MiB in" << ms << "ms:" <<
+            (ms > 0 ? mb * 1000 / ms : 0) << "MiB/s";
+}
+
+void App::testRepositorySnapshot()
+{
+    Repository r;
+
+    Package* p = new Package("com.example.Test", "Test");
+    p->description = "Test package";
+    p->license = "org.gnu.GPLv3";
+    p->setIcon("http://www.example.com/icon.png");
+    p->categories.append("Development/Tools");
+    p->links.insert("changelog", "http://www.example.com/changelog");
+    p->links.insert("screenshot", "http://www.example.com/1.png");
+    p->links.insert("screenshot", "http://www.example.com/2.png");
+    r.packages.append(p);
+
+    PackageVersion* pv = new PackageVersion("com.example.Test",
+            Version("1.2.3"));
+    pv->download.setUrl("http://www.example.com/test.exe");
+    pv->sha1 = "5f36b2ea290645ee34d943220a14b54ee5ea5be5";
+    r.packageVersions.append(pv);
+
+    License* lic = new License("org.gnu.GPLv3", "GPLv3");
+    lic->url = "http://www.gnu.org/licenses/gpl-3.0.html";
+    r.licenses.append(lic);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QString err = RepositorySnapshot::write(&r, &buffer);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QByteArray data = buffer.data();
+    QVERIFY(RepositorySnapshot::isSnapshot(data));
+    QVERIFY(data.size() % 4 == 0);
+
+    Repository r2;
+    err = RepositorySnapshot::read((const uchar*) data.constData(),
+            data.size(), &r2);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r2.packages.count() == 1);
+    QVERIFY(r2.packages.at(0)->name == p->name);
+    QVERIFY(r2.packages.at(0)->title == p->title);
+    QVERIFY(r2.packages.at(0)->description == p->description);
+    QVERIFY(r2.packages.at(0)->license == p->license);
+    QVERIFY(r2.packages.at(0)->getIcon() == p->getIcon());
+    QVERIFY(r2.packages.at(0)->categories == p->categories);
+    QVERIFY(r2.packages.at(0)->links == p->links);
+    QVERIFY(r2.packageVersions.count() == 1);
+    QVERIFY(r2.packageVersions.at(0)->version == pv->version);
+    QVERIFY(r2.packageVersions.at(0)->download == pv->download);
+    QVERIFY(r2.package2versions.count("com.example.Test") == 1);
+    QVERIFY(r2.licenses.count() == 1);
+    QVERIFY(r2.licenses.at(0)->url == lic->url);
+
+    // truncated data
+    Repository r3;
+    err = RepositorySnapshot::read((const uchar*) data.constData(),
+            data.size() - 4, &r3);
+    QVERIFY(!err.isEmpty());
+}
+
+void App::testRepositoryWriteTo()
+{
+    Repository r;
+
+    Package* p = new Package("com.example.Test", "Test");
+    p->description = "Test package";
+    p->categories.append("Development");
+    r.packages.append(p);
+
+    PackageVersion* pv = new PackageVersion("com.example.Test",
+            Version("2.1"));
+    pv->download.setUrl("http://www.example.com/test.exe");
+    pv->files.append(new PackageVersionFile(".Npackd\\Install.bat",
+            "echo <installed> & exit"));
+    r.packageVersions.append(pv);
+
+    License* lic = new License("org.gnu.GPLv3", "GPLv3");
+    r.licenses.append(lic);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QString err = r.writeTo(&buffer);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    buffer.close();
+
+    Repository r2;
+    RepositoryXMLParser parser(&r2);
+    err = parser.parse(&buffer);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r2.packages.count() == 1);
+    QVERIFY(r2.packages.at(0)->description == p->description);
+    QVERIFY(r2.packages.at(0)->categories == p->categories);
+    QVERIFY(r2.packageVersions.count() == 1);
+    QVERIFY(r2.packageVersions.at(0)->version == pv->version);
+    QVERIFY(r2.packageVersions.at(0)->files.count() == 1);
+    QVERIFY(r2.packageVersions.at(0)->files.at(0)->content ==
+            "echo <installed> & exit");
+    QVERIFY(r2.licenses.count() == 1);
+    QVERIFY(r2.licenses.at(0)->title == "GPLv3");
+}
+
+void App::testPlanUninstallation()
+{
+    // C depends on B, B depends on A. D depends on A, but is also satisfied
+    // by another version of A.
+    PackageVersion* a1 = new PackageVersion("com.example.A", Version(1, 0));
+    PackageVersion* a2 = new PackageVersion("com.example.A", Version(1, 5));
+    PackageVersion* b = new PackageVersion("com.example.B", Version(2, 0));
+    PackageVersion* c = new PackageVersion("com.example.C", Version(3, 0));
+    PackageVersion* d = new PackageVersion("com.example.D", Version(4, 0));
+
+    Dependency* dep = new Dependency();
+    dep->package = "com.example.A";
+    dep->setVersions("[1, 1.1)");
+    b->dependencies.append(dep);
+
+    dep = new Dependency();
+    dep->package = "com.example.B";
+    dep->setVersions("[2, 3)");
+    c->dependencies.append(dep);
+
+    dep = new Dependency();
+    dep->package = "com.example.A";
+    dep->setVersions("[1, 2)");
+    d->dependencies.append(dep);
+
+    QList<PackageVersion*> all;
+    all << a1 << a2 << b << c << d;
+
+    ReverseDependencies rd(all);
+    QVERIFY(rd.findDependents("com.example.A", Version(1, 0)).count() == 2);
+    QVERIFY(rd.findDependents("com.example.A", Version(1, 5)).count() == 1);
+    QVERIFY(rd.countMatches(d->dependencies.at(0)) == 2);
+    QVERIFY(rd.find("com.example.B", Version("2")) == b);
+
+    QList<PackageVersion*> installed = all;
+    QList<InstallOperation*> ops;
+    QString err = a1->planUninstallation(installed, ops);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(ops.count() == 3);
+    QVERIFY(ops.at(0)->package == "com.example.C");
+    QVERIFY(ops.at(1)->package == "com.example.B");
+    QVERIFY(ops.at(2)->package == "com.example.A");
+    QVERIFY(!ops.at(2)->install);
+    QVERIFY(installed.count() == 2);
+    QVERIFY(installed.contains(a2));
+    QVERIFY(installed.contains(d));
+
+    qDeleteAll(ops);
+    qDeleteAll(all);
+}
+
+void App::testDependencySolver()
+{
+    // B 1.5 cannot be installed, B 2.0 does not match
+    Repository r;
+    PackageVersion* a = addTestPackageVersion(&r, "com.example.A", "1",
+            "com.example.B", "[1, 2)");
+    addTestPackageVersion(&r, "com.example.B", "1");
+    addTestPackageVersion(&r, "com.example.B", "1.5",
+            "com.example.Missing", "[1, 2)");
+    addTestPackageVersion(&r, "com.example.B", "2");
+    PackageVersion* c = addTestPackageVersion(&r, "com.example.C", "1",
+            "com.example.Missing", "[1, 2)");
+
+    DependencySolver solver(&r);
+    QList<PackageVersion*> goals;
+    goals.append(a);
+    QList<PackageVersion*> installed, avoid;
+    QList<InstallOperation*> ops;
+    QString err = solver.planInstallation(goals, installed, ops, avoid);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(ops.count() == 2);
+    QVERIFY(ops.at(0)->package == "com.example.B");
+    QVERIFY(ops.at(0)->version == Version(1, 0));
+    QVERIFY(ops.at(1)->package == "com.example.A");
+    QVERIFY(ops.at(1)->install);
+    QVERIFY(installed.count() == 2);
+    qDeleteAll(ops);
+    ops.clear();
+
+    // nothing to do if the goal is already installed
+    err = solver.planInstallation(goals, installed, ops, avoid);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(ops.count() == 0);
+    qDeleteAll(installed);
+    installed.clear();
+
+    // B 1 may not be used
+    avoid.append(new PackageVersion("com.example.B", Version(1, 0)));
+    err = solver.planInstallation(goals, installed, ops, avoid);
+    QVERIFY(err.contains("com.example.B"));
+    QVERIFY(ops.count() == 0);
+    qDeleteAll(avoid);
+    avoid.clear();
+
+    goals.clear();
+    goals.append(c);
+    err = solver.planInstallation(goals, installed, ops, avoid);
+    QVERIFY(!err.isEmpty());
+    QVERIFY(ops.count() == 0);
+    QVERIFY(installed.count() == 0);
+
+    // X 2 needs Z 2, but every version of Y needs Z 1. Only one new version
+    // of Z should be installed. The first decision (X 2) leads to a
+    // conflict on the decision level 1.
+    Repository r2;
+    PackageVersion* root = addTestPackageVersion(&r2, "com.example.Root",
+            "1", "com.example.X", "[1, 3)");
+    addTestDependency(root, "com.example.Y", "[1, 3)");
+    addTestPackageVersion(&r2, "com.example.X", "1",
+            "com.example.Z", "[1, 2)");
+    addTestPackageVersion(&r2, "com.example.X", "2",
+            "com.example.Z", "[2, 3)");
+    addTestPackageVersion(&r2, "com.example.Y", "1",
+            "com.example.Z", "[1, 2)");
+    addTestPackageVersion(&r2, "com.example.Y", "2",
+            "com.example.Z", "[1, 2)");
+    addTestPackageVersion(&r2, "com.example.Z", "1");
+    addTestPackageVersion(&r2, "com.example.Z", "2");
+
+    DependencySolver solver2(&r2);
+    goals.clear();
+    goals.append(root);
+    err = solver2.planInstallation(goals, installed, ops, avoid);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(solver2.getConflictCount() > 0);
+    QVERIFY(ops.count() == 4);
+    QVERIFY(ops.at(0)->package == "com.example.Z");
+    QVERIFY(ops.at(0)->version == Version(1, 0));
+    QVERIFY(ops.at(1)->package == "com.example.X");
+    QVERIFY(ops.at(1)->version == Version(1, 0));
+    QVERIFY(ops.at(2)->package == "com.example.Y");
+    QVERIFY(ops.at(2)->version == Version(2, 0));
+    QVERIFY(ops.at(3)->package == "com.example.Root");
+    qDeleteAll(ops);
+    ops.clear();
+    qDeleteAll(installed);
+    installed.clear();
+}
+
+void App::testBatchPlan()
+{
+    Repository r;
+    addTestPackageVersion(&r, "com.example.B", "1");
+    PackageVersion* b2 = addTestPackageVersion(&r, "com.example.B", "2");
+    PackageVersion* d2 = addTestPackageVersion(&r, "com.example.D", "2",
+            "com.example.E", "[1, 2)");
+    addTestPackageVersion(&r, "com.example.E", "1");
+
+    // A only works with B 1, C also with B 2
+    QList<PackageVersion*> installed;
+    installed.append(new PackageVersion("com.example.B", Version(1, 0)));
+    PackageVersion* a = new PackageVersion("com.example.A", Version(1, 0));
+    Dependency* dep = new Dependency();
+    dep->package = "com.example.B";
+    dep->setVersions("[1, 2)");
+    a->dependencies.append(dep);
+    installed.append(a);
+    PackageVersion* c = new PackageVersion("com.example.C", Version(1, 0));
+    dep = new Dependency();
+    dep->package = "com.example.B";
+    dep->setVersions("[1, 3)");
+    c->dependencies.append(dep);
+    installed.append(c);
+    installed.append(new PackageVersion("com.example.D", Version(1, 0)));
+    QList<PackageVersion*> all = installed;
+
+    // update B and D together
+    QList<PackageVersion*> install, remove;
+    install << b2 << d2;
+    remove << installed.at(0) << installed.at(3);
+
+    DependencySolver solver(&r);
+    QList<InstallOperation*> ops;
+    QString err = solver.plan(install, remove, installed, ops);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(ops.count() == 6);
+    QVERIFY(ops.at(0)->install && ops.at(0)->package == "com.example.B");
+    QVERIFY(ops.at(1)->install && ops.at(1)->package == "com.example.E");
+    QVERIFY(ops.at(2)->install && ops.at(2)->package == "com.example.D");
+    QVERIFY(!ops.at(3)->install && ops.at(3)->package == "com.example.D");
+    QVERIFY(!ops.at(4)->install && ops.at(4)->package == "com.example.A");
+    QVERIFY(!ops.at(5)->install && ops.at(5)->package == "com.example.B");
+    QVERIFY(installed.count() == 4);
+    QVERIFY(PackageVersion::indexOf(installed, c) >= 0);
+    QVERIFY(PackageVersion::indexOf(installed, a) < 0);
+    qDeleteAll(ops);
+    ops.clear();
+    for (int i = 0; i < installed.count(); i++) {
+        if (!all.contains(installed.at(i)))
+            delete installed.at(i);
+    }
+
+    // nothing else depends on B: the old version is removed first
+    installed.clear();
+    installed.append(all.at(0));
+    remove.clear();
+    remove.append(all.at(0));
+    install.clear();
+    install.append(b2);
+    err = solver.plan(install, remove, installed, ops);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(ops.count() == 2);
+    QVERIFY(!ops.at(0)->install);
+    QVERIFY(ops.at(1)->install);
+    qDeleteAll(ops);
+    qDeleteAll(installed);
+
+    qDeleteAll(all);
+}
+
+void App::benchmarkDependencySolver()
+{
+    // com.example.Root depends on P0. The version j of P0..P(n-2) depends
+    // on the next package and on the version j of Z. Every version of
+    // P(n-1) depends on Z 1. Only one version of Z can be installed, so only
+    // the oldest versions of P0..P(n-2) can be used. A depth-first search
+    // has to try VERSIONS^n combinations. The solver learns from every
+    // conflict that one version of Z cannot be used.
+    const int VERSIONS = 10;
+    for (int n = 5; n <= 80; n *= 2) {
+        Repository r;
+        PackageVersion* root = addTestPackageVersion(&r, "com.example.Root",
+                "1", "com.example.P0", "[1, 100)");
+        for (int j = 1; j <= VERSIONS; j++) {
+            addTestPackageVersion(&r, "com.example.Z", QString::number(j));
+        }
+        for (int i = 0; i < n; i++) {
+            QString package = QString("com.example.P%1").arg(i);
+            for (int j = 1; j <= VERSIONS; j++) {
+                if (i == n - 1) {
+                    addTestPackageVersion(&r, package, QString::number(j),
+                            "com.example.Z", "[1, 2)");
+                } else {
+                    PackageVersion* pv = addTestPackageVersion(&r, package,
+                            QString::number(j),
+                            QString("com.example.P%1").arg(i + 1),
+                            "[1, 100)");
+                    addTestDependency(pv, "com.example.Z",
+                            QString("[%1, %2)").arg(j).arg(j + 1));
+                }
+            }
+        }
+
+        DependencySolver solver(&r);
+        QList<PackageVersion*> goals;
+        goals.append(root);
+        QList<PackageVersion*> installed, avoid;
+        QList<InstallOperation*> ops;
+
+        QElapsedTimer timer;
+        timer.start();
+        QString err = solver.planInstallation(goals, installed, ops, avoid);
+        qint64 ms = timer.elapsed();
+
+        qDebug() << "Depth" << n << ":" << solver.getVariableCount() <<
+                "variables," << solver.getClauseCount() << "clauses," <<
+                solver.getDecisionCount() << "decisions," <<
+                solver.getConflictCount() << "conflicts in" << ms << "ms";
+
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        QVERIFY(ops.count() == n + 2);
+        QVERIFY(ops.at(0)->package == "com.example.Z");
+        QVERIFY(ops.at(0)->version == Version(1, 0));
+        QVERIFY(ops.at(1)->package == QString("com.example.P%1").arg(n - 1));
+        QVERIFY(ops.at(n)->package == "com.example.P0");
+        QVERIFY(ops.at(n)->version == Version(1, 0));
+
+        // every conflict excludes one version of Z
+        QVERIFY(solver.getConflictCount() > 0);
+        QVERIFY(solver.getConflictCount() < VERSIONS);
+        QVERIFY(solver.getDecisionCount() <= n + 2 * VERSIONS);
+
+        qDeleteAll(ops);
+        qDeleteAll(installed);
+    }
+}
+
+void App::testPipeBuffer()
+{
+    Repository r;
+    for (int i = 0; i < 100; i++) {
+        QString name = QString("com.example.Test%1").arg(i);
+        r.packages.append(new Package(name, name));
+        PackageVersion* pv = new PackageVersion(name, Version(1, i));
+        pv->download.setUrl("http://www.example.com/test.exe");
+        r.packageVersions.append(pv);
+    }
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QString err = r.writeTo(&buffer);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    buffer.close();
+
+    // the capacity is much smaller than the data so that the writer has to
+    // wait for the parser
+    PipeBuffer pipe(1024);
+    QVERIFY(pipe.lookAhead(0).isEmpty());
+
+    PipeWriterThread writer;
+    writer.pipe = &pipe;
+    writer.data = buffer.data();
+    writer.start();
+
+    QVERIFY(pipe.lookAhead(5) == "<?xml");
+
+    Repository r2;
+    RepositoryXMLParser parser(&r2);
+    err = parser.parse(&pipe);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    pipe.readAll();
+    writer.wait();
+
+    QVERIFY(pipe.getWriteError().isEmpty());
+    QVERIFY(pipe.atEnd());
+    QVERIFY(r2.packages.count() == 100);
+    QVERIFY(r2.packageVersions.count() == 100);
+    QVERIFY(r2.packageVersions.at(99)->version == Version(1, 99));
+    QVERIFY(pipe.getHashSum() == QCryptographicHash::hash(buffer.data(),
+            QCryptographicHash::Sha1).toHex().toLower());
+
+    // a reader that stops early lets the writer fail
+    PipeBuffer pipe2(1024);
+    PipeWriterThread writer2;
+    writer2.pipe = &pipe2;
+    writer2.data = buffer.data();
+    writer2.start();
+    pipe2.abort();
+    writer2.wait();
+    QVERIFY(pipe2.getHashSum().isEmpty());
+}
+
+void App::testOperationExecutor()
+{
+    // B depends on A, C is independent
+    QList<PackageVersion*> pvs;
+    pvs.append(new PackageVersion("com.example.A", Version(1, 0)));
+    PackageVersion* b = new PackageVersion("com.example.B", Version(1, 0));
+    Dependency* dep = new Dependency();
+    dep->package = "com.example.A";
+    dep->setVersions("[1, 2)");
+    b->dependencies.append(dep);
+    pvs.append(b);
+    pvs.append(new PackageVersion("com.example.C", Version(1, 0)));
+
+    QList<InstallOperation*> ops;
+    for (int i = 0; i < pvs.count(); i++) {
+        InstallOperation* op = new InstallOperation();
+        op->install = true;
+        op->package = pvs.at(i)->package;
+        op->version = pvs.at(i)->version;
+        ops.append(op);
+    }
+
+    TestOperationExecutor executor(ops, pvs);
+    QVERIFY(executor.getDependencies(0).count() == 0);
+    QVERIFY(executor.getDependencies(1) == QList<int>() << 0);
+    QVERIFY(executor.getDependencies(2).count() == 0);
+
+    Job job;
+    executor.execute(&job, 1);
+    QVERIFY2(job.getErrorMessage().isEmpty(),
+            qPrintable(job.getErrorMessage()));
+    QVERIFY(executor.done.count() == 3);
+    QVERIFY(executor.started.indexOf("com.example.B") >
+            executor.started.indexOf("com.example.A"));
+    QVERIFY(executor.done.indexOf("com.example.B") >
+            executor.done.indexOf("com.example.A"));
+    QVERIFY(executor.maxRunning == 2);
+    QVERIFY(job.getProgress() > 0.99);
+
+    // sequential execution
+    TestOperationExecutor executor2(ops, pvs);
+    executor2.setMaxParallel(1);
+    Job job2;
+    executor2.execute(&job2, 1);
+    QVERIFY(executor2.done.count() == 3);
+    QVERIFY(executor2.maxRunning == 1);
+
+    qDeleteAll(ops);
+    qDeleteAll(pvs);
+}
+
+void App::testDownloadPrefetcher()
+{
+    QTemporaryFile source;
+    QVERIFY(source.open());
+    QByteArray data(100000, 'x');
+    QVERIFY(source.write(data) == data.size());
+    source.close();
+    QString sha1 = QCryptographicHash::hash(data,
+            QCryptographicHash::Sha1).toHex().toLower();
+
+    // A has the correct hash sum, B a wrong one and C none
+    QList<PackageVersion*> pvs;
+    for (int i = 0; i < 3; i++) {
+        PackageVersion* pv = new PackageVersion(
+                QString("com.example.Test%1").arg(i), Version(1, 0));
+        pv->download = QUrl::fromLocalFile(source.fileName());
+        pvs.append(pv);
+    }
+    pvs.at(0)->sha1 = sha1;
+    pvs.at(1)->sha1 = QString(40, '0');
+
+    DownloadPrefetcher prefetcher(pvs);
+    prefetcher.setMaxParallel(2);
+
+    // only one downloaded file can wait for the installation
+    prefetcher.setDiskBudget(1);
+    prefetcher.start();
+
+    Job job;
+    QString a = prefetcher.take(pvs.at(0), &job);
+    QVERIFY(!a.isEmpty());
+    QFile fa(a);
+    QVERIFY(fa.open(QFile::ReadOnly));
+    QVERIFY(fa.readAll() == data);
+    fa.close();
+    QVERIFY(QFile::remove(a));
+
+    QVERIFY(prefetcher.take(pvs.at(1), &job).isEmpty());
+
+    QString c = prefetcher.take(pvs.at(2), &job);
+    QVERIFY(!c.isEmpty());
+    QVERIFY(QFileInfo(c).size() == data.size());
+    QVERIFY(QFile::remove(c));
+
+    // a file is only handed over once
+    QVERIFY(prefetcher.take(pvs.at(0), &job).isEmpty());
+
+    prefetcher.cancel();
+    qDeleteAll(pvs);
+}
+
+void App::testDownloadState()
+{
+    qint64 start, total;
+    QVERIFY(DownloadState::parseContentRange("bytes 100-999/1000", &start,
+            &total));
+    QVERIFY(start == 100);
+    QVERIFY(total == 1000);
+    QVERIFY(DownloadState::parseContentRange("bytes 0-9/*", &start, &total));
+    QVERIFY(start == 0);
+    QVERIFY(total == -1);
+    QVERIFY(!DownloadState::parseContentRange("bytes */1000", &start,
+            &total));
+    QVERIFY(!DownloadState::parseContentRange("bytes 100-99/1000", &start,
+            &total));
+    QVERIFY(!DownloadState::parseContentRange("bytes 100-499/1000", &start,
+            &total));
+    QVERIFY(!DownloadState::parseContentRange("bytes 100-1000/1000", &start,
+            &total));
+
+    DownloadState s;
+    QVERIFY(!s.isResumable());
+    s.url = "http://www.example.com/test.zip";
+    s.bytes = 1000;
+    s.etag = "W/\"abc\"";
+    QVERIFY(!s.isResumable());
+    s.lastModified = "Wed, 21 Oct 2015 07:28:00 GMT";
+    QVERIFY(s.getValidator() == s.lastModified);
+    s.etag = "\"abc\"";
+    QVERIFY(s.isResumable());
+    QVERIFY(s.getRangeHeaders() ==
+            "Range: bytes=1000-\r\nIf-Range: \"abc\"");
+
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    f.close();
+    QString err = s.save(f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    DownloadState s2;
+    err = s2.load(f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(s2.url == s.url);
+    QVERIFY(s2.bytes == 1000);
+    QVERIFY(s2.total == -1);
+    QVERIFY(s2.etag == s.etag);
+    QVERIFY(s2.lastModified == s.lastModified);
+
+    s2.restart();
+    QVERIFY(s2.bytes == 0);
+    QVERIFY(!s2.isResumable());
+}
+
+void App::testResumableDownload()
+{
+    QByteArray data;
+    for (int i = 0; i < 300000; i++) {
+        data.append((char) (i % 251));
+    }
+
+    TestHTTPServer server;
+    server.data = data;
+    server.etag = "\"v1\"";
+    server.cut = 100000;
+    server.start();
+    server.ready.acquire();
+
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    QString fileName = f.fileName();
+    f.close();
+    QUrl url(QString("http://127.0.0.1:%1/test.bin").arg(server.port));
+
+    // the connection is closed after 100000 bytes
+    Job job;
+    QString sha1;
+    Downloader::downloadResumable(&job, url, fileName, &sha1,
+            QCryptographicHash::Sha1, 1);
+    QVERIFY(!job.getErrorMessage().isEmpty());
+    QVERIFY(QFile::exists(fileName + ".state"));
+
+    // the second call continues at the byte 100000
+    Job job2;
+    Downloader::downloadResumable(&job2, url, fileName, &sha1,
+            QCryptographicHash::Sha1);
+    server.wait();
+    QVERIFY2(job2.getErrorMessage().isEmpty(),
+            qPrintable(job2.getErrorMessage()));
+    QVERIFY(!QFile::exists(fileName + ".state"));
+    QVERIFY(server.ranges.count() == 2);
+    QVERIFY(server.ranges.at(0).isEmpty());
+    QVERIFY(server.ranges.at(1) == "bytes=100000-");
+    QVERIFY(sha1 == QCryptographicHash::hash(data,
+            QCryptographicHash::Sha1).toHex().toLower());
+
+    QFile result(fileName);
+    QVERIFY(result.open(QFile::ReadOnly));
+    QVERIFY(result.readAll() == data);
+    result.close();
+}
@@ -26,10 +26,82 @@ private slots:
      */
     void test();
 
+    /**
+     * Measures parsing, comparing and formatting of version numbers
+     */
+    void benchmarkVersion();
+
     /**
      * Tests für CommandLine
      */
     void testCommandLine();
+
+    /**
+     * Tests for the binary form of PackageVersion
+     */
+    void testPackageVersionBinary();
+
+    /**
+     * Parses a large generated repository and prints the throughput
+     */
+    void benchmarkRepositoryXMLParser();
+
+    /**
+     * Tests for RepositorySnapshot
+     */
+    void testRepositorySnapshot();
+
+    /**
+     * Writes a repository as XML and parses it again
+     */
+    void testRepositoryWriteTo();
+
+    /**
+     * Tests ReverseDependencies and PackageVersion::planUninstallation
+     */
+    void testPlanUninstallation();
+
+    /**
+     * Tests DependencySolver
+     */
+    void testDependencySolver();
+
+    /**
+     * Plans an update of many packages with DependencySolver::plan()
+     */
+    void testBatchPlan();
+
+    /**
+     * Plans installations on dependency graphs that are exponential for a
+     * depth-first search and checks that the number of conflicts and
+     * decisions grows at most linearly
+     */
+    void benchmarkDependencySolver();
+
+    /**
+     * Parses a repository from a PipeBuffer filled by another thread
+     */
+    void testPipeBuffer();
+
+    /**
+     * Executes independent operations in parallel with OperationExecutor
+     */
+    void testOperationExecutor();
+
+    /**
+     * Downloads binaries in the background with DownloadPrefetcher
+     */
+    void testDownloadPrefetcher();
+
+    /**
+     * Tests DownloadState
+     */
+    void testDownloadState();
+
+    /**
+     * Resumes an interrupted download from a local HTTP server
+     */
+    void testResumableDownload();
 };
 
 #endif // APP_H
@@ -45,7 +45,14 @@ SOURCES += main.cpp \
     ../../wpmcpp/src/controlpanelthirdpartypm.cpp \
     ../../wpmcpp/src/wellknownprogramsthirdpartypm.cpp \
     ../../wpmcpp/src/hrtimer.cpp \
-    ../../wpmcpp/src/repositoryxmlhandler.cpp \
+    ../../wpmcpp/src/repositoryxmlparser.cpp \
+    ../../wpmcpp/src/repositorysnapshot.cpp \
+    ../../wpmcpp/src/pipebuffer.cpp \
+    ../../wpmcpp/src/reversedependencies.cpp \
+    ../../wpmcpp/src/dependencysolver.cpp \
+    ../../wpmcpp/src/operationexecutor.cpp \
+    ../../wpmcpp/src/downloadprefetcher.cpp \
+    ../../wpmcpp/src/downloadstate.cpp \
     ../../wpmcpp/src/mysqlquery.cpp \
     ../../wpmcpp/src/installedpackagesthirdpartypm.cpp \
     ../../wpmcpp/src/cbsthirdpartypm.cpp
@@ -77,7 +84,14 @@ HEADERS += ../../wpmcpp/src/visiblejobs.h \
     ../../wpmcpp/src/controlpanelthirdpartypm.h \
     ../../wpmcpp/src/wellknownprogramsthirdpartypm.h \
     ../../wpmcpp/src/hrtimer.h \
-    ../../wpmcpp/src/repositoryxmlhandler.h \
+    ../../wpmcpp/src/repositoryxmlparser.h \
+    ../../wpmcpp/src/repositorysnapshot.h \
+    ../../wpmcpp/src/pipebuffer.h \
+    ../../wpmcpp/src/reversedependencies.h \
+    ../../wpmcpp/src/dependencysolver.h \
+    ../../wpmcpp/src/operationexecutor.h \
+    ../../wpmcpp/src/downloadprefetcher.h \
+    ../../wpmcpp/src/downloadstate.h \
     ../../wpmcpp/src/mysqlquery.h \
     ../../wpmcpp/src/installedpackagesthirdpartypm.h \
     ../../wpmcpp/src/cbsthirdpartypm.h
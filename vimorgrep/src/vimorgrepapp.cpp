@@ -338,6 +338,8 @@ int VimOrgRepApp::process()
 
     if (job->shouldProceed()) {
         QString e = rep.writeTo("VimOrgRep.xml");
+        if (e.isEmpty())
+            e = rep.writeSnapshotTo("VimOrgRep.npks");
         if (!e.isEmpty())
             job->setErrorMessage(e);
         else
@@ -1,12 +1,23 @@
 #include <QDebug>
+#include <QtAlgorithms>
+#include <QSet>
 
 #include "abstractrepository.h"
 #include "wpmutils.h"
 #include "windowsregistry.h"
 #include "installedpackages.h"
+#include "dependencysolver.h"
+#include "operationexecutor.h"
+#include "downloadprefetcher.h"
 
 AbstractRepository* AbstractRepository::def = 0;
 
+static bool packageVersionGreaterThan(const PackageVersion* a,
+        const PackageVersion* b)
+{
+    return a->version.compare(b->version) > 0;
+}
+
 AbstractRepository *AbstractRepository::getDefault_()
 {
     return def;
@@ -163,6 +174,20 @@ void AbstractRepository::process(Job *job,
         }
     }
 
+    // the binaries are downloaded while the packages are stopped and the
+    // previous operations are executed
+    QList<PackageVersion*> downloads;
+    for (int i = 0; i < pvs.count(); i++) {
+        PackageVersion* pv = pvs.at(i);
+        if (install.at(i)->install && !pv->installed() &&
+                pv->download.isValid())
+            downloads.append(pv);
+    }
+    DownloadPrefetcher prefetcher(downloads);
+    prefetcher.readSettings();
+    if (job->shouldProceed())
+        prefetcher.start();
+
     int n = install.count();
 
     // 10% for stopping the packages
@@ -185,30 +210,16 @@ void AbstractRepository::process(Job *job,
         }
     }
 
-    // 90% for removing/installing the packages
+    // 90% for removing/installing the packages. Independent operations are
+    // executed in parallel.
     if (job->shouldProceed()) {
-        for (int i = 0; i < install.count(); i++) {
-            InstallOperation* op = install.at(i);
-            PackageVersion* pv = pvs.at(i);
-            QString txt;
-            if (op->install)
-                txt = QString(QObject::tr("Installing %1")).arg(
-                        pv->toString());
-            else
-                txt = QString(QObject::tr("Uninstalling %1")).arg(
-                        pv->toString());
-
-            Job* sub = job->newSubJob(0.9 / n, txt, true, true);
-            if (op->install)
-                pv->install(sub, pv->getPreferredInstallationDirectory());
-            else
-                pv->uninstall(sub);
-
-            if (!job->getErrorMessage().isEmpty())
-                break;
-        }
+        OperationExecutor executor(install, pvs);
+        executor.setPrefetcher(&prefetcher);
+        executor.execute(job, 0.9);
     }
 
+    prefetcher.cancel();
+
     for (int j = 0; j < pvs.size(); j++) {
         PackageVersion* pv = pvs.at(j);
         pv->unlock();
@@ -249,7 +260,6 @@ QString AbstractRepository::planUpdates(const QList<Package*> packages,
 
     QList<PackageVersion*> installed = getInstalled_(&err);
     QList<PackageVersion*> newest, newesti;
-    QList<bool> used;
 
     if (err.isEmpty()) {
         for (int i = 0; i < packages.count(); i++) {
@@ -282,70 +292,29 @@ QString AbstractRepository::planUpdates(const QList<Package*> packages,
             if (a->version.compare(b->version) > 0) {
                 newest.append(a);
                 newesti.append(b);
-                used.append(false);
-            }
-        }
-    }
-
-    if (err.isEmpty()) {
-        // many packages cannot be installed side-by-side and overwrite for
-        // example
-        // the shortcuts of the old version in the start menu. We try to find
-        // those packages where the old version can be uninstalled first and
-        // then
-        // the new version installed. This is the reversed order for an update.
-        // If this is possible and does not affect other packages, we do this
-        // first.
-        for (int i = 0; i < newest.count(); i++) {
-            QList<PackageVersion*> avoid;
-            QList<InstallOperation*> ops2;
-            QList<PackageVersion*> installedCopy = installed;
-
-            QString err = newesti.at(i)->planUninstallation(
-                    installedCopy, ops2);
-            if (err.isEmpty()) {
-                err = newest.at(i)->planInstallation(installedCopy, ops2, avoid);
-                if (err.isEmpty()) {
-                    if (ops2.count() == 2) {
-                        used[i] = true;
-                        installed = installedCopy;
-                        ops.append(ops2[0]);
-                        ops.append(ops2[1]);
-                        ops2.clear();
-                    }
-                }
-            }
-
-            qDeleteAll(ops2);
-        }
-    }
-
-    if (err.isEmpty()) {
-        for (int i = 0; i < newest.count(); i++) {
-            if (!used[i]) {
-                QList<PackageVersion*> avoid;
-                err = newest.at(i)->planInstallation(installed, ops, avoid);
-                if (!err.isEmpty())
-                    break;
+            } else {
+                delete a;
+                delete b;
             }
         }
     }
 
-    if (err.isEmpty()) {
-        for (int i = 0; i < newesti.count(); i++) {
-            if (!used[i]) {
-                err = newesti.at(i)->planUninstallation(installed, ops);
-                if (!err.isEmpty())
-                    break;
-            }
-        }
-    }
+    // plan() removes the objects for uninstalled package versions from the
+    // list, but does not destroy them
+    QSet<PackageVersion*> all = installed.toSet();
 
     if (err.isEmpty()) {
-        InstallOperation::simplify(ops);
+        // many packages cannot be installed side-by-side and overwrite for
+        // example the shortcuts of the old version in the start menu. The
+        // solver uninstalls the old version first if this does not affect
+        // other packages. All updates are planned together so that the
+        // dependency graph is only built once.
+        DependencySolver solver(this);
+        err = solver.plan(newest, newesti, installed, ops);
     }
 
-    qDeleteAll(installed);
+    all.unite(installed.toSet());
+    qDeleteAll(all);
     qDeleteAll(newest);
     qDeleteAll(newesti);
 
@@ -459,6 +428,12 @@ QString AbstractRepository::computeNpackdCLEnvVar_(QString* err) const
     return v;
 }
 
+QList<PackageVersion*> AbstractRepository::getPackageVersionHeaders_(
+        const QString &package, QString *err) const
+{
+    return getPackageVersions_(package, err);
+}
+
 PackageVersion* AbstractRepository::findNewestInstallablePackageVersion_(
         const QString &package, QString* err) const
 {
@@ -483,6 +458,34 @@ PackageVersion* AbstractRepository::findNewestInstallablePackageVersion_(
     return r;
 }
 
+QList<PackageVersion*> AbstractRepository::findInstallableMatches_(
+        const Dependency& d, const QList<PackageVersion*>& avoid,
+        QString* err) const
+{
+    QList<PackageVersion*> r;
+
+    QList<PackageVersion*> pvs = this->getPackageVersions_(d.package, err);
+    for (int i = 0; i < pvs.count(); i++) {
+        PackageVersion* p = pvs.at(i);
+
+        bool ok = p->download.isValid() && d.test(p->version);
+        for (int j = 0; ok && j < avoid.count(); j++) {
+            PackageVersion* a = avoid.at(j);
+            if (a->package == p->package && a->version == p->version)
+                ok = false;
+        }
+
+        if (ok)
+            r.append(p);
+        else
+            delete p;
+    }
+
+    qSort(r.begin(), r.end(), packageVersionGreaterThan);
+
+    return r;
+}
+
 AbstractRepository::AbstractRepository()
 {
 }
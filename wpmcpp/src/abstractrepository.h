@@ -10,6 +10,7 @@
 #include "package.h"
 #include "license.h"
 #include "installoperation.h"
+#include "dependency.h"
 
 /**
  * @brief basis for repositories
@@ -91,6 +92,22 @@ public:
     virtual QList<PackageVersion*> getPackageVersions_(
             const QString& package, QString* err) const = 0;
 
+    /**
+     * @brief finds all package versions for listing purposes. Only the
+     *     fields stored directly in PackageVersion (version, download URL,
+     *     hash sum etc.) are guaranteed to be available.
+     *     PackageVersion::materialize() should be called before
+     *     files, detectFiles or dependencies are accessed. The default
+     *     implementation calls getPackageVersions_().
+     *
+     * @param package full package name
+     * @param err error message will be stored here
+     * @return [ownership:caller] the list of package versions.
+     *     The first returned object has the highest version number.
+     */
+    virtual QList<PackageVersion*> getPackageVersionHeaders_(
+            const QString& package, QString* err) const;
+
     /**
      * Find the newest installed package version.
      *
@@ -109,8 +126,23 @@ public:
      * @return found package version or 0. The returned object should be
      *     destroyed later.
      */
-    PackageVersion* findNewestInstallablePackageVersion_(const QString& package,
-            QString *err) const;
+    virtual PackageVersion* findNewestInstallablePackageVersion_(
+            const QString& package, QString *err) const;
+
+    /**
+     * @brief searches for the package versions with a download URL that
+     *     match a dependency. The default implementation filters the result
+     *     of getPackageVersions_().
+     * @param d a dependency
+     * @param avoid these package versions are skipped. They are only
+     *     compared by the package name and version.
+     * @param err error message will be stored here
+     * @return [ownership:caller] found package versions. The first returned
+     *     object has the highest version number. PackageVersion::materialize()
+     *     must be called before the files or dependencies are accessed.
+     */
+    virtual QList<PackageVersion*> findInstallableMatches_(const Dependency& d,
+            const QList<PackageVersion*>& avoid, QString* err) const;
 
     /**
      * @param err error message will be stored here
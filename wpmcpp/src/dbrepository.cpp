@@ -14,10 +14,11 @@
 #include <QDebug>
 #include <QXmlStreamWriter>
 #include <QSqlRecord>
-#include <QTemporaryDir>
 #include <QtConcurrent/QtConcurrentRun>
 #include <QFuture>
 #include <QSqlResult>
+#include <QSqlDriver>
+#include <QThread>
 
 #include "package.h"
 #include "repository.h"
@@ -26,8 +27,13 @@
 #include "installedpackages.h"
 #include "hrtimer.h"
 #include "mysqlquery.h"
-#include "repositoryxmlhandler.h"
+#include "repositoryxmlparser.h"
+#include "repositorysnapshot.h"
 #include "downloader.h"
+#include "pipebuffer.h"
+#include "quazip.h"
+#include "quazipfile.h"
+#include "quagzipfile.h"
 
 static bool packageVersionLessThan3(const PackageVersion* a,
         const PackageVersion* b)
@@ -40,26 +46,200 @@ static bool packageVersionLessThan3(const PackageVersion* a,
     return r > 0;
 }
 
+/**
+ * @brief downloads a repository into a pipe. A dedicated thread is used
+ *     instead of QtConcurrent so that a download waiting for the reader can
+ *     never prevent a queued parser from starting.
+ */
+class RepositoryDownloadThread: public QThread
+{
+public:
+    Job* job;
+    QUrl url;
+    PipeBuffer* pipe;
+    bool useCache;
+
+    void run()
+    {
+        Downloader::download(job, url, pipe, 0, QCryptographicHash::Sha1,
+                useCache);
+
+        QString err = job->getErrorMessage();
+        if (err.isEmpty() && job->isCancelled())
+            err = QObject::tr("Cancelled by the user");
+        pipe->closeWrite(err);
+    }
+};
+
 DBRepository DBRepository::def;
 
-DBRepository::DBRepository()
+DBRepository::ReadConnection::~ReadConnection()
+{
+    qDeleteAll(statements);
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(name);
+}
+
+DBRepository::DBRepository(): mainConnectionMutex(QMutex::Recursive)
 {
-    savePackageVersionQuery = 0;
-    insertPackageQuery = 0;
-    insertLinkQuery = 0;
-    deleteLinkQuery = 0;
-    replacePackageQuery = 0;
-    selectCategoryQuery = 0;
+    currentRepository = 0;
+    statementCacheHits = 0;
+    statementCacheMisses = 0;
+    ingesting = false;
+    ingestRowID = 1;
+    readPool = false;
+    readConnectionCounter = 0;
+    generation = 0;
 }
 
 DBRepository::~DBRepository()
 {
-    delete selectCategoryQuery;
-    delete deleteLinkQuery;
-    delete insertLinkQuery;
-    delete insertPackageQuery;
-    delete replacePackageQuery;
-    delete savePackageVersionQuery;
+    // the connections cannot be removed safely during the destruction of
+    // static objects
+    if (this != &def)
+        closeReadConnection();
+    clearStatementCache();
+}
+
+MySQLQuery* DBRepository::getQuery(const QString& sql, QString* err) const
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    *err = "";
+
+    MySQLQuery* q = statementCache.value(sql);
+    if (q) {
+        statementCacheHits.ref();
+    } else {
+        statementCacheMisses.ref();
+        q = new MySQLQuery(db);
+        if (!q->prepare(sql)) {
+            *err = getErrorString(*q);
+            delete q;
+            q = 0;
+        } else {
+            statementCache.insert(sql, q);
+        }
+    }
+
+    return q;
+}
+
+void DBRepository::clearStatementCache()
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    qDeleteAll(statementCache);
+    statementCache.clear();
+}
+
+DBRepository::ReadConnection* DBRepository::getReadConnection(
+        QString* err) const
+{
+    *err = "";
+
+    if (!readPool || getTransactionLevel() > 0)
+        return 0;
+
+    // the connection was created for a previous database
+    ReadConnection* rc = readConnections.localData();
+    if (rc && rc->generation != generation.load()) {
+        readConnections.setLocalData(0);
+        rc = 0;
+    }
+
+    if (!rc) {
+        rc = new ReadConnection();
+        rc->generation = generation.load();
+        rc->name = connectionName + "-read-" +
+                QString::number(readConnectionCounter.fetchAndAddOrdered(1));
+        rc->db = QSqlDatabase::addDatabase("QSQLITE", rc->name);
+        rc->db.setDatabaseName(fileName);
+        rc->db.setConnectOptions("QSQLITE_OPEN_READONLY=1");
+        rc->db.open();
+        *err = toString(rc->db.lastError());
+
+        if (err->isEmpty()) {
+            MySQLQuery q(rc->db);
+            if (!q.exec("PRAGMA busy_timeout = 30000"))
+                *err = getErrorString(q);
+        }
+
+        if (err->isEmpty()) {
+            readConnections.setLocalData(rc);
+        } else {
+            delete rc;
+            rc = 0;
+        }
+    }
+
+    return rc;
+}
+
+MySQLQuery* DBRepository::getReadQuery(const QString& sql, QString* err) const
+{
+    ReadConnection* rc = getReadConnection(err);
+    if (!err->isEmpty())
+        return 0;
+
+    if (!rc)
+        return getQuery(sql, err);
+
+    // the read-only connection is only used by the current thread
+    MySQLQuery* q = rc->statements.value(sql);
+    if (q) {
+        statementCacheHits.ref();
+    } else {
+        statementCacheMisses.ref();
+        q = new MySQLQuery(rc->db);
+        if (!q->prepare(sql)) {
+            *err = getErrorString(*q);
+            delete q;
+            q = 0;
+        } else {
+            rc->statements.insert(sql, q);
+        }
+    }
+
+    return q;
+}
+
+QSqlDatabase DBRepository::getReadDatabase(QString* err) const
+{
+    ReadConnection* rc = getReadConnection(err);
+    if (rc)
+        return rc->db;
+    else
+        return db;
+}
+
+void DBRepository::closeReadConnection()
+{
+    // the old connection is deleted
+    readConnections.setLocalData(0);
+}
+
+int DBRepository::getTransactionLevel() const
+{
+    return transactionLevels.hasLocalData() ?
+            transactionLevels.localData() : 0;
+}
+
+int DBRepository::getStatementCacheHits() const
+{
+    return statementCacheHits.load();
+}
+
+int DBRepository::getStatementCacheMisses() const
+{
+    return statementCacheMisses.load();
+}
+
+QString DBRepository::dumpStatementCacheStatistics() const
+{
+    return QString("Statement cache: %1 hits, %2 misses\n").
+            arg(getStatementCacheHits()).arg(getStatementCacheMisses());
 }
 
 DBRepository* DBRepository::getDefault()
@@ -69,13 +249,101 @@ DBRepository* DBRepository::getDefault()
 
 QString DBRepository::exec(const QString& sql)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     MySQLQuery q(db);
     q.exec(sql);
     return getErrorString(q);
 }
 
+void DBRepository::setTransactionLevel(int level)
+{
+    // the read methods use the main connection during a transaction.
+    // See getReadConnection(). The other threads wait for the end of the
+    // transaction before they can use the main connection.
+    int before = getTransactionLevel();
+    if (level != before) {
+        transactionLevels.setLocalData(level);
+        if (before == 0)
+            mainConnectionMutex.lock();
+        else if (level == 0)
+            mainConnectionMutex.unlock();
+    }
+}
+
+QString DBRepository::beginTransaction()
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err = exec("BEGIN TRANSACTION");
+    if (err.isEmpty())
+        setTransactionLevel(1);
+    return err;
+}
+
+QString DBRepository::commit()
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err = exec("COMMIT");
+    if (!err.isEmpty())
+        exec("ROLLBACK");
+    setTransactionLevel(0);
+    return err;
+}
+
+QString DBRepository::rollback()
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err = exec("ROLLBACK");
+    setTransactionLevel(0);
+    return err;
+}
+
+QString DBRepository::savepoint(const QString& name)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err = exec("SAVEPOINT " + name);
+    if (err.isEmpty())
+        setTransactionLevel(getTransactionLevel() + 1);
+    return err;
+}
+
+QString DBRepository::releaseSavepoint(const QString& name)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err = exec("RELEASE " + name);
+    if (!err.isEmpty()) {
+        exec("ROLLBACK TO " + name);
+        if (!exec("RELEASE " + name).isEmpty() &&
+                getTransactionLevel() == 1)
+            exec("ROLLBACK");
+    }
+    setTransactionLevel(qMax(getTransactionLevel() - 1, 0));
+    return err;
+}
+
+QString DBRepository::rollbackToSavepoint(const QString& name)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err = exec("ROLLBACK TO " + name);
+    QString err2 = exec("RELEASE " + name);
+    if (!err2.isEmpty() && getTransactionLevel() == 1)
+        exec("ROLLBACK");
+    if (err.isEmpty())
+        err = err2;
+    setTransactionLevel(qMax(getTransactionLevel() - 1, 0));
+    return err;
+}
+
 int DBRepository::count(const QString& sql, QString* err)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     int n = 0;
 
     *err = "";
@@ -101,9 +369,9 @@ int DBRepository::count(const QString& sql, QString* err)
 
 QString DBRepository::saveLicense(License* p, bool replace)
 {
-    QString err;
+    QMutexLocker locker(&mainConnectionMutex);
 
-    MySQLQuery q(db);
+    QString err;
 
     QString sql = "INSERT OR ";
     if (replace)
@@ -111,19 +379,19 @@ QString DBRepository::saveLicense(License* p, bool replace)
     else
         sql += "IGNORE";
     sql += " INTO LICENSE "
-            "(NAME, TITLE, DESCRIPTION, URL)"
-            "VALUES(:NAME, :TITLE, :DESCRIPTION, :URL)";
-    if (!q.prepare(sql))
-        err = getErrorString(q);
+            "(REPOSITORY, NAME, TITLE, DESCRIPTION, URL)"
+            "VALUES(:REPOSITORY, :NAME, :TITLE, :DESCRIPTION, :URL)";
+    MySQLQuery* q = getQuery(sql, &err);
 
     if (err.isEmpty()) {
-        q.bindValue(":REPOSITORY", this->currentRepository);
-        q.bindValue(":NAME", p->name);
-        q.bindValue(":TITLE", p->title);
-        q.bindValue(":DESCRIPTION", p->description);
-        q.bindValue(":URL", p->url);
-        if (!q.exec())
-            err = getErrorString(q);
+        q->bindValue(":REPOSITORY", this->currentRepository);
+        q->bindValue(":NAME", p->name);
+        q->bindValue(":TITLE", p->title);
+        q->bindValue(":DESCRIPTION", p->description);
+        q->bindValue(":URL", p->url);
+        if (!q->exec())
+            err = getErrorString(*q);
+        q->finish();
     }
 
     return err;
@@ -183,29 +451,30 @@ Package *DBRepository::findPackage_(const QString &name)
 
     Package* r = 0;
 
-    MySQLQuery q(db);
-    if (!q.prepare("SELECT TITLE, URL, ICON, DESCRIPTION, LICENSE "
-            "FROM PACKAGE WHERE NAME = :NAME LIMIT 1"))
-        err = getErrorString(q);
+    MySQLQuery* q = getReadQuery("SELECT TITLE, URL, ICON, DESCRIPTION, LICENSE "
+            "FROM PACKAGE WHERE NAME = :NAME LIMIT 1", &err);
 
     if (err.isEmpty()) {
-        q.bindValue(":NAME", name);
-        if (!q.exec())
-            err = getErrorString(q);
+        q->bindValue(":NAME", name);
+        if (!q->exec())
+            err = getErrorString(*q);
     }
 
-    if (err.isEmpty() && q.next()) {
+    if (err.isEmpty() && q->next()) {
         r = new Package(name, name);
-        r->title = q.value(0).toString();
-        r->url = q.value(1).toString();
-        r->setIcon(q.value(2).toString());
-        r->description = q.value(3).toString();
-        r->license = q.value(4).toString();
+        r->title = q->value(0).toString();
+        r->url = q->value(1).toString();
+        r->setIcon(q->value(2).toString());
+        r->description = q->value(3).toString();
+        r->license = q->value(4).toString();
 
         if (err.isEmpty())
             err = readLinks(r);
     }
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
@@ -226,32 +495,34 @@ QList<Package*> DBRepository::findPackages(const QStringList& names)
     sql += ")";
 
     while (start < c) {
-        MySQLQuery q(db);
-        if (!q.prepare(sql))
-            err = getErrorString(q);
+        MySQLQuery* q = getReadQuery(sql, &err);
 
         if (!err.isEmpty())
             break;
 
-        for (int i = start; i < std::min(start + block, c); i++) {
-            q.bindValue(":NAME" + QString::number(i - start), names.at(i));
+        // the values from the previous block are still bound
+        for (int i = 0; i < block; i++) {
+            QVariant v;
+            if (start + i < c)
+                v = names.at(start + i);
+            q->bindValue(":NAME" + QString::number(i), v);
         }
 
-        if (!q.exec())
-            err = getErrorString(q);
+        if (!q->exec())
+            err = getErrorString(*q);
 
         if (!err.isEmpty())
             break;
 
         QList<Package*> list;
-        while (q.next()) {
-            QString name = q.value(0).toString();
+        while (q->next()) {
+            QString name = q->value(0).toString();
             Package* r = new Package(name, name);
-            r->title = q.value(1).toString();
-            r->url = q.value(2).toString();
-            r->setIcon(q.value(3).toString());
-            r->description = q.value(4).toString();
-            r->license = q.value(5).toString();
+            r->title = q->value(1).toString();
+            r->url = q->value(2).toString();
+            r->setIcon(q->value(3).toString());
+            r->description = q->value(4).toString();
+            r->license = q->value(5).toString();
 
             err = readLinks(r);
 
@@ -260,6 +531,7 @@ QList<Package*> DBRepository::findPackages(const QStringList& names)
 
             list.append(r);
         }
+        q->finish();
 
         for (int i = start; i < std::min(start + block, c); i++) {
             QString find = names.at(i);
@@ -289,6 +561,33 @@ QString DBRepository::findCategory(int cat) const
     return categories.value(cat);
 }
 
+PackageVersion* DBRepository::parsePackageVersion(const QByteArray& content,
+        QString* err, bool validate, bool headerOnly)
+{
+    *err = "";
+
+    PackageVersion* r = 0;
+
+    if (PackageVersion::isBinary(content)) {
+        r = PackageVersion::fromBinary(content, err, headerOnly);
+    } else {
+        // databases created by older versions contain XML
+        QDomDocument doc;
+        int errorLine, errorColumn;
+        if (!doc.setContent(content, err, &errorLine, &errorColumn))
+            *err = QString(
+                    QObject::tr("XML parsing failed at line %1, column %2: %3")).
+                    arg(errorLine).arg(errorColumn).arg(*err);
+
+        if (err->isEmpty()) {
+            QDomElement root = doc.documentElement();
+            r = PackageVersion::parse(&root, err, validate);
+        }
+    }
+
+    return r;
+}
+
 PackageVersion* DBRepository::findPackageVersion_(
         const QString& package, const Version& version, QString* err) const
 {
@@ -299,127 +598,194 @@ PackageVersion* DBRepository::findPackageVersion_(
     QString version_ = v.getVersionString();
     PackageVersion* r = 0;
 
-    MySQLQuery q(db);
-    if (!q.prepare("SELECT NAME, "
+    MySQLQuery* q = getReadQuery("SELECT NAME, "
             "PACKAGE, CONTENT, MSIGUID FROM PACKAGE_VERSION "
-            "WHERE NAME = :NAME AND PACKAGE = :PACKAGE"))
-        *err = getErrorString(q);
+            "WHERE NAME = :NAME AND PACKAGE = :PACKAGE", err);
 
     if (err->isEmpty()) {
-        q.bindValue(":NAME", version_);
-        q.bindValue(":PACKAGE", package);
-        if (!q.exec())
-            *err = getErrorString(q);
+        q->bindValue(":NAME", version_);
+        q->bindValue(":PACKAGE", package);
+        if (!q->exec())
+            *err = getErrorString(*q);
     }
 
-    if (err->isEmpty() && q.next()) {
-        QDomDocument doc;
-        int errorLine, errorColumn;
-        if (!doc.setContent(q.value(2).toByteArray(),
-                err, &errorLine, &errorColumn))
-            *err = QString(
-                    QObject::tr("XML parsing failed at line %1, column %2: %3")).
-                    arg(errorLine).arg(errorColumn).arg(*err);
-
-        if (err->isEmpty()) {
-            QDomElement root = doc.documentElement();
-            PackageVersion* p = PackageVersion::parse(&root, err);
-
-            if (err->isEmpty()) {
-                r = p;
-            }
-        }
+    if (err->isEmpty() && q->next()) {
+        r = parsePackageVersion(q->value(2).toByteArray(), err);
     }
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
 QList<PackageVersion*> DBRepository::getPackageVersions_(const QString& package,
         QString *err) const
+{
+    return readPackageVersions(package, err, false);
+}
+
+QList<PackageVersion*> DBRepository::getPackageVersionHeaders_(
+        const QString& package, QString *err) const
+{
+    return readPackageVersions(package, err, true);
+}
+
+QList<PackageVersion*> DBRepository::readPackageVersions(
+        const QString& package, QString *err, bool headerOnly) const
 {
     *err = "";
 
     QList<PackageVersion*> r;
 
-    MySQLQuery q(db);
-    if (!q.prepare("SELECT CONTENT FROM PACKAGE_VERSION "
-            "WHERE PACKAGE = :PACKAGE"))
-        *err = getErrorString(q);
+    // the versions are sorted by SQLite using the index
+    MySQLQuery* q = getReadQuery("SELECT CONTENT FROM PACKAGE_VERSION "
+            "WHERE PACKAGE = :PACKAGE ORDER BY VERSION_KEY DESC", err);
 
     if (err->isEmpty()) {
-        q.bindValue(":PACKAGE", package);
-        if (!q.exec()) {
-            *err = getErrorString(q);
+        q->bindValue(":PACKAGE", package);
+        if (!q->exec()) {
+            *err = getErrorString(*q);
         }
     }
 
-    while (err->isEmpty() && q.next()) {
-        QDomDocument doc;
-        int errorLine, errorColumn;
-        if (!doc.setContent(q.value(0).toByteArray(),
-                err, &errorLine, &errorColumn)) {
-            *err = QString(
-                    QObject::tr("XML parsing failed at line %1, column %2: %3")).
-                    arg(errorLine).arg(errorColumn).arg(*err);
-        }
+    while (err->isEmpty() && q->next()) {
+        PackageVersion* pv = parsePackageVersion(q->value(0).toByteArray(),
+                err, false, headerOnly);
+        if (err->isEmpty())
+            r.append(pv);
+    }
+
+    // qDebug() << vs.count();
 
-        QDomElement root = doc.documentElement();
+    if (q)
+        q->finish();
 
-        if (err->isEmpty()) {
-            PackageVersion* pv = PackageVersion::parse(&root, err, false);
-            if (err->isEmpty())
-                r.append(pv);
-        }
+    return r;
+}
+
+PackageVersion* DBRepository::findNewestInstallablePackageVersion_(
+        const QString& package, QString *err) const
+{
+    *err = "";
+
+    PackageVersion* r = 0;
+
+    MySQLQuery* q = getReadQuery("SELECT CONTENT FROM PACKAGE_VERSION "
+            "WHERE PACKAGE = :PACKAGE AND HAS_DOWNLOAD = 1 "
+            "ORDER BY VERSION_KEY DESC LIMIT 1", err);
+
+    if (err->isEmpty()) {
+        q->bindValue(":PACKAGE", package);
+        if (!q->exec())
+            *err = getErrorString(*q);
     }
 
-    // qDebug() << vs.count();
+    if (err->isEmpty() && q->next())
+        r = parsePackageVersion(q->value(0).toByteArray(), err, false);
 
-    qSort(r.begin(), r.end(), packageVersionLessThan3);
+    if (q)
+        q->finish();
 
     return r;
 }
 
-QList<PackageVersion *> DBRepository::getPackageVersionsWithDetectFiles(
+QList<PackageVersion*> DBRepository::findInstallableInRange_(
+        const QString& package,
+        const Version& min, bool minIncluded,
+        const Version& max, bool maxIncluded,
+        const QList<PackageVersion*>& avoid, int limit,
         QString *err) const
 {
     *err = "";
 
     QList<PackageVersion*> r;
 
-    MySQLQuery q(db);
-    if (!q.prepare("SELECT CONTENT FROM PACKAGE_VERSION "
-            "WHERE DETECT_FILE_COUNT > 0"))
-        *err = getErrorString(q);
+    // the SQL text only differs in the comparison operators so that there
+    // are at most 4 cached statements
+    MySQLQuery* q = getReadQuery(QString("SELECT NAME, CONTENT "
+            "FROM PACKAGE_VERSION WHERE PACKAGE = :PACKAGE AND "
+            "VERSION_KEY %1 :MIN AND VERSION_KEY %2 :MAX AND "
+            "HAS_DOWNLOAD = 1 ORDER BY VERSION_KEY DESC").
+            arg(minIncluded ? ">=" : ">").
+            arg(maxIncluded ? "<=" : "<"), err);
 
     if (err->isEmpty()) {
-        if (!q.exec()) {
-            *err = getErrorString(q);
+        q->bindValue(":PACKAGE", package);
+        q->bindValue(":MIN", min.getSortKey());
+        q->bindValue(":MAX", max.getSortKey());
+        if (!q->exec())
+            *err = getErrorString(*q);
+    }
+
+    while (err->isEmpty() && (limit < 0 || r.count() < limit) &&
+            q->next()) {
+        // the version number is available without decoding the data
+        Version v;
+        if (!v.setVersion(q->value(0).toString()))
+            continue;
+
+        bool skip = false;
+        for (int i = 0; i < avoid.count(); i++) {
+            PackageVersion* a = avoid.at(i);
+            if (a->package == package && a->version == v) {
+                skip = true;
+                break;
+            }
         }
+        if (skip)
+            continue;
+
+        PackageVersion* pv = parsePackageVersion(q->value(1).toByteArray(),
+                err, false, true);
+        if (err->isEmpty())
+            r.append(pv);
     }
 
-    while (err->isEmpty() && q.next()) {
-        QDomDocument doc;
-        int errorLine, errorColumn;
-        if (!doc.setContent(q.value(0).toByteArray(),
-                err, &errorLine, &errorColumn)) {
-            *err = QString(
-                    QObject::tr("XML parsing failed at line %1, column %2: %3")).
-                    arg(errorLine).arg(errorColumn).arg(*err);
-        }
+    if (q)
+        q->finish();
 
-        QDomElement root = doc.documentElement();
+    return r;
+}
 
-        if (err->isEmpty()) {
-            PackageVersion* pv = PackageVersion::parse(&root, err);
-            if (err->isEmpty())
-                r.append(pv);
+QList<PackageVersion*> DBRepository::findInstallableMatches_(
+        const Dependency& d, const QList<PackageVersion*>& avoid,
+        QString* err) const
+{
+    return findInstallableInRange_(d.package, d.min, d.minIncluded,
+            d.max, d.maxIncluded, avoid, -1, err);
+}
+
+QList<PackageVersion *> DBRepository::getPackageVersionsWithDetectFiles(
+        QString *err) const
+{
+    *err = "";
+
+    QList<PackageVersion*> r;
+
+    MySQLQuery* q = getReadQuery("SELECT CONTENT FROM PACKAGE_VERSION "
+            "WHERE DETECT_FILE_COUNT > 0", err);
+
+    if (err->isEmpty()) {
+        if (!q->exec()) {
+            *err = getErrorString(*q);
         }
     }
 
+    while (err->isEmpty() && q->next()) {
+        PackageVersion* pv = parsePackageVersion(q->value(0).toByteArray(),
+                err);
+        if (err->isEmpty())
+            r.append(pv);
+    }
+
     // qDebug() << vs.count();
 
     qSort(r.begin(), r.end(), packageVersionLessThan3);
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
@@ -427,31 +793,33 @@ License *DBRepository::findLicense_(const QString& name, QString *err)
 {
     *err = "";
 
+    QMutexLocker locker(&licensesMutex);
+
     License* r = 0;
     License* cached = this->licenses.object(name);
     if (!cached) {
-        MySQLQuery q(db);
-
-        if (!q.prepare("SELECT NAME, TITLE, DESCRIPTION, URL "
+        MySQLQuery* q = getReadQuery("SELECT NAME, TITLE, DESCRIPTION, URL "
                 "FROM LICENSE "
-                "WHERE NAME = :NAME"))
-            *err = getErrorString(q);
+                "WHERE NAME = :NAME", err);
 
         if (err->isEmpty()) {
-            q.bindValue(":NAME", name);
-            if (!q.exec())
-                *err = getErrorString(q);
+            q->bindValue(":NAME", name);
+            if (!q->exec())
+                *err = getErrorString(*q);
         }
 
         if (err->isEmpty()) {
-            if (q.next()) {
-                cached = new License(name, q.value(1).toString());
-                cached->description = q.value(2).toString();
-                cached->url = q.value(3).toString();
+            if (q->next()) {
+                cached = new License(name, q->value(1).toString());
+                cached->description = q->value(2).toString();
+                cached->url = q->value(3).toString();
                 r = cached->clone();
                 this->licenses.insert(name, cached);
             }
         }
+
+        if (q)
+            q->finish();
     } else {
         r = cached->clone();
     }
@@ -468,17 +836,10 @@ QStringList DBRepository::findPackages(Package::Status status,
     QString where;
     QList<QVariant> params;
 
-    QStringList keywords = query.toLower().simplified().split(" ",
-            QString::SkipEmptyParts);
-
-    for (int i = 0; i < keywords.count(); i++) {
-        QString kw = keywords.at(i);
-        if (kw.length() > 1) {
-            if (!where.isEmpty())
-                where += " AND ";
-            where += "FULLTEXT LIKE :FULLTEXT" + QString::number(i);
-            params.append(QString("%" + kw.toLower() + "%"));
-        }
+    QString match = createFTSMatchQuery(query);
+    if (!match.isEmpty()) {
+        where += "PACKAGE_FTS MATCH :MATCH";
+        params.append(match);
     }
     if (filterByStatus) {
         if (!where.isEmpty())
@@ -517,20 +878,92 @@ QStringList DBRepository::findPackages(Package::Status status,
 
     // qDebug() << "DBRepository::findPackages.1";
 
-    return findPackagesWhere(where, params, err);
+    if (match.isEmpty())
+        return findPackagesWhere(where, params, err);
+    else
+        return findPackagesRanked(where, params, err);
 }
 
-QStringList DBRepository::getCategories(const QStringList& ids, QString* err)
+QString DBRepository::createFTSMatchQuery(const QString &query)
 {
-    *err = "";
+    QString r;
 
-    QString sql = "SELECT NAME FROM CATEGORY WHERE ID IN (" +
-            ids.join(", ") + ")";
+    QStringList keywords = query.toLower().simplified().split(" ",
+            QString::SkipEmptyParts);
 
-    MySQLQuery q(db);
+    for (int i = 0; i < keywords.count(); i++) {
+        QString kw = keywords.at(i);
+        if (kw.length() <= 1)
+            continue;
+
+        // the "simple" tokenizer treats all non-ASCII characters and ASCII
+        // letters and digits as parts of a token
+        QStringList tokens;
+        QString token;
+        for (int j = 0; j < kw.length(); j++) {
+            QChar c = kw.at(j);
+            ushort u = c.unicode();
+            if (u >= 128 || (u >= 'a' && u <= 'z') || (u >= '0' && u <= '9')) {
+                token.append(c);
+            } else if (!token.isEmpty()) {
+                tokens.append(token);
+                token.clear();
+            }
+        }
+        if (!token.isEmpty())
+            tokens.append(token);
 
-    if (!q.prepare(sql))
-        *err = getErrorString(q);
+        if (tokens.count() > 0) {
+            if (!r.isEmpty())
+                r.append(' ');
+            r.append('"').append(tokens.join("* ")).append("*\"");
+        }
+    }
+
+    return r;
+}
+
+double DBRepository::rankFTSMatch(const QByteArray &matchinfo)
+{
+    // weights for the columns TITLE, DESCRIPTION and NAME
+    static const double WEIGHTS[] = {10.0, 1.0, 5.0};
+
+    const quint32* mi = (const quint32*) matchinfo.constData();
+    int n = matchinfo.size() / sizeof(quint32);
+
+    double r = 0;
+    if (n >= 2) {
+        int nphrases = mi[0];
+        int ncols = mi[1];
+        if (n >= 2 + nphrases * ncols * 3) {
+            for (int i = 0; i < nphrases; i++) {
+                const quint32* phrase = mi + 2 + i * ncols * 3;
+                for (int j = 0; j < ncols && j < 3; j++) {
+                    quint32 hitsThisRow = phrase[j * 3];
+                    quint32 hitsAllRows = phrase[j * 3 + 1];
+                    if (hitsThisRow > 0)
+                        r += WEIGHTS[j] * hitsThisRow / hitsAllRows;
+                }
+            }
+        }
+    }
+
+    return r;
+}
+
+QStringList DBRepository::getCategories(const QStringList& ids, QString* err)
+{
+    *err = "";
+
+    QString sql = "SELECT NAME FROM CATEGORY WHERE ID IN (" +
+            ids.join(", ") + ")";
+
+    // the SQL is different for every list of IDs and is not cached
+    QSqlDatabase rdb = getReadDatabase(err);
+    MySQLQuery q(rdb);
+
+    if (err->isEmpty() && !q.prepare(sql))
+        *err = getErrorString(q);
 
     QStringList r;
     if (err->isEmpty()) {
@@ -552,85 +985,113 @@ QList<QStringList> DBRepository::findCategories(Package::Status status,
 {
     // qDebug() << "DBRepository::findPackages.0";
 
-    QString where;
+    QString sql;
     QList<QVariant> params;
 
-    QStringList keywords = query.toLower().simplified().split(" ",
-            QString::SkipEmptyParts);
+    QString match = createFTSMatchQuery(query);
+
+    // the counts for both category combo boxes in the GUI without keywords
+    // are read from CATEGORY_COUNT
+    if (match.isEmpty() && cat1 < 0 &&
+            ((level == 0 && cat0 < 0) || (level == 1 && cat0 >= 0))) {
+        QString where = "C.LEVEL = :LEVEL AND C.PARENT = :PARENT";
+        params.append(level);
+        params.append(level == 0 ? 0 : cat0);
+        if (filterByStatus) {
+            if (status == Package::INSTALLED)
+                where += " AND C.STATUS >= :STATUS";
+            else
+                where += " AND C.STATUS = :STATUS";
+            params.append(QVariant((int) status));
+        }
 
-    for (int i = 0; i < keywords.count(); i++) {
-        if (!where.isEmpty())
-            where += " AND ";
-        where += "FULLTEXT LIKE :FULLTEXT" + QString::number(i);
-        params.append(QString("%" + keywords.at(i).toLower() + "%"));
-    }
-    if (filterByStatus) {
-        if (!where.isEmpty())
-            where += " AND ";
-        if (status == Package::INSTALLED)
-            where += "STATUS >= :STATUS";
-        else
-            where += "STATUS = :STATUS";
-        params.append(QVariant((int) status));
-    }
+        sql = "SELECT CATEGORY.ID, SUM(C.N), CATEGORY.NAME FROM "
+                "CATEGORY_COUNT C LEFT JOIN CATEGORY ON C.CATEGORY = "
+                "CATEGORY.ID WHERE " + where +
+                " GROUP BY CATEGORY.ID, CATEGORY.NAME "
+                "HAVING SUM(C.N) > 0 ORDER BY CATEGORY.NAME";
+    } else {
+        QString where;
+        if (!match.isEmpty()) {
+            where += "PACKAGE_FTS MATCH :MATCH";
+            params.append(match);
+        }
+        if (filterByStatus) {
+            if (!where.isEmpty())
+                where += " AND ";
+            if (status == Package::INSTALLED)
+                where += "STATUS >= :STATUS";
+            else
+                where += "STATUS = :STATUS";
+            params.append(QVariant((int) status));
+        }
 
-    if (cat0 == 0) {
-        if (!where.isEmpty())
-            where += " AND ";
-        where += "CATEGORY0 IS NULL";
-    } else if (cat0 > 0) {
-        if (!where.isEmpty())
-            where += " AND ";
-        where += "CATEGORY0 = :CATEGORY0";
-        params.append(QVariant((int) cat0));
-    }
+        if (cat0 == 0) {
+            if (!where.isEmpty())
+                where += " AND ";
+            where += "CATEGORY0 IS NULL";
+        } else if (cat0 > 0) {
+            if (!where.isEmpty())
+                where += " AND ";
+            where += "CATEGORY0 = :CATEGORY0";
+            params.append(QVariant((int) cat0));
+        }
 
-    if (cat1 == 0) {
-        if (!where.isEmpty())
-            where += " AND ";
-        where += "CATEGORY1 IS NULL";
-    } else if (cat1 > 0) {
-        if (!where.isEmpty())
-            where += " AND ";
-        where += "CATEGORY1 = :CATEGORY1";
-        params.append(QVariant((int) cat1));
-    }
+        if (cat1 == 0) {
+            if (!where.isEmpty())
+                where += " AND ";
+            where += "CATEGORY1 IS NULL";
+        } else if (cat1 > 0) {
+            if (!where.isEmpty())
+                where += " AND ";
+            where += "CATEGORY1 = :CATEGORY1";
+            params.append(QVariant((int) cat1));
+        }
 
-    if (!where.isEmpty())
-        where = "WHERE " + where;
+        if (!where.isEmpty())
+            where = "WHERE " + where;
 
-    QString sql = QString("SELECT CATEGORY.ID, COUNT(*), CATEGORY.NAME FROM "
-            "PACKAGE LEFT JOIN CATEGORY ON PACKAGE.CATEGORY") +
-            QString::number(level) +
-            " = CATEGORY.ID " +
-            where + " GROUP BY CATEGORY.ID, CATEGORY.NAME "
-            "ORDER BY CATEGORY.NAME";
+        // CROSS JOIN forces SQLite to use the full-text index first
+        QString from;
+        if (match.isEmpty())
+            from = "PACKAGE";
+        else
+            from = "PACKAGE_FTS CROSS JOIN PACKAGE "
+                    "ON PACKAGE.ROWID = PACKAGE_FTS.DOCID";
 
-    MySQLQuery q(db);
+        sql = "SELECT CATEGORY.ID, COUNT(*), CATEGORY.NAME FROM " + from +
+                " LEFT JOIN CATEGORY ON PACKAGE.CATEGORY" +
+                QString::number(level) +
+                " = CATEGORY.ID " +
+                where + " GROUP BY CATEGORY.ID, CATEGORY.NAME "
+                "ORDER BY CATEGORY.NAME";
+    }
 
-    if (!q.prepare(sql))
-        *err = getErrorString(q);
+    MySQLQuery* q = getReadQuery(sql, err);
 
     if (err->isEmpty()) {
         for (int i = 0; i < params.count(); i++) {
-            q.bindValue(i, params.at(i));
+            q->bindValue(i, params.at(i));
         }
     }
 
     QList<QStringList> r;
     if (err->isEmpty()) {
-        if (!q.exec())
-            *err = getErrorString(q);
+        if (!q->exec())
+            *err = getErrorString(*q);
 
-        while (q.next()) {
+        while (q->next()) {
             QStringList sl;
-            sl.append(q.value(0).toString());
-            sl.append(q.value(1).toString());
-            sl.append(q.value(2).toString());
+            sl.append(q->value(0).toString());
+            sl.append(q->value(1).toString());
+            sl.append(q->value(2).toString());
             r.append(sl);
         }
     }
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
@@ -641,7 +1102,6 @@ QStringList DBRepository::findPackagesWhere(const QString& where,
     *err = "";
 
     QStringList r;
-    MySQLQuery q(db);
 
     QString sql = "SELECT NAME FROM PACKAGE";
 
@@ -650,44 +1110,116 @@ QStringList DBRepository::findPackagesWhere(const QString& where,
 
     sql += " ORDER BY TITLE";
 
-    if (!q.prepare(sql))
-        *err = getErrorString(q);
+    MySQLQuery* q = getReadQuery(sql, err);
 
     if (err->isEmpty()) {
         for (int i = 0; i < params.count(); i++) {
-            q.bindValue(i, params.at(i));
+            q->bindValue(i, params.at(i));
         }
     }
 
     if (err->isEmpty()) {
-        if (!q.exec())
-            *err = getErrorString(q);
+        if (!q->exec())
+            *err = getErrorString(*q);
 
-        while (q.next()) {
-            r.append(q.value(0).toString());
+        while (q->next()) {
+            r.append(q->value(0).toString());
         }
     }
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
-int DBRepository::insertCategory(int parent, int level,
-        const QString& category, QString* err)
+/**
+ * @brief a package found by the full-text search
+ */
+struct RankedPackage
+{
+    QString name;
+    QString title;
+    double rank;
+};
+
+static bool rankedPackageLessThan(const RankedPackage& a,
+        const RankedPackage& b)
+{
+    if (a.rank != b.rank)
+        return a.rank > b.rank;
+
+    return a.title.compare(b.title, Qt::CaseInsensitive) < 0;
+}
+
+QStringList DBRepository::findPackagesRanked(const QString& where,
+        const QList<QVariant>& params,
+        QString *err) const
 {
     *err = "";
 
-    if (!selectCategoryQuery) {
-        selectCategoryQuery = new MySQLQuery(db);
+    QStringList r;
+
+    // CROSS JOIN forces SQLite to use the full-text index first
+    QString sql = "SELECT PACKAGE.NAME, PACKAGE.TITLE, "
+            "matchinfo(PACKAGE_FTS, 'pcx') "
+            "FROM PACKAGE_FTS CROSS JOIN PACKAGE "
+            "ON PACKAGE.ROWID = PACKAGE_FTS.DOCID " + where;
 
-        QString sql = "SELECT ID FROM CATEGORY WHERE PARENT = :PARENT AND "
-                "LEVEL = :LEVEL AND NAME = :NAME";
+    MySQLQuery* q = getReadQuery(sql, err);
 
-        if (!selectCategoryQuery->prepare(sql)) {
-            *err = getErrorString(*selectCategoryQuery);
-            delete selectCategoryQuery;
+    if (err->isEmpty()) {
+        for (int i = 0; i < params.count(); i++) {
+            q->bindValue(i, params.at(i));
+        }
+    }
+
+    QList<RankedPackage> found;
+    if (err->isEmpty()) {
+        if (!q->exec())
+            *err = getErrorString(*q);
+
+        while (q->next()) {
+            RankedPackage rp;
+            rp.name = q->value(0).toString();
+            rp.title = q->value(1).toString();
+            rp.rank = rankFTSMatch(q->value(2).toByteArray());
+            found.append(rp);
         }
     }
 
+    qStableSort(found.begin(), found.end(), rankedPackageLessThan);
+
+    for (int i = 0; i < found.count(); i++) {
+        r.append(found.at(i).name);
+    }
+
+    if (q)
+        q->finish();
+
+    return r;
+}
+
+int DBRepository::insertCategory(int parent, int level,
+        const QString& category, QString* err)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    *err = "";
+
+    QString key;
+    if (ingesting) {
+        key = QString::number(parent) + "/" + QString::number(level) + "/" +
+                category;
+        int id = ingestCategories.value(key, -1);
+        if (id >= 0)
+            return id;
+    }
+
+    QString sql = "SELECT ID FROM CATEGORY WHERE PARENT = :PARENT AND "
+            "LEVEL = :LEVEL AND NAME = :NAME";
+    MySQLQuery* selectCategoryQuery = getQuery(sql, err);
+
     if (err->isEmpty()) {
         selectCategoryQuery->bindValue(":NAME", category);
         selectCategoryQuery->bindValue(":PARENT", parent);
@@ -701,43 +1233,65 @@ int DBRepository::insertCategory(int parent, int level,
         if (selectCategoryQuery->next())
             id = selectCategoryQuery->value(0).toInt();
         else {
-            MySQLQuery q(db);
-            QString sql = "INSERT INTO CATEGORY "
+            sql = "INSERT INTO CATEGORY "
                     "(ID, NAME, PARENT, LEVEL) "
                     "VALUES (NULL, :NAME, :PARENT, :LEVEL)";
-            if (!q.prepare(sql))
-                *err = getErrorString(q);
+            MySQLQuery* q = getQuery(sql, err);
 
             if (err->isEmpty()) {
-                q.bindValue(":NAME", category);
-                q.bindValue(":PARENT", parent);
-                q.bindValue(":LEVEL", level);
-                if (!q.exec())
-                    *err = getErrorString(q);
+                q->bindValue(":NAME", category);
+                q->bindValue(":PARENT", parent);
+                q->bindValue(":LEVEL", level);
+                if (!q->exec())
+                    *err = getErrorString(*q);
                 else
-                    id = q.lastInsertId().toInt();
+                    id = q->lastInsertId().toInt();
+                q->finish();
             }
         }
     }
 
-    selectCategoryQuery->finish();
+    if (selectCategoryQuery)
+        selectCategoryQuery->finish();
+
+    if (ingesting && err->isEmpty() && id >= 0)
+        ingestCategories.insert(key, id);
 
     return id;
 }
 
-QString DBRepository::deleteLinks(const QString& name)
+QString DBRepository::insertCategories(Package* p, int* ids)
 {
     QString err;
 
-    if (!deleteLinkQuery) {
-        deleteLinkQuery = new MySQLQuery(db);
-        if (!deleteLinkQuery->prepare(
-                "DELETE FROM LINK WHERE PACKAGE=:PACKAGE")) {
-            err = getErrorString(*deleteLinkQuery);
-            delete deleteLinkQuery;
+    for (int i = 0; i < 5; i++) {
+        ids[i] = 0;
+    }
+
+    if (p->categories.count() > 0) {
+        QString category = p->categories.at(0);
+        QStringList cats = category.split('/');
+        for (int i = 0; i < cats.length() && i < 5; i++) {
+            if (!err.isEmpty())
+                break;
+
+            ids[i] = insertCategory(i == 0 ? 0 : ids[i - 1], i,
+                    cats.at(i).trimmed(), &err);
         }
     }
 
+    return err;
+}
+
+QString DBRepository::deleteLinks(const QString& name)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err;
+
+    MySQLQuery* deleteLinkQuery = getQuery(
+            "DELETE FROM LINK WHERE PACKAGE=:PACKAGE", &err);
+
     if (err.isEmpty()) {
         deleteLinkQuery->bindValue(":PACKAGE", name);
         if (!deleteLinkQuery->exec())
@@ -748,23 +1302,126 @@ QString DBRepository::deleteLinks(const QString& name)
     return err;
 }
 
-QString DBRepository::saveLinks(Package* p)
+QString DBRepository::deleteFTS(const QString& name)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     QString err;
 
-    if (!insertLinkQuery) {
-        insertLinkQuery = new MySQLQuery(db);
+    MySQLQuery* deleteFTSQuery = getQuery(
+            "DELETE FROM PACKAGE_FTS WHERE DOCID IN "
+            "(SELECT ROWID FROM PACKAGE WHERE NAME=:NAME)", &err);
+
+    if (err.isEmpty()) {
+        deleteFTSQuery->bindValue(":NAME", name);
+        if (!deleteFTSQuery->exec())
+            err = getErrorString(*deleteFTSQuery);
+        deleteFTSQuery->finish();
+    }
+
+    return err;
+}
+
+QString DBRepository::updateCategoryCounts()
+{
+    QString err = exec("DELETE FROM CATEGORY_COUNT");
+
+    // level 0 entries use 0 as PARENT. Un-categorized packages are counted
+    // under the category 0.
+    if (err.isEmpty())
+        err = exec("INSERT INTO CATEGORY_COUNT(LEVEL, PARENT, CATEGORY, "
+                "STATUS, N) "
+                "SELECT 0, 0, IFNULL(CATEGORY0, 0), STATUS, COUNT(*) "
+                "FROM PACKAGE GROUP BY IFNULL(CATEGORY0, 0), STATUS");
+    if (err.isEmpty())
+        err = exec("INSERT INTO CATEGORY_COUNT(LEVEL, PARENT, CATEGORY, "
+                "STATUS, N) "
+                "SELECT 1, IFNULL(CATEGORY0, 0), IFNULL(CATEGORY1, 0), "
+                "STATUS, COUNT(*) "
+                "FROM PACKAGE GROUP BY IFNULL(CATEGORY0, 0), "
+                "IFNULL(CATEGORY1, 0), STATUS");
+
+    return err;
+}
+
+QString DBRepository::adjustCategoryCounts(const QString& package, int delta)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err;
 
-        QString insertSQL = "INSERT INTO LINK "
-                "(PACKAGE, INDEX_, REL, HREF) "
-                "VALUES(:PACKAGE, :INDEX_, :REL, :HREF)";
+    if (delta > 0) {
+        MySQLQuery* q = getQuery("INSERT OR IGNORE INTO CATEGORY_COUNT("
+                "LEVEL, PARENT, CATEGORY, STATUS, N) "
+                "SELECT 0, 0, IFNULL(CATEGORY0, 0), STATUS, 0 "
+                "FROM PACKAGE WHERE NAME = :NAME "
+                "UNION ALL "
+                "SELECT 1, IFNULL(CATEGORY0, 0), IFNULL(CATEGORY1, 0), "
+                "STATUS, 0 FROM PACKAGE WHERE NAME = :NAME2", &err);
+        if (err.isEmpty()) {
+            q->bindValue(":NAME", package);
+            q->bindValue(":NAME2", package);
+            if (!q->exec())
+                err = getErrorString(*q);
+            q->finish();
+        }
+    }
 
-        if (!insertLinkQuery->prepare(insertSQL)) {
-            err = getErrorString(*insertLinkQuery);
-            delete insertLinkQuery;
+    if (err.isEmpty()) {
+        MySQLQuery* q = getQuery("UPDATE CATEGORY_COUNT SET N = N + :DELTA "
+                "WHERE ROWID IN (SELECT C.ROWID FROM CATEGORY_COUNT C, "
+                "PACKAGE P WHERE P.NAME = :NAME AND C.STATUS = P.STATUS AND "
+                "((C.LEVEL = 0 AND C.PARENT = 0 AND "
+                "C.CATEGORY = IFNULL(P.CATEGORY0, 0)) OR "
+                "(C.LEVEL = 1 AND C.PARENT = IFNULL(P.CATEGORY0, 0) AND "
+                "C.CATEGORY = IFNULL(P.CATEGORY1, 0))))", &err);
+        if (err.isEmpty()) {
+            q->bindValue(":DELTA", delta);
+            q->bindValue(":NAME", package);
+            if (!q->exec())
+                err = getErrorString(*q);
+            q->finish();
         }
     }
 
+    return err;
+}
+
+QString DBRepository::saveFTS(qlonglong rowid, Package* p)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err;
+
+    MySQLQuery* insertFTSQuery = getQuery(
+            "INSERT INTO PACKAGE_FTS "
+            "(DOCID, TITLE, DESCRIPTION, NAME) "
+            "VALUES(:DOCID, :TITLE, :DESCRIPTION, :NAME)", &err);
+
+    if (err.isEmpty()) {
+        insertFTSQuery->bindValue(":DOCID", rowid);
+        insertFTSQuery->bindValue(":TITLE", p->title.toLower());
+        insertFTSQuery->bindValue(":DESCRIPTION", p->description.toLower());
+        insertFTSQuery->bindValue(":NAME", p->name.toLower());
+        if (!insertFTSQuery->exec())
+            err = getErrorString(*insertFTSQuery);
+        insertFTSQuery->finish();
+    }
+
+    return err;
+}
+
+QString DBRepository::saveLinks(Package* p)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err;
+
+    QString insertSQL = "INSERT INTO LINK "
+            "(PACKAGE, INDEX_, REL, HREF) "
+            "VALUES(:PACKAGE, :INDEX_, :REL, :HREF)";
+    MySQLQuery* insertLinkQuery = getQuery(insertSQL, &err);
+
     QList<QString> rels = p->links.uniqueKeys();
     int index = 1;
     for (int i = 0; i < rels.size(); i++) {
@@ -792,7 +1449,8 @@ QString DBRepository::saveLinks(Package* p)
         }
     }
 
-    insertLinkQuery->finish();
+    if (insertLinkQuery)
+        insertLinkQuery->finish();
 
     return err;
 }
@@ -800,6 +1458,8 @@ QString DBRepository::saveLinks(Package* p)
 
 QString DBRepository::savePackage(Package *p, bool replace)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     QString err;
 
     /*
@@ -807,84 +1467,43 @@ QString DBRepository::savePackage(Package *p, bool replace)
         qDebug() << p->name << "->" << p->description;
         */
 
-    int cat0 = 0;
-    int cat1 = 0;
-    int cat2 = 0;
-    int cat3 = 0;
-    int cat4 = 0;
-
-    if (p->categories.count() > 0) {
-        QString category = p->categories.at(0);
-        QStringList cats = category.split('/');
-        for (int i = 0; i < cats.length(); i++) {
-            cats[i] = cats.at(i).trimmed();
-        }
-
-        QString c;
-        if (cats.count() > 0) {
-            c = cats.at(0);
-            cat0 = insertCategory(0, 0, c, &err);
-        }
-        if (cats.count() > 1) {
-            c = cats.at(1);
-            cat1 = insertCategory(cat0, 1, c, &err);
-        }
-        if (cats.count() > 2) {
-            c = cats.at(2);
-            cat2 = insertCategory(cat1, 2, c, &err);
-        }
-        if (cats.count() > 3) {
-            c = cats.at(3);
-            cat3 = insertCategory(cat2, 3, c, &err);
-        }
-        if (cats.count() > 4) {
-            c = cats.at(4);
-            cat4 = insertCategory(cat3, 4, c, &err);
-        }
-    }
-
-    if (!insertPackageQuery) {
-        insertPackageQuery = new MySQLQuery(db);
-        replacePackageQuery = new MySQLQuery(db);
-
-        QString insertSQL = "INSERT OR IGNORE";
-        QString replaceSQL = "INSERT OR REPLACE";
-
-        QString add = " INTO PACKAGE "
-                "(REPOSITORY, NAME, TITLE, URL, ICON, "
-                "DESCRIPTION, LICENSE, FULLTEXT, "
-                "STATUS, SHORT_NAME, CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3,"
-                " CATEGORY4)"
-                "VALUES(:REPOSITORY, :NAME, :TITLE, :URL, "
-                ":ICON, :DESCRIPTION, :LICENSE, "
-                ":FULLTEXT, :STATUS, :SHORT_NAME, "
-                ":CATEGORY0, :CATEGORY1, :CATEGORY2, :CATEGORY3, :CATEGORY4)";
-
-        insertSQL += add;
-        replaceSQL += add;
-
-        if (!insertPackageQuery->prepare(insertSQL)) {
-            err = getErrorString(*insertPackageQuery);
-            delete insertPackageQuery;
-            delete replacePackageQuery;
-        }
-
-        if (err.isEmpty()) {
-            if (!replacePackageQuery->prepare(replaceSQL)) {
-                err = getErrorString(*replacePackageQuery);
-                delete insertPackageQuery;
-                delete replacePackageQuery;
-            }
-        }
-    }
+    int cats[5];
+    err = insertCategories(p, cats);
+    int cat0 = cats[0];
+    int cat1 = cats[1];
+    int cat2 = cats[2];
+    int cat3 = cats[3];
+    int cat4 = cats[4];
 
-    MySQLQuery* savePackageQuery;
+    QString sql = "INSERT OR ";
     if (replace)
-        savePackageQuery = replacePackageQuery;
+        sql += "REPLACE";
     else
-        savePackageQuery = insertPackageQuery;
+        sql += "IGNORE";
+    sql += " INTO PACKAGE "
+            "(REPOSITORY, NAME, TITLE, URL, ICON, "
+            "DESCRIPTION, LICENSE, "
+            "STATUS, SHORT_NAME, CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3,"
+            " CATEGORY4)"
+            "VALUES(:REPOSITORY, :NAME, :TITLE, :URL, "
+            ":ICON, :DESCRIPTION, :LICENSE, "
+            ":STATUS, :SHORT_NAME, "
+            ":CATEGORY0, :CATEGORY1, :CATEGORY2, :CATEGORY3, :CATEGORY4)";
+
+    MySQLQuery* savePackageQuery = 0;
+    if (err.isEmpty())
+        savePackageQuery = getQuery(sql, &err);
+
+    // INSERT OR REPLACE assigns a new ROWID to the package and the old
+    // full-text entry would be orphaned
+    if (err.isEmpty() && replace)
+        err = deleteFTS(p->name);
+
+    if (err.isEmpty() && replace)
+        err = adjustCategoryCounts(p->name, -1);
 
     int affected = 0;
+    qlonglong rowid = 0;
     if (err.isEmpty()) {
         savePackageQuery->bindValue(":REPOSITORY", this->currentRepository);
         savePackageQuery->bindValue(":NAME", p->name);
@@ -893,8 +1512,6 @@ QString DBRepository::savePackage(Package *p, bool replace)
         savePackageQuery->bindValue(":ICON", p->getIcon());
         savePackageQuery->bindValue(":DESCRIPTION", p->description);
         savePackageQuery->bindValue(":LICENSE", p->license);
-        savePackageQuery->bindValue(":FULLTEXT", (p->title + " " + p->description + " " +
-                p->name).toLower());
         savePackageQuery->bindValue(":STATUS", 0);
         savePackageQuery->bindValue(":SHORT_NAME", p->getShortName());
         if (cat0 == 0)
@@ -919,14 +1536,28 @@ QString DBRepository::savePackage(Package *p, bool replace)
             savePackageQuery->bindValue(":CATEGORY4", cat4);
         if (!savePackageQuery->exec())
             err = getErrorString(*savePackageQuery);
-        else
+        else {
             affected = savePackageQuery->numRowsAffected();
+            rowid = savePackageQuery->lastInsertId().toLongLong();
+        }
     }
 
-    savePackageQuery->finish();
+    if (savePackageQuery)
+        savePackageQuery->finish();
 
     bool exists = affected == 0;
 
+    if (err.isEmpty()) {
+        if (!exists)
+            err = saveFTS(rowid, p);
+    }
+
+    // an ignored package was not un-counted above
+    if (err.isEmpty()) {
+        if (!exists)
+            err = adjustCategoryCounts(p->name, 1);
+    }
+
     if (err.isEmpty()) {
         if (!exists)
             err = deleteLinks(p->name);
@@ -955,39 +1586,332 @@ QString DBRepository::saveLicense(License *p)
     return saveLicense(p, true);
 }
 
-QList<Package*> DBRepository::findPackagesByShortName(const QString &name)
+QString DBRepository::optimizeForBulkLoad()
+{
+    QString err = exec("PRAGMA journal_mode = OFF");
+    if (err.isEmpty())
+        err = exec("PRAGMA synchronous = OFF");
+
+    // 64 MiB
+    if (err.isEmpty())
+        err = exec("PRAGMA cache_size = -65536");
+    if (err.isEmpty())
+        err = exec("PRAGMA temp_store = MEMORY");
+
+    return err;
+}
+
+QString DBRepository::beginIngest()
 {
+    Q_ASSERT(!ingesting);
+
     QString err;
 
-    QList<Package*> r;
+    int n = count("SELECT (SELECT COUNT(*) FROM PACKAGE) + "
+            "(SELECT COUNT(*) FROM PACKAGE_VERSION) + "
+            "(SELECT COUNT(*) FROM LICENSE)", &err);
+    if (err.isEmpty() && n != 0)
+        err = QObject::tr("The bulk ingest requires an empty database");
 
-    MySQLQuery q(db);
-    if (!q.prepare("SELECT NAME, TITLE, URL, ICON, "
-            "DESCRIPTION, LICENSE, CATEGORY0, "
-            "CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4 "
-            "FROM PACKAGE WHERE SHORT_NAME = :SHORT_NAME "
-            "LIMIT 1"))
-        err = getErrorString(q);
+    if (err.isEmpty())
+        err = dropIndexes();
 
     if (err.isEmpty()) {
-        q.bindValue(":SHORT_NAME", name);
-        if (!q.exec())
-            err = getErrorString(q);
+        ingesting = true;
+        ingestRowID = 1;
     }
 
-    while (err.isEmpty() && q.next()) {
-        Package* p = new Package(q.value(0).toString(), q.value(1).toString());
-        p->url = q.value(2).toString();
-        p->setIcon(q.value(3).toString());
-        p->description = q.value(4).toString();
-        p->license = q.value(5).toString();
-
+    return err;
+}
+
+QString DBRepository::ingestPackage(Package* p)
+{
+    Q_ASSERT(ingesting);
+
+    QString err;
+
+    if (ingestedPackages.contains(p->name))
+        return err;
+
+    int cats[5];
+    err = insertCategories(p, cats);
+
+    if (err.isEmpty()) {
+        ingestedPackages.insert(p->name);
+
+        qlonglong rowid = ingestRowID++;
+        ingestPackageRows << rowid << this->currentRepository << p->name <<
+                p->title << p->url << p->getIcon() << p->description <<
+                p->license << 0 << p->getShortName();
+        for (int i = 0; i < 5; i++) {
+            if (cats[i] == 0)
+                ingestPackageRows << QVariant(QVariant::Int);
+            else
+                ingestPackageRows << cats[i];
+        }
+
+        ingestFTSRows << rowid << p->title.toLower() <<
+                p->description.toLower() << p->name.toLower();
+
+        // the same numbering as in saveLinks()
+        QList<QString> rels = p->links.uniqueKeys();
+        int index = 1;
+        for (int i = 0; i < rels.size(); i++) {
+            QString rel = rels.at(i);
+            QList<QString> hrefs = p->links.values(rel);
+            for (int j = 0; j < hrefs.size(); j++) {
+                QString href = hrefs.at(j);
+                if (!rel.isEmpty() && !href.isEmpty()) {
+                    ingestLinkRows << p->name << index << rel << href;
+                    index++;
+                }
+            }
+        }
+    }
+
+    if (err.isEmpty())
+        err = insertRows("PACKAGE", "ROWID, REPOSITORY, NAME, TITLE, URL, "
+                "ICON, DESCRIPTION, LICENSE, STATUS, SHORT_NAME, "
+                "CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4", 15,
+                &ingestPackageRows, false);
+    if (err.isEmpty())
+        err = insertRows("PACKAGE_FTS", "DOCID, TITLE, DESCRIPTION, NAME", 4,
+                &ingestFTSRows, false);
+    if (err.isEmpty())
+        err = insertRows("LINK", "PACKAGE, INDEX_, REL, HREF", 4,
+                &ingestLinkRows, false);
+
+    return err;
+}
+
+QString DBRepository::ingestPackageVersion(PackageVersion* p)
+{
+    Q_ASSERT(ingesting);
+
+    Version v = p->version;
+    v.normalize();
+    QString name = v.getVersionString();
+
+    QString key = p->package + "@" + name;
+    if (ingestedPackageVersions.contains(key))
+        return "";
+    ingestedPackageVersions.insert(key);
+
+    ingestPackageVersionRows << this->currentRepository << name <<
+            p->package << p->download.toString() << QVariant(p->toBinary()) <<
+            p->msiGUID << p->detectFiles.count() << v.getSortKey() <<
+            (p->download.isValid() ? 1 : 0) << (p->installed() ? 1 : 0);
+
+    return insertRows("PACKAGE_VERSION", "REPOSITORY, NAME, PACKAGE, URL, "
+            "CONTENT, MSIGUID, DETECT_FILE_COUNT, VERSION_KEY, HAS_DOWNLOAD, "
+            "INSTALLED", 10, &ingestPackageVersionRows, false);
+}
+
+QString DBRepository::ingestLicense(License* p)
+{
+    Q_ASSERT(ingesting);
+
+    if (ingestedLicenses.contains(p->name))
+        return "";
+    ingestedLicenses.insert(p->name);
+
+    ingestLicenseRows << this->currentRepository << p->name << p->title <<
+            p->description << p->url;
+
+    return insertRows("LICENSE", "REPOSITORY, NAME, TITLE, DESCRIPTION, URL",
+            5, &ingestLicenseRows, false);
+}
+
+QString DBRepository::endIngest()
+{
+    Q_ASSERT(ingesting);
+
+    QString err = insertRows("PACKAGE", "ROWID, REPOSITORY, NAME, TITLE, URL, "
+            "ICON, DESCRIPTION, LICENSE, STATUS, SHORT_NAME, "
+            "CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4", 15,
+            &ingestPackageRows, true);
+    if (err.isEmpty())
+        err = insertRows("PACKAGE_FTS", "DOCID, TITLE, DESCRIPTION, NAME", 4,
+                &ingestFTSRows, true);
+    if (err.isEmpty())
+        err = insertRows("LINK", "PACKAGE, INDEX_, REL, HREF", 4,
+                &ingestLinkRows, true);
+    if (err.isEmpty())
+        err = insertRows("PACKAGE_VERSION", "REPOSITORY, NAME, PACKAGE, URL, "
+                "CONTENT, MSIGUID, DETECT_FILE_COUNT, VERSION_KEY, "
+                "HAS_DOWNLOAD, INSTALLED", 10, &ingestPackageVersionRows,
+                true);
+    if (err.isEmpty())
+        err = insertRows("LICENSE", "REPOSITORY, NAME, TITLE, DESCRIPTION, URL",
+                5, &ingestLicenseRows, true);
+    if (err.isEmpty())
+        err = updateCategoryCounts();
+
+    // the indexes are re-created even if the load failed as the database
+    // may be used further
+    QString err2 = createIndexes();
+    if (err.isEmpty())
+        err = err2;
+
+    ingesting = false;
+    ingestedPackages.clear();
+    ingestedPackageVersions.clear();
+    ingestedLicenses.clear();
+    ingestCategories.clear();
+    ingestPackageRows.clear();
+    ingestFTSRows.clear();
+    ingestLinkRows.clear();
+    ingestPackageVersionRows.clear();
+    ingestLicenseRows.clear();
+
+    return err;
+}
+
+QString DBRepository::insertRows(const QString& table, const QString& columns,
+        int ncolumns, QList<QVariant>* values, bool all)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err;
+
+    // SQLite allows at most 999 parameters in one statement
+    int batch = 999 / ncolumns;
+    int rows = values->count() / ncolumns;
+
+    QString row = "(" + QString("?, ").repeated(ncolumns - 1) + "?)";
+
+    int done = 0;
+    while (err.isEmpty() && (rows - done >= batch ||
+            (all && rows - done > 0))) {
+        int n = qMin(batch, rows - done);
+
+        QString sql = "INSERT INTO " + table + "(" + columns + ") VALUES ";
+        for (int i = 0; i < n; i++) {
+            if (i != 0)
+                sql.append(", ");
+            sql.append(row);
+        }
+
+        // only the complete batches are cached as the statement for the
+        // rest is only used once
+        MySQLQuery rest(db);
+        MySQLQuery* q = 0;
+        if (n == batch)
+            q = getQuery(sql, &err);
+        else {
+            q = &rest;
+            if (!rest.prepare(sql))
+                err = getErrorString(rest);
+        }
+
+        if (err.isEmpty()) {
+            int first = done * ncolumns;
+            for (int i = 0; i < n * ncolumns; i++) {
+                q->bindValue(i, values->at(first + i));
+            }
+            if (!q->exec())
+                err = getErrorString(*q);
+            q->finish();
+        }
+
+        done += n;
+    }
+
+    values->erase(values->begin(), values->begin() + done * ncolumns);
+
+    return err;
+}
+
+/**
+ * Indexes that are not necessary while the data is loaded in the bulk ingest
+ * mode: name and SQL.
+ */
+static const char* const INDEXES[][2] = {
+    {"PACKAGE_NAME",
+            "CREATE UNIQUE INDEX IF NOT EXISTS PACKAGE_NAME ON PACKAGE(NAME)"},
+    {"PACKAGE_SHORT_NAME",
+            "CREATE INDEX IF NOT EXISTS PACKAGE_SHORT_NAME ON "
+            "PACKAGE(SHORT_NAME)"},
+    {"PACKAGE_VERSION_PACKAGE_KEY",
+            "CREATE INDEX IF NOT EXISTS PACKAGE_VERSION_PACKAGE_KEY ON "
+            "PACKAGE_VERSION(PACKAGE, VERSION_KEY)"},
+    {"PACKAGE_VERSION_PACKAGE_NAME",
+            "CREATE UNIQUE INDEX IF NOT EXISTS PACKAGE_VERSION_PACKAGE_NAME ON "
+            "PACKAGE_VERSION(PACKAGE, NAME)"},
+    {"PACKAGE_VERSION_MSIGUID",
+            "CREATE INDEX IF NOT EXISTS PACKAGE_VERSION_MSIGUID ON "
+            "PACKAGE_VERSION(MSIGUID)"},
+    {"PACKAGE_VERSION_DETECT_FILE_COUNT",
+            "CREATE INDEX IF NOT EXISTS PACKAGE_VERSION_DETECT_FILE_COUNT ON "
+            "PACKAGE_VERSION(DETECT_FILE_COUNT)"},
+    {"LICENSE_NAME",
+            "CREATE UNIQUE INDEX IF NOT EXISTS LICENSE_NAME ON LICENSE(NAME)"},
+    {"LINK_PACKAGE",
+            "CREATE INDEX IF NOT EXISTS LINK_PACKAGE ON LINK(PACKAGE)"},
+};
+
+QString DBRepository::createIndexes()
+{
+    QString err;
+
+    int n = sizeof(INDEXES) / sizeof(INDEXES[0]);
+    for (int i = 0; i < n; i++) {
+        if (!err.isEmpty())
+            break;
+
+        err = exec(QString::fromLatin1(INDEXES[i][1]));
+    }
+
+    return err;
+}
+
+QString DBRepository::dropIndexes()
+{
+    QString err;
+
+    int n = sizeof(INDEXES) / sizeof(INDEXES[0]);
+    for (int i = 0; i < n; i++) {
+        if (!err.isEmpty())
+            break;
+
+        err = exec("DROP INDEX IF EXISTS " +
+                QString::fromLatin1(INDEXES[i][0]));
+    }
+
+    return err;
+}
+
+QList<Package*> DBRepository::findPackagesByShortName(const QString &name)
+{
+    QString err;
+
+    QList<Package*> r;
+
+    MySQLQuery* q = getReadQuery("SELECT NAME, TITLE, URL, ICON, "
+            "DESCRIPTION, LICENSE, CATEGORY0, "
+            "CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4 "
+            "FROM PACKAGE WHERE SHORT_NAME = :SHORT_NAME "
+            "LIMIT 1", &err);
+
+    if (err.isEmpty()) {
+        q->bindValue(":SHORT_NAME", name);
+        if (!q->exec())
+            err = getErrorString(*q);
+    }
+
+    while (err.isEmpty() && q->next()) {
+        Package* p = new Package(q->value(0).toString(), q->value(1).toString());
+        p->url = q->value(2).toString();
+        p->setIcon(q->value(3).toString());
+        p->description = q->value(4).toString();
+        p->license = q->value(5).toString();
+
         QString path = getCategoryPath(
-                q.value(6).toInt(),
-                q.value(7).toInt(),
-                q.value(8).toInt(),
-                q.value(9).toInt(),
-                q.value(10).toInt());
+                q->value(6).toInt(),
+                q->value(7).toInt(),
+                q->value(8).toInt(),
+                q->value(9).toInt(),
+                q->value(10).toInt());
         if (!path.isEmpty())
             p->categories.append(path);
 
@@ -997,6 +1921,9 @@ QList<Package*> DBRepository::findPackagesByShortName(const QString &name)
         r.append(p);
     }
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
@@ -1006,47 +1933,45 @@ QString DBRepository::readLinks(Package* p)
 
     QList<Package*> r;
 
-    MySQLQuery q(db);
-    if (!q.prepare("SELECT REL, HREF "
+    MySQLQuery* q = getReadQuery("SELECT REL, HREF "
             "FROM LINK WHERE PACKAGE = :PACKAGE "
-            "ORDER BY INDEX_"))
-        err = getErrorString(q);
+            "ORDER BY INDEX_", &err);
 
     if (err.isEmpty()) {
-        q.bindValue(":PACKAGE", p->name);
-        if (!q.exec())
-            err = getErrorString(q);
+        q->bindValue(":PACKAGE", p->name);
+        if (!q->exec())
+            err = getErrorString(*q);
     }
 
-    while (err.isEmpty() && q.next()) {
-        p->links.insert(q.value(0).toString(), q.value(1).toString());
+    while (err.isEmpty() && q->next()) {
+        p->links.insert(q->value(0).toString(), q->value(1).toString());
     }
 
+    if (q)
+        q->finish();
+
     return err;
 }
 
 QString DBRepository::savePackageVersion(PackageVersion *p, bool replace)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     QString err;
 
-    if (!savePackageVersionQuery) {
-        savePackageVersionQuery = new MySQLQuery(db);
-        QString sql = "INSERT OR ";
-        if (replace)
-            sql += "REPLACE";
-        else
-            sql += "IGNORE";
-        sql += " INTO PACKAGE_VERSION "
-                "(NAME, PACKAGE, URL, "
-                "CONTENT, MSIGUID, DETECT_FILE_COUNT)"
-                "VALUES(:NAME, :PACKAGE, "
-                ":URL, :CONTENT, :MSIGUID, "
-                ":DETECT_FILE_COUNT)";
-        if (!savePackageVersionQuery->prepare(sql)) {
-            err = getErrorString(*savePackageVersionQuery);
-            delete savePackageVersionQuery;
-        }
-    }
+    QString sql = "INSERT OR ";
+    if (replace)
+        sql += "REPLACE";
+    else
+        sql += "IGNORE";
+    sql += " INTO PACKAGE_VERSION "
+            "(REPOSITORY, NAME, PACKAGE, URL, "
+            "CONTENT, MSIGUID, DETECT_FILE_COUNT, VERSION_KEY, "
+            "HAS_DOWNLOAD, INSTALLED)"
+            "VALUES(:REPOSITORY, :NAME, :PACKAGE, "
+            ":URL, :CONTENT, :MSIGUID, "
+            ":DETECT_FILE_COUNT, :VERSION_KEY, :HAS_DOWNLOAD, :INSTALLED)";
+    MySQLQuery* savePackageVersionQuery = getQuery(sql, &err);
 
     if (err.isEmpty()) {
         Version v = p->version;
@@ -1060,17 +1985,20 @@ QString DBRepository::savePackageVersion(PackageVersion *p, bool replace)
         savePackageVersionQuery->bindValue(":MSIGUID", p->msiGUID);
         savePackageVersionQuery->bindValue(":DETECT_FILE_COUNT",
                 p->detectFiles.count());
-
-        QByteArray file;
-        file.reserve(1024);
-        QXmlStreamWriter w(&file);
-        p->toXML(&w);
-        savePackageVersionQuery->bindValue(":CONTENT", QVariant(file));
+        savePackageVersionQuery->bindValue(":VERSION_KEY", v.getSortKey());
+        savePackageVersionQuery->bindValue(":HAS_DOWNLOAD",
+                p->download.isValid() ? 1 : 0);
+        savePackageVersionQuery->bindValue(":INSTALLED",
+                p->installed() ? 1 : 0);
+
+        savePackageVersionQuery->bindValue(":CONTENT",
+                QVariant(p->toBinary()));
         if (!savePackageVersionQuery->exec())
             err = getErrorString(*savePackageVersionQuery);
     }
 
-    savePackageVersionQuery->finish();
+    if (savePackageVersionQuery)
+        savePackageVersionQuery->finish();
 
     return err;
 }
@@ -1082,39 +2010,25 @@ PackageVersion *DBRepository::findPackageVersionByMSIGUID_(
 
     PackageVersion* r = 0;
 
-    MySQLQuery q(db);
-    if (!q.prepare("SELECT NAME, "
+    MySQLQuery* q = getReadQuery("SELECT NAME, "
             "PACKAGE, CONTENT FROM PACKAGE_VERSION "
-            "WHERE MSIGUID = :MSIGUID"))
-        *err = getErrorString(q);
+            "WHERE MSIGUID = :MSIGUID", err);
 
     if (err->isEmpty()) {
-        q.bindValue(":MSIGUID", guid);
-        if (!q.exec())
-            *err = getErrorString(q);
+        q->bindValue(":MSIGUID", guid);
+        if (!q->exec())
+            *err = getErrorString(*q);
     }
 
     if (err->isEmpty()) {
-        if (q.next()) {
-            QDomDocument doc;
-            int errorLine, errorColumn;
-            if (!doc.setContent(q.value(2).toByteArray(),
-                    err, &errorLine, &errorColumn))
-                *err = QString(
-                        QObject::tr("XML parsing failed at line %1, column %2: %3")).
-                        arg(errorLine).arg(errorColumn).arg(*err);
-
-            if (err->isEmpty()) {
-                QDomElement root = doc.documentElement();
-                PackageVersion* p = PackageVersion::parse(&root, err);
-
-                if (err->isEmpty()) {
-                    r = p;
-                }
-            }
+        if (q->next()) {
+            r = parsePackageVersion(q->value(2).toByteArray(), err);
         }
     }
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
@@ -1128,6 +2042,10 @@ QString DBRepository::clear()
         Job* sub = job->newSubJob(0.1,
                 QObject::tr("Clearing the packages table"));
         QString err = exec("DELETE FROM PACKAGE");
+        if (err.isEmpty())
+            err = exec("DELETE FROM PACKAGE_FTS");
+        if (err.isEmpty())
+            err = exec("DELETE FROM CATEGORY_COUNT");
         if (!err.isEmpty())
             job->setErrorMessage(err);
         else
@@ -1199,53 +2117,113 @@ void DBRepository::load(Job* job, bool useCache)
                     QObject::tr("Error saving the list of repositories in the database: %1").arg(
                     err));
 
-        QList<QFuture<QTemporaryFile*> > files;
-        for (int i = 0; i < urls.count(); i++) {
-            QUrl* url = urls.at(i);
-            Job* s = job->newSubJob(0.1,
-                    QObject::tr("Downloading %1").
-                    arg(url->toDisplayString()), false, true);
-            QFuture<QTemporaryFile*> future = QtConcurrent::run(
-                    Downloader::download2, s, *url,
-                    useCache);
-            files.append(future);
+        bool ingestStarted = false;
+        if (job->shouldProceed()) {
+            QString err = beginIngest();
+            if (err.isEmpty())
+                ingestStarted = true;
+            else
+                job->setErrorMessage(err);
+        }
+
+        // every repository is downloaded in its own thread and parsed in
+        // another one while the data is still arriving
+        QList<PipeBuffer*> pipes;
+        QList<RepositoryDownloadThread*> downloads;
+        QList<Repository*> parsed;
+        QList<Job*> parseJobs;
+        QList<QFuture<void> > futures;
+        if (job->shouldProceed()) {
+            for (int i = 0; i < urls.count(); i++) {
+                PipeBuffer* pipe = new PipeBuffer();
+                pipes.append(pipe);
+
+                RepositoryDownloadThread* t = new RepositoryDownloadThread();
+                t->job = job->newSubJob(0.5 / urls.count(),
+                        QObject::tr("Downloading %1").
+                        arg(urls.at(i)->toDisplayString()), false, false);
+                t->url = *urls.at(i);
+                t->pipe = pipe;
+                t->useCache = useCache;
+                downloads.append(t);
+                t->start();
+
+                Repository* r = new Repository();
+                Job* s = job->newSubJob(0.4 / urls.count(), QString(
+                        QObject::tr("Parsing the repository %1 of %2")).
+                        arg(i + 1).arg(urls.count()), false, false);
+                parsed.append(r);
+                parseJobs.append(s);
+                futures.append(QtConcurrent::run(DBRepository::loadPipe, s,
+                        pipe, r));
+            }
         }
 
-        for (int i = 0; i < urls.count(); i++) {
-            if (!job->shouldProceed())
-                break;
+        // only this thread writes to the database. The repositories are
+        // stored in the order of their priority.
+        for (int i = 0; i < futures.count(); i++) {
+            futures[i].waitForFinished();
+            downloads.at(i)->wait();
 
-            files[i].waitForFinished();
+            if (!job->shouldProceed())
+                continue;
 
-            job->setProgress((i + 1.0) / urls.count() * 0.5);
-        }
+            Job* ds = downloads.at(i)->job;
+            if (!ds->getErrorMessage().isEmpty()) {
+                job->setErrorMessage(QString(
+                        QObject::tr("Error downloading the repository %1: %2")).
+                        arg(urls.at(i)->toString()).arg(
+                        ds->getErrorMessage()));
+                continue;
+            }
 
-        for (int i = 0; i < urls.count(); i++) {
-            if (!job->shouldProceed())
-                break;
+            Job* ps = parseJobs.at(i);
+            if (!ps->getErrorMessage().isEmpty()) {
+                job->setErrorMessage(QString(
+                        QObject::tr("Error loading the repository %1: %2")).arg(
+                        urls.at(i)->toString()).arg(
+                        ps->getErrorMessage()));
+                continue;
+            }
+            job->setProgress(job->getProgress() + 0.9 / urls.count());
 
-            QTemporaryFile* tf = files.at(i).result();
-            Job* s = job->newSubJob(1.0 / urls.count(), QString(
+            Job* s = job->newSubJob(0.1 / urls.count(), QString(
                     QObject::tr("Repository %1 of %2")).arg(i + 1).
                     arg(urls.count()));
             this->currentRepository = i;
             // this is currently unnecessary clearRepository(i);
-            loadOne(s, tf);
-            if (!s->getErrorMessage().isEmpty()) {
+            QString err = ingest(parsed.at(i));
+            if (!err.isEmpty()) {
                 job->setErrorMessage(QString(
                         QObject::tr("Error loading the repository %1: %2")).arg(
-                        urls.at(i)->toString()).arg(
-                        s->getErrorMessage()));
-                break;
+                        urls.at(i)->toString()).arg(err));
+                continue;
             }
-        }
+            s->completeWithProgress();
 
-        for (int i = 0; i < urls.count(); i++) {
-            if (!job->shouldProceed())
-                break;
+            // the memory can be released before the next repository is
+            // written
+            delete parsed.at(i);
+            parsed[i] = 0;
 
-            QTemporaryFile* tf = files.at(i).result();
-            delete tf;
+            // the SHA1 allows updateF5Incremental() to skip this repository
+            // next time if it was not changed
+            setRepositorySHA1(urls.at(i)->toString(),
+                    pipes.at(i)->getHashSum(), &err);
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+        }
+        qDeleteAll(parsed);
+        parsed.clear();
+        qDeleteAll(downloads);
+        downloads.clear();
+        qDeleteAll(pipes);
+        pipes.clear();
+
+        if (ingestStarted) {
+            QString err = endIngest();
+            if (!err.isEmpty() && job->shouldProceed())
+                job->setErrorMessage(err);
         }
     } else {
         job->setErrorMessage(QObject::tr("No repositories defined"));
@@ -1260,54 +2238,209 @@ void DBRepository::load(Job* job, bool useCache)
     job->complete();
 }
 
-void DBRepository::loadOne(Job* job, QFile* f) {
-    QTemporaryDir* dir = 0;
+QString DBRepository::ingest(Repository* r)
+{
+    QString err;
+
+    for (int i = 0; i < r->packages.count(); i++) {
+        err = ingestPackage(r->packages.at(i));
+        if (!err.isEmpty()) {
+            err = QObject::tr("Error saving the package %1: %2").
+                    arg(r->packages.at(i)->title).arg(err);
+            break;
+        }
+    }
+
+    for (int i = 0; i < r->packageVersions.count(); i++) {
+        if (!err.isEmpty())
+            break;
+
+        PackageVersion* pv = r->packageVersions.at(i);
+        err = ingestPackageVersion(pv);
+        if (!err.isEmpty())
+            err = QObject::tr("Error saving the package version %1 %2: %3").
+                    arg(pv->package).arg(pv->version.getVersionString()).
+                    arg(err);
+    }
+
+    for (int i = 0; i < r->licenses.count(); i++) {
+        if (!err.isEmpty())
+            break;
+
+        err = ingestLicense(r->licenses.at(i));
+        if (!err.isEmpty())
+            err = QObject::tr("Error saving the license %1: %2").
+                    arg(r->licenses.at(i)->title).arg(err);
+    }
+
+    return err;
+}
+
+void DBRepository::loadOne(Job* job, QFile* f, Repository* r) {
+    // the format is recognized by the magic bytes
+    QByteArray magic;
     if (job->shouldProceed()) {
-        if (f->open(QFile::ReadOnly) &&
-                f->seek(0) && f->read(4) == QByteArray::fromRawData(
-                "PK\x03\x04", 4)) {
+        if (f->open(QFile::ReadOnly) && f->seek(0))
+            magic = f->read(4);
+        f->close();
+    }
+
+    if (job->shouldProceed() && RepositorySnapshot::isSnapshot(magic)) {
+        Job* sub = job->newSubJob(0.9, QObject::tr("Reading the snapshot"));
+        QString err;
+        if (!f->open(QFile::ReadOnly))
+            err = f->errorString();
+
+        // the records are used directly from the memory mapped file. If the
+        // file cannot be mapped, it is read into memory.
+        if (err.isEmpty()) {
+            qint64 size = f->size();
+            uchar* data = f->map(0, size);
+            if (data) {
+                err = RepositorySnapshot::read(data, size, r);
+                f->unmap(data);
+            } else {
+                QByteArray all = f->readAll();
+                err = RepositorySnapshot::read(
+                        (const uchar*) all.constData(), all.size(), r);
+            }
             f->close();
+        }
+
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else {
+            sub->completeWithProgress();
+            job->setProgress(1);
+        }
+    } else if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.9, QObject::tr("Parsing XML"));
+        QString err;
+
+        // compressed repositories are parsed directly from the decompressed
+        // stream without extracting them to the disk
+        QuaZip* zip = 0;
+        QIODevice* in = 0;
+        if (magic == QByteArray::fromRawData("PK\x03\x04", 4)) {
+            zip = new QuaZip(f->fileName());
+            if (!zip->open(QuaZip::mdUnzip))
+                err = QString(QObject::tr("Cannot open the ZIP file %1: %2")).
+                        arg(f->fileName()).arg(zip->getZipError());
+            else if (!zip->setCurrentFile("Rep.xml", QuaZip::csInsensitive))
+                err = QObject::tr(
+                        "Rep.xml is missing in a repository in ZIP format");
+            else
+                in = new QuaZipFile(zip);
+        } else if (magic.startsWith("\x1f\x8b")) {
+            in = new QuaGzipFile(f->fileName());
+        } else {
+            in = f;
+        }
+
+        if (err.isEmpty() && !in->open(QIODevice::ReadOnly))
+            err = QString(QObject::tr("Error reading %1: %2")).
+                    arg(f->fileName()).arg(in->errorString());
+
+        if (err.isEmpty()) {
+            RepositoryXMLParser parser(r);
+            err = parser.parse(in);
+            in->close();
+        }
 
-            dir = new QTemporaryDir();
-            if (dir->isValid()) {
-                Job* sub = job->newSubJob(0.1, QObject::tr("Extracting"));
-                WPMUtils::unzip(sub, f->fileName(), dir->path() + "\\");
-                if (!sub->getErrorMessage().isEmpty()) {
-                    job->setErrorMessage(QString(
-                            QObject::tr("Unzipping the repository failed: %1")).
-                            arg(f->fileName()).
-                            arg(sub->getErrorMessage()));
-                } else {
-                    QString repfn = dir->path() + "\\Rep.xml";
-                    if (QFile::exists(repfn)) {
-                        f = new QFile(repfn);
-                    } else {
-                        job->setErrorMessage(QObject::tr(
-                                "Rep.xml is missing in a repository in ZIP format"));
-                    }
+        if (in != f)
+            delete in;
+        if (zip) {
+            zip->close();
+            delete zip;
+        }
+
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else {
+            sub->completeWithProgress();
+            job->setProgress(1);
+        }
+    }
+
+    job->complete();
+}
+
+void DBRepository::loadPipe(Job* job, PipeBuffer* pipe, Repository* r)
+{
+    // the format is recognized by the magic bytes
+    QByteArray magic;
+    if (job->shouldProceed())
+        magic = pipe->lookAhead(4);
+    else
+        pipe->abort();
+
+    if (job->shouldProceed() && (RepositorySnapshot::isSnapshot(magic) ||
+            magic == QByteArray::fromRawData("PK\x03\x04", 4) ||
+            magic.startsWith("\x1f\x8b"))) {
+        // snapshots and archives need random access
+        Job* sub = job->newSubJob(0.1,
+                QObject::tr("Writing the repository to a temporary file"));
+        QTemporaryFile tf;
+        QString err;
+        if (!tf.open()) {
+            err = QString(QObject::tr("Error opening file: %1")).
+                    arg(tf.fileName());
+        } else {
+            const int bufferSize = 512 * 1024;
+            char* buffer = new char[bufferSize];
+            while (true) {
+                qint64 n = pipe->read(buffer, bufferSize);
+                if (n <= 0)
+                    break;
+                if (tf.write(buffer, n) < 0) {
+                    err = tf.errorString();
+                    break;
                 }
             }
+            delete[] buffer;
+            tf.close();
         }
-        f->close();
-    }
 
-    if (job->shouldProceed()) {
+        if (!err.isEmpty())
+            pipe->abort();
+        else
+            err = pipe->getWriteError();
+
+        if (err.isEmpty()) {
+            sub->completeWithProgress();
+            Job* ls = job->newSubJob(0.9);
+            loadOne(ls, &tf, r);
+            if (!ls->getErrorMessage().isEmpty())
+                job->setErrorMessage(ls->getErrorMessage());
+        } else {
+            job->setErrorMessage(err);
+        }
+    } else if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.9, QObject::tr("Parsing XML"));
-        RepositoryXMLHandler handler(this);
-        QXmlSimpleReader reader;
-        reader.setContentHandler(&handler);
-        reader.setErrorHandler(&handler);
-        QXmlInputSource inputSource(f);
-        if (!reader.parse(inputSource))
-            job->setErrorMessage(handler.errorString());
+
+        RepositoryXMLParser parser(r);
+        QString err = parser.parse(pipe);
+
+        // the hash sum is only available after all data was written
+        if (err.isEmpty())
+            pipe->readAll();
+        else
+            pipe->abort();
+
+        // an interrupted download also leads to an XML error. The download
+        // error is more useful in this case.
+        QString writeError = pipe->getWriteError();
+        if (!writeError.isEmpty())
+            err = writeError;
+
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
         else {
             sub->completeWithProgress();
             job->setProgress(1);
         }
     }
 
-    delete dir;
-
     job->complete();
 }
 
@@ -1317,7 +2450,7 @@ void DBRepository::updateF5(Job* job)
     if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.01,
                 QObject::tr("Starting an SQL transaction (tempdb)"));
-        QString err = exec("BEGIN TRANSACTION");
+        QString err = beginTransaction();
         if (!err.isEmpty())
             job->setErrorMessage(err);
         else {
@@ -1355,9 +2488,7 @@ void DBRepository::updateF5(Job* job)
     if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.05,
                 QObject::tr("Removing packages without versions"));
-        QString err = exec("DELETE FROM PACKAGE WHERE NOT EXISTS "
-                "(SELECT * FROM PACKAGE_VERSION "
-                "WHERE PACKAGE = PACKAGE.NAME)");
+        QString err = deletePackagesWithoutVersions();
         if (err.isEmpty())
             sub->completeWithProgress();
         else
@@ -1375,14 +2506,14 @@ void DBRepository::updateF5(Job* job)
     if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.05,
                 QObject::tr("Commiting the SQL transaction (tempdb)"));
-        QString err = exec("COMMIT");
+        QString err = commit();
         if (!err.isEmpty())
             job->setErrorMessage(err);
         else
             sub->completeWithProgress();
     } else {
         if (transactionStarted)
-            exec("ROLLBACK");
+            rollback();
     }
 
     /*QString error;
@@ -1426,6 +2557,38 @@ void DBRepository::updateF5Runnable(Job *job)
             THREAD_MODE_BACKGROUND_BEGIN);
     */
 
+    DBRepository dbr;
+
+    if (job->shouldProceed()) {
+        QString err = dbr.openDefault("recognize");
+        if (!err.isEmpty()) {
+            job->setErrorMessage(QObject::tr("Error opening the database: %1").
+                    arg(err));
+        }
+    }
+
+    bool incremental = false;
+    if (job->shouldProceed()) {
+        QString err;
+        incremental = dbr.canUpdateIncrementally(&err);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (incremental) {
+        if (job->shouldProceed()) {
+            Job* sub = job->newSubJob(1,
+                    QObject::tr("Updating the changed repositories"),
+                    true, true);
+            CoInitialize(0);
+            dbr.updateF5Incremental(sub, true);
+            CoUninitialize();
+        }
+
+        job->complete();
+        return;
+    }
+
     DBRepository tempdb;
 
     QTemporaryFile tempFile;
@@ -1445,7 +2608,11 @@ void DBRepository::updateF5Runnable(Job *job)
             job->setErrorMessage(err);
         else {
             tempDatabaseOpen = true;
-            job->setProgress(0.02);
+            err = tempdb.optimizeForBulkLoad();
+            if (err.isEmpty())
+                job->setProgress(0.02);
+            else
+                job->setErrorMessage(err);
         }
     }
 
@@ -1457,38 +2624,522 @@ void DBRepository::updateF5Runnable(Job *job)
         CoUninitialize();
     }
 
-    if (tempDatabaseOpen)
-        tempdb.db.close();
+    if (tempDatabaseOpen) {
+        tempdb.clearStatementCache();
+        tempdb.db.close();
+    }
+
+    if (job->shouldProceed()) {
+        job->setProgress(0.8);
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.2,
+                QObject::tr("Transferring the data from the temporary database"),
+                true, true);
+        dbr.transferFrom(sub, tempFile.fileName());
+    }
+
+    if (job->shouldProceed()) {
+        job->setProgress(1);
+    }
+
+    job->complete();
+
+    /*
+    if (b)
+        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+    */
+}
+
+bool DBRepository::canUpdateIncrementally(QString* err)
+{
+    *err = "";
+
+    QList<QUrl*> urls = AbstractRepository::getRepositoryURLs(err);
+
+    QStringList stored;
+    if (err->isEmpty())
+        stored = readRepositories(err);
+
+    bool r = err->isEmpty() && urls.count() > 0 &&
+            urls.count() == stored.count();
+
+    for (int i = 0; i < urls.count(); i++) {
+        if (!r)
+            break;
+
+        QString url = urls.at(i)->toString();
+        if (url != stored.at(i))
+            r = false;
+        else if (getRepositorySHA1(url, err).isEmpty())
+            r = false;
+
+        if (!err->isEmpty())
+            r = false;
+    }
+
+    qDeleteAll(urls);
+
+    return r;
+}
+
+void DBRepository::updateF5Incremental(Job* job, bool useCache)
+{
+    QString initialTitle = job->getTitle();
+
+    QString err;
+    QList<QUrl*> urls = AbstractRepository::getRepositoryURLs(&err);
+    if (!err.isEmpty())
+        job->setErrorMessage(err);
+
+    // every repository is downloaded in its own thread and parsed in
+    // another one while the data is still arriving like in load()
+    QList<PipeBuffer*> pipes;
+    QList<RepositoryDownloadThread*> downloads;
+    QList<Repository*> parsed;
+    QList<Job*> parseJobs;
+    QList<QFuture<void> > futures;
+    if (job->shouldProceed()) {
+        for (int i = 0; i < urls.count(); i++) {
+            PipeBuffer* pipe = new PipeBuffer();
+            pipes.append(pipe);
+
+            RepositoryDownloadThread* t = new RepositoryDownloadThread();
+            t->job = job->newSubJob(0.15 / urls.count(),
+                    QObject::tr("Downloading %1").
+                    arg(urls.at(i)->toDisplayString()), false, false);
+            t->url = *urls.at(i);
+            t->pipe = pipe;
+            t->useCache = useCache;
+            downloads.append(t);
+            t->start();
+
+            Repository* r = new Repository();
+            Job* s = job->newSubJob(0.15 / urls.count(), QString(
+                    QObject::tr("Parsing the repository %1 of %2")).
+                    arg(i + 1).arg(urls.count()), false, false);
+            parsed.append(r);
+            parseJobs.append(s);
+            futures.append(QtConcurrent::run(DBRepository::loadPipe, s,
+                    pipe, r));
+        }
+    }
+
+    // true if rows from the repositories with lower priority that were
+    // hidden before could be visible now
+    bool syncAll = false;
+
+    bool anyChanged = false;
+    for (int i = 0; i < futures.count(); i++) {
+        downloads.at(i)->wait();
+
+        QString url = urls.at(i)->toString();
+
+        // the hash sum was computed during the download. The parser is
+        // stopped for an unchanged repository.
+        bool changed = false;
+        QString sha1;
+        if (job->shouldProceed()) {
+            Job* ds = downloads.at(i)->job;
+            if (!ds->getErrorMessage().isEmpty()) {
+                job->setErrorMessage(QString(
+                        QObject::tr("Error downloading the repository %1: %2")).
+                        arg(url).arg(ds->getErrorMessage()));
+            } else {
+                sha1 = pipes.at(i)->getHashSum();
+                QString old = getRepositorySHA1(url, &err);
+                if (!err.isEmpty())
+                    job->setErrorMessage(err);
+                else
+                    changed = syncAll || sha1.isEmpty() || sha1 != old;
+            }
+        }
+        if (!changed)
+            pipes.at(i)->abort();
+
+        futures[i].waitForFinished();
+
+        if (job->shouldProceed())
+            job->setProgress(job->getProgress() + 0.3 / urls.count());
+
+        if (job->shouldProceed() && changed) {
+            Job* ps = parseJobs.at(i);
+            if (!ps->getErrorMessage().isEmpty()) {
+                job->setErrorMessage(QString(
+                        QObject::tr("Error loading the repository %1: %2")).
+                        arg(url).arg(ps->getErrorMessage()));
+            }
+        }
+
+        if (job->shouldProceed() && changed) {
+            anyChanged = true;
+
+            job->setTitle(initialTitle + " / " + QString(
+                    QObject::tr("Repository %1 of %2")).arg(i + 1).
+                    arg(urls.count()));
+            Job* sub = job->newSubJob(0.4 / urls.count(), QString(
+                    QObject::tr("Repository %1 of %2")).arg(i + 1).
+                    arg(urls.count()));
+            bool removed = false;
+            syncRepository(sub, i, parsed.at(i), sha1, url, &removed);
+            if (!sub->getErrorMessage().isEmpty()) {
+                job->setErrorMessage(QString(
+                        QObject::tr("Error loading the repository %1: %2")).
+                        arg(url).arg(sub->getErrorMessage()));
+            } else if (removed) {
+                syncAll = true;
+            }
+        } else if (job->shouldProceed()) {
+            job->setProgress(job->getProgress() + 0.4 / urls.count());
+        }
+
+        // the memory can be released before the next repository is
+        // written
+        delete parsed.at(i);
+        parsed[i] = 0;
+    }
+    job->setTitle(initialTitle);
+
+    qDeleteAll(parsed);
+    parsed.clear();
+    qDeleteAll(downloads);
+    downloads.clear();
+    qDeleteAll(pipes);
+    pipes.clear();
+    qDeleteAll(urls);
+    urls.clear();
+
+    bool transactionStarted = false;
+    if (job->shouldProceed()) {
+        QString err = beginTransaction();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else
+            transactionStarted = true;
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.2,
+                QObject::tr("Refreshing the installation status"));
+        InstalledPackages::getDefault()->refresh(this, sub);
+        if (!sub->getErrorMessage().isEmpty())
+            job->setErrorMessage(sub->getErrorMessage());
+    }
+
+    if (job->shouldProceed() && anyChanged) {
+        QString err = deletePackagesWithoutVersions();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.05,
+                QObject::tr("Updating the status for installed packages in the database"));
+        updateStatusForInstalled(sub);
+        if (!sub->getErrorMessage().isEmpty())
+            job->setErrorMessage(sub->getErrorMessage());
+    }
+
+    if (job->shouldProceed()) {
+        QString err = commit();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    } else {
+        if (transactionStarted)
+            rollback();
+    }
+
+    if (job->shouldProceed()) {
+        QString err = readCategories();
+        if (err.isEmpty())
+            job->setProgress(1);
+        else
+            job->setErrorMessage(err);
+    }
+
+    job->complete();
+}
+
+void DBRepository::syncRepository(Job* job, int index, Repository* r,
+        const QString& sha1, const QString& url, bool* removed)
+{
+    *removed = false;
+
+    QString initialTitle = job->getTitle();
+
+    QTemporaryFile tempFile;
+    if (job->shouldProceed()) {
+        if (!tempFile.open()) {
+            job->setErrorMessage(QObject::tr("Error creating a temporary file"));
+        } else {
+            tempFile.close();
+        }
+    }
+
+    DBRepository tempdb;
+    bool tempDatabaseOpen = false;
+    if (job->shouldProceed()) {
+        QString err = tempdb.open("syncdb", tempFile.fileName());
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else {
+            tempDatabaseOpen = true;
+            err = tempdb.optimizeForBulkLoad();
+            if (err.isEmpty())
+                job->setProgress(0.05);
+            else
+                job->setErrorMessage(err);
+        }
+    }
+
+    bool attached = false;
+    if (job->shouldProceed()) {
+        QString err = exec("ATTACH '" + tempFile.fileName() + "' as tempdb");
+        if (err.isEmpty())
+            attached = true;
+        else
+            job->setErrorMessage(err);
+    }
+
+    // the same category IDs should be used in both databases
+    if (job->shouldProceed()) {
+        QString err = exec("INSERT INTO tempdb.CATEGORY(ID, NAME, PARENT, "
+                "LEVEL) SELECT ID, NAME, PARENT, LEVEL FROM CATEGORY");
+        if (err.isEmpty())
+            job->setProgress(0.1);
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        tempdb.currentRepository = index;
+        QString err = tempdb.beginTransaction();
+        if (err.isEmpty()) {
+            err = tempdb.beginIngest();
+            if (err.isEmpty()) {
+                err = tempdb.ingest(r);
+                QString err2 = tempdb.endIngest();
+                if (err.isEmpty())
+                    err = err2;
+            }
+            if (err.isEmpty())
+                err = tempdb.commit();
+            else
+                tempdb.rollback();
+        }
+        if (err.isEmpty())
+            job->setProgress(0.7);
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (tempDatabaseOpen) {
+        tempdb.clearStatementCache();
+        tempdb.db.close();
+    }
+
+    bool transactionStarted = false;
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Starting an SQL transaction"));
+        QString err = beginTransaction();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else
+            transactionStarted = true;
+    }
+
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Writing the changes"));
+        QString err = mergeRepository(index, removed);
+        if (err.isEmpty())
+            setRepositorySHA1(url, sha1, &err);
+        if (err.isEmpty())
+            job->setProgress(0.95);
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        QString err = commit();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    } else {
+        if (transactionStarted)
+            rollback();
+    }
+
+    if (attached) {
+        QString err;
+        for (int i = 0; i < 10; i++) {
+            err = exec("DETACH tempdb");
+            if (err.isEmpty())
+                break;
+            else
+                Sleep(1000);
+        }
+
+        if (!err.isEmpty() && job->getErrorMessage().isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed())
+        job->setProgress(1);
 
-    DBRepository dbr;
+    job->setTitle(initialTitle);
 
-    if (job->shouldProceed()) {
-        QString err = dbr.openDefault("recognize");
-        if (!err.isEmpty()) {
-            job->setErrorMessage(QObject::tr("Error opening the database: %1").
-                    arg(err));
-        } else {
-            job->setProgress(0.8);
-        }
-    }
+    job->complete();
+}
 
-    if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.2,
-                QObject::tr("Transferring the data from the temporary database"),
-                true, true);
-        dbr.transferFrom(sub, tempFile.fileName());
+QString DBRepository::mergeRepository(int index, bool* removed)
+{
+    *removed = false;
+
+    QString r = QString::number(index);
+
+    QString err = exec("CREATE TEMP TABLE IF NOT EXISTS SYNC_PACKAGE("
+            "NAME TEXT PRIMARY KEY)");
+
+    // removed packages
+    if (err.isEmpty())
+        err = exec("DELETE FROM SYNC_PACKAGE");
+    if (err.isEmpty())
+        err = exec("INSERT INTO SYNC_PACKAGE(NAME) SELECT NAME FROM PACKAGE "
+                "WHERE REPOSITORY = " + r + " AND NAME NOT IN "
+                "(SELECT NAME FROM tempdb.PACKAGE)");
+    if (err.isEmpty()) {
+        if (count("SELECT changes()", &err) > 0)
+            *removed = true;
     }
+    if (err.isEmpty())
+        err = exec("DELETE FROM PACKAGE_FTS WHERE DOCID IN "
+                "(SELECT ROWID FROM PACKAGE WHERE NAME IN "
+                "(SELECT NAME FROM SYNC_PACKAGE))");
+    if (err.isEmpty())
+        err = exec("DELETE FROM LINK WHERE PACKAGE IN "
+                "(SELECT NAME FROM SYNC_PACKAGE)");
+    if (err.isEmpty())
+        err = exec("DELETE FROM PACKAGE WHERE NAME IN "
+                "(SELECT NAME FROM SYNC_PACKAGE)");
 
-    if (job->shouldProceed()) {
-        job->setProgress(1);
+    // new and changed packages. Packages from repositories with higher
+    // priority are not overwritten.
+    if (err.isEmpty())
+        err = exec("DELETE FROM SYNC_PACKAGE");
+    if (err.isEmpty())
+        err = exec("INSERT INTO SYNC_PACKAGE(NAME) SELECT T.NAME "
+                "FROM tempdb.PACKAGE T WHERE NOT EXISTS "
+                "(SELECT * FROM PACKAGE M WHERE M.NAME = T.NAME AND "
+                "(M.REPOSITORY < " + r + " OR (M.REPOSITORY = " + r + " AND "
+                "M.TITLE IS T.TITLE AND M.URL IS T.URL AND "
+                "M.ICON IS T.ICON AND M.DESCRIPTION IS T.DESCRIPTION AND "
+                "M.LICENSE IS T.LICENSE AND M.SHORT_NAME IS T.SHORT_NAME AND "
+                "M.CATEGORY0 IS T.CATEGORY0 AND M.CATEGORY1 IS T.CATEGORY1 AND "
+                "M.CATEGORY2 IS T.CATEGORY2 AND M.CATEGORY3 IS T.CATEGORY3 AND "
+                "M.CATEGORY4 IS T.CATEGORY4 AND "
+                "NOT EXISTS (SELECT INDEX_, REL, HREF FROM LINK "
+                "WHERE PACKAGE = T.NAME EXCEPT "
+                "SELECT INDEX_, REL, HREF FROM tempdb.LINK "
+                "WHERE PACKAGE = T.NAME) AND "
+                "NOT EXISTS (SELECT INDEX_, REL, HREF FROM tempdb.LINK "
+                "WHERE PACKAGE = T.NAME EXCEPT "
+                "SELECT INDEX_, REL, HREF FROM LINK "
+                "WHERE PACKAGE = T.NAME))))");
+    if (err.isEmpty())
+        err = exec("DELETE FROM PACKAGE_FTS WHERE DOCID IN "
+                "(SELECT ROWID FROM PACKAGE WHERE NAME IN "
+                "(SELECT NAME FROM SYNC_PACKAGE))");
+    if (err.isEmpty())
+        err = exec("DELETE FROM LINK WHERE PACKAGE IN "
+                "(SELECT NAME FROM SYNC_PACKAGE)");
+    if (err.isEmpty())
+        err = exec("INSERT OR REPLACE INTO PACKAGE(NAME, TITLE, URL, ICON, "
+                "DESCRIPTION, LICENSE, STATUS, SHORT_NAME, "
+                "REPOSITORY, CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, "
+                "CATEGORY4) SELECT NAME, TITLE, URL, ICON, DESCRIPTION, "
+                "LICENSE, STATUS, SHORT_NAME, REPOSITORY, "
+                "CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4 "
+                "FROM tempdb.PACKAGE WHERE NAME IN "
+                "(SELECT NAME FROM SYNC_PACKAGE)");
+    if (err.isEmpty())
+        err = exec("INSERT INTO PACKAGE_FTS(DOCID, TITLE, DESCRIPTION, NAME) "
+                "SELECT M.ROWID, F.TITLE, F.DESCRIPTION, F.NAME "
+                "FROM PACKAGE M, tempdb.PACKAGE T, tempdb.PACKAGE_FTS F "
+                "WHERE M.NAME IN (SELECT NAME FROM SYNC_PACKAGE) AND "
+                "T.NAME = M.NAME AND F.DOCID = T.ROWID");
+    if (err.isEmpty())
+        err = exec("INSERT INTO LINK(PACKAGE, INDEX_, REL, HREF) "
+                "SELECT PACKAGE, INDEX_, REL, HREF FROM tempdb.LINK "
+                "WHERE PACKAGE IN (SELECT NAME FROM SYNC_PACKAGE)");
+
+    // package versions
+    if (err.isEmpty())
+        err = exec("DELETE FROM PACKAGE_VERSION WHERE REPOSITORY = " + r +
+                " AND NOT EXISTS (SELECT * FROM tempdb.PACKAGE_VERSION T "
+                "WHERE T.PACKAGE = PACKAGE_VERSION.PACKAGE AND "
+                "T.NAME = PACKAGE_VERSION.NAME)");
+    if (err.isEmpty()) {
+        if (count("SELECT changes()", &err) > 0)
+            *removed = true;
+    }
+    if (err.isEmpty())
+        err = exec("INSERT OR REPLACE INTO PACKAGE_VERSION(NAME, PACKAGE, "
+                "URL, CONTENT, MSIGUID, DETECT_FILE_COUNT, REPOSITORY, "
+                "VERSION_KEY, HAS_DOWNLOAD, INSTALLED) "
+                "SELECT NAME, PACKAGE, URL, CONTENT, MSIGUID, "
+                "DETECT_FILE_COUNT, REPOSITORY, VERSION_KEY, HAS_DOWNLOAD, "
+                "INSTALLED FROM tempdb.PACKAGE_VERSION T "
+                "WHERE NOT EXISTS (SELECT * FROM PACKAGE_VERSION M "
+                "WHERE M.PACKAGE = T.PACKAGE AND M.NAME = T.NAME AND "
+                "(M.REPOSITORY < " + r + " OR (M.REPOSITORY = " + r + " AND "
+                "M.URL IS T.URL AND M.CONTENT = T.CONTENT)))");
+
+    // licenses
+    if (err.isEmpty())
+        err = exec("DELETE FROM LICENSE WHERE REPOSITORY = " + r +
+                " AND NAME NOT IN (SELECT NAME FROM tempdb.LICENSE)");
+    if (err.isEmpty()) {
+        if (count("SELECT changes()", &err) > 0)
+            *removed = true;
     }
+    if (err.isEmpty())
+        err = exec("INSERT OR REPLACE INTO LICENSE(NAME, TITLE, DESCRIPTION, "
+                "URL, REPOSITORY) SELECT NAME, TITLE, DESCRIPTION, URL, "
+                "REPOSITORY FROM tempdb.LICENSE T WHERE NOT EXISTS "
+                "(SELECT * FROM LICENSE M WHERE M.NAME = T.NAME AND "
+                "(M.REPOSITORY < " + r + " OR (M.REPOSITORY = " + r + " AND "
+                "M.TITLE IS T.TITLE AND M.DESCRIPTION IS T.DESCRIPTION AND "
+                "M.URL IS T.URL)))");
+
+    // new categories
+    if (err.isEmpty())
+        err = exec("INSERT INTO CATEGORY(ID, NAME, PARENT, LEVEL) "
+                "SELECT ID, NAME, PARENT, LEVEL FROM tempdb.CATEGORY "
+                "WHERE ID NOT IN (SELECT ID FROM CATEGORY)");
 
-    job->complete();
+    if (err.isEmpty())
+        err = exec("DROP TABLE SYNC_PACKAGE");
 
-    /*
-    if (b)
-        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
-    */
+    licensesMutex.lock();
+    this->licenses.clear();
+    licensesMutex.unlock();
+
+    return err;
+}
+
+QString DBRepository::deletePackagesWithoutVersions()
+{
+    QString err = exec("DELETE FROM PACKAGE_FTS WHERE DOCID IN "
+            "(SELECT ROWID FROM PACKAGE WHERE NOT EXISTS "
+            "(SELECT * FROM PACKAGE_VERSION "
+            "WHERE PACKAGE = PACKAGE.NAME))");
+    if (err.isEmpty())
+        err = exec("DELETE FROM PACKAGE WHERE NOT EXISTS "
+                "(SELECT * FROM PACKAGE_VERSION "
+                "WHERE PACKAGE = PACKAGE.NAME)");
+    return err;
 }
 
 void DBRepository::saveAll(Job* job, Repository* r, bool replace)
@@ -1530,30 +3181,47 @@ void DBRepository::updateStatusForInstalled(Job* job)
 {
     QString initialTitle = job->getTitle();
 
-    QSet<QString> packages;
+    // SAVEPOINT works both inside and outside of a transaction
+    bool transactionStarted = false;
     if (job->shouldProceed()) {
-        QList<InstalledPackageVersion*> pvs = InstalledPackages::getDefault()->getAll();
-        for (int i = 0; i < pvs.count(); i++) {
-            InstalledPackageVersion* pv = pvs.at(i);
-            packages.insert(pv->package);
-        }
-        qDeleteAll(pvs);
-        pvs.clear();
-        job->setProgress(0.1);
+        QString err = savepoint("UPDATE_STATUS");
+        if (err.isEmpty())
+            transactionStarted = true;
+        else
+            job->setErrorMessage(err);
     }
 
     if (job->shouldProceed()) {
         job->setTitle(initialTitle + " / " +
-                QObject::tr("Updating statuses"));
-        QList<QString> packages_ = packages.values();
-        for (int i = 0; i < packages_.count(); i++) {
-            QString package = packages_.at(i);
-            updateStatus(package);
+                QObject::tr("Updating installed package versions"));
+        QString err = updateInstalledFlags("");
+        if (err.isEmpty())
+            job->setProgress(0.5);
+        else
+            job->setErrorMessage(err);
+    }
 
-            if (!job->shouldProceed())
-                break;
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Updating statuses"));
+        QString err = updateStatuses("");
+        if (err.isEmpty())
+            job->setProgress(0.95);
+        else
+            job->setErrorMessage(err);
+    }
 
-            job->setProgress(0.1 + 0.9 * (i + 1) / packages_.count());
+    if (transactionStarted) {
+        QString err;
+        if (job->shouldProceed())
+            err = releaseSavepoint("UPDATE_STATUS");
+        else
+            rollbackToSavepoint("UPDATE_STATUS");
+        if (job->shouldProceed()) {
+            if (err.isEmpty())
+                job->setProgress(1);
+            else
+                job->setErrorMessage(err);
         }
     }
 
@@ -1615,103 +3283,117 @@ QString DBRepository::getErrorString(const MySQLQuery &q)
 
 QString DBRepository::readCategories()
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     QString err;
 
     this->categories.clear();
 
     QString sql = "SELECT ID, NAME FROM CATEGORY";
 
-    MySQLQuery q(db);
-
-    if (!q.prepare(sql))
-        err = getErrorString(q);
+    MySQLQuery* q = getQuery(sql, &err);
 
     if (err.isEmpty()) {
-        if (!q.exec())
-            err = getErrorString(q);
+        if (!q->exec())
+            err = getErrorString(*q);
         else {
-            while (q.next()) {
-                categories.insert(q.value(0).toInt(),
-                        q.value(1).toString());
+            while (q->next()) {
+                categories.insert(q->value(0).toInt(),
+                        q->value(1).toString());
             }
         }
     }
 
+    if (q)
+        q->finish();
+
     return err;
 }
 
 QStringList DBRepository::readRepositories(QString* err)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     QStringList r;
 
     *err = "";
 
     QString sql = "SELECT ID, URL FROM REPOSITORY ORDER BY ID";
 
-    MySQLQuery q(db);
-
-    if (!q.prepare(sql))
-        *err = getErrorString(q);
+    MySQLQuery* q = getQuery(sql, err);
 
     if (err->isEmpty()) {
-        if (!q.exec())
-            *err = getErrorString(q);
+        if (!q->exec())
+            *err = getErrorString(*q);
         else {
-            while (q.next()) {
-                r.append(q.value(1).toString());
+            while (q->next()) {
+                r.append(q->value(1).toString());
             }
         }
     }
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
 QString DBRepository::getRepositorySHA1(const QString& url, QString* err)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
+    *err = "";
+
     QString r;
 
     QString sql = "SELECT SHA1 FROM REPOSITORY WHERE URL=:URL";
 
-    MySQLQuery q(db);
-
-    if (!q.prepare(sql))
-        *err = getErrorString(q);
+    MySQLQuery* q = getQuery(sql, err);
 
     if (err->isEmpty()) {
-        q.bindValue(":URL", url);
+        q->bindValue(":URL", url);
 
-        if (!q.exec())
-            *err = getErrorString(q);
+        if (!q->exec())
+            *err = getErrorString(*q);
         else {
-            if (q.next()) {
-                r = q.value(1).toString();
+            if (q->next()) {
+                r = q->value(0).toString();
             }
         }
     }
 
+    if (q)
+        q->finish();
+
     return r;
 }
 
 void DBRepository::setRepositorySHA1(const QString& url, const QString& sha1,
         QString* err)
 {
-    MySQLQuery q(db);
+    QMutexLocker locker(&mainConnectionMutex);
+
+    *err = "";
 
     QString sql = "UPDATE REPOSITORY SET SHA1=:SHA1 WHERE URL=:URL";
-    if (!q.prepare(sql))
-        *err = getErrorString(q);
+    MySQLQuery* q = getQuery(sql, err);
 
     if (err->isEmpty()) {
-        q.bindValue(":SHA1", sha1);
-        q.bindValue(":URL", url);
-        if (!q.exec())
-            *err = getErrorString(q);
+        q->bindValue(":SHA1", sha1);
+        q->bindValue(":URL", url);
+        if (!q->exec())
+            *err = getErrorString(*q);
     }
+
+    if (q)
+        q->finish();
 }
 
 
 QString DBRepository::saveRepositories(const QStringList &reps)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     QString err = exec("DELETE FROM REPOSITORY");
 
     MySQLQuery q(db);
@@ -1760,60 +3442,145 @@ QString DBRepository::getCategoryPath(int c0, int c1, int c2, int c3,
     return r;
 }
 
-QString DBRepository::updateStatus(const QString& package)
+QString DBRepository::updateInstalledFlags(const QString& package)
 {
+    QMutexLocker locker(&mainConnectionMutex);
+
     QString err;
 
-    QList<PackageVersion*> pvs = getPackageVersions_(package, &err);
-    PackageVersion* newestInstallable = 0;
-    PackageVersion* newestInstalled = 0;
-    if (err.isEmpty()) {
-        for (int j = 0; j < pvs.count(); j++) {
-            PackageVersion* pv = pvs.at(j);
-            if (pv->installed()) {
-                if (!newestInstalled ||
-                        newestInstalled->version.compare(pv->version) < 0)
-                    newestInstalled = pv;
-            }
+    QList<InstalledPackageVersion*> pvs;
+    if (package.isEmpty())
+        pvs = InstalledPackages::getDefault()->getAll();
+    else
+        pvs = InstalledPackages::getDefault()->getByPackage(package);
 
-            // qDebug() << pv->download.toString();
+    err = exec("CREATE TEMP TABLE IF NOT EXISTS INSTALLED_VERSION("
+            "PACKAGE TEXT, NAME TEXT)");
+    if (err.isEmpty())
+        err = exec("DELETE FROM INSTALLED_VERSION");
 
-            if (pv->download.isValid()) {
-                if (!newestInstallable ||
-                        newestInstallable->version.compare(pv->version) < 0)
-                    newestInstallable = pv;
-            }
+    if (err.isEmpty()) {
+        MySQLQuery* q = getQuery("INSERT INTO INSTALLED_VERSION(PACKAGE, NAME) "
+                "VALUES(:PACKAGE, :NAME)", &err);
+        for (int i = 0; i < pvs.count(); i++) {
+            if (!err.isEmpty())
+                break;
+
+            InstalledPackageVersion* ipv = pvs.at(i);
+            Version v = ipv->version;
+            v.normalize();
+            q->bindValue(":PACKAGE", ipv->package);
+            q->bindValue(":NAME", v.getVersionString());
+            if (!q->exec())
+                err = getErrorString(*q);
         }
+        if (q)
+            q->finish();
     }
+    qDeleteAll(pvs);
+
+    QString where;
+    if (!package.isEmpty())
+        where = " AND PACKAGE = :PACKAGE";
 
     if (err.isEmpty()) {
-        Package::Status status;
-        if (newestInstalled) {
-            bool up2date = !(newestInstalled && newestInstallable &&
-                    newestInstallable->version.compare(
-                    newestInstalled->version) > 0);
-            if (up2date)
-                status = Package::INSTALLED;
-            else
-                status = Package::UPDATEABLE;
-        } else {
-            status = Package::NOT_INSTALLED;
+        MySQLQuery* q = getQuery("UPDATE PACKAGE_VERSION SET INSTALLED = 0 "
+                "WHERE INSTALLED <> 0" + where, &err);
+        if (err.isEmpty()) {
+            if (!package.isEmpty())
+                q->bindValue(":PACKAGE", package);
+            if (!q->exec())
+                err = getErrorString(*q);
+            q->finish();
         }
+    }
 
-        MySQLQuery q(db);
-        if (!q.prepare("UPDATE PACKAGE "
-                "SET STATUS=:STATUS "
-                "WHERE NAME=:NAME"))
-            err = getErrorString(q);
-
+    // the unique index on (PACKAGE, NAME) is used for every installed version
+    if (err.isEmpty()) {
+        MySQLQuery* q = getQuery("UPDATE PACKAGE_VERSION SET INSTALLED = 1 "
+                "WHERE ROWID IN (SELECT V.ROWID FROM INSTALLED_VERSION I, "
+                "PACKAGE_VERSION V WHERE V.PACKAGE = I.PACKAGE AND "
+                "V.NAME = I.NAME)" + where, &err);
         if (err.isEmpty()) {
-            q.bindValue(":STATUS", status);
-            q.bindValue(":NAME", package);
-            if (!q.exec())
-                err = getErrorString(q);
+            if (!package.isEmpty())
+                q->bindValue(":PACKAGE", package);
+            if (!q->exec())
+                err = getErrorString(*q);
+            q->finish();
         }
     }
-    qDeleteAll(pvs);
+
+    return err;
+}
+
+QString DBRepository::updateStatuses(const QString& package)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err;
+
+    // a package is installed if at least one version is installed and
+    // updateable if there is a downloadable version newer than the newest
+    // installed one
+    QString sql = "UPDATE PACKAGE SET STATUS = CASE "
+            "WHEN NOT EXISTS (SELECT * FROM PACKAGE_VERSION V "
+            "WHERE V.PACKAGE = PACKAGE.NAME AND V.INSTALLED = 1) THEN " +
+            QString::number(Package::NOT_INSTALLED) + " "
+            "WHEN EXISTS (SELECT * FROM PACKAGE_VERSION V "
+            "WHERE V.PACKAGE = PACKAGE.NAME AND V.HAS_DOWNLOAD = 1 AND "
+            "V.VERSION_KEY > (SELECT MAX(I.VERSION_KEY) FROM PACKAGE_VERSION I "
+            "WHERE I.PACKAGE = PACKAGE.NAME AND I.INSTALLED = 1)) THEN " +
+            QString::number(Package::UPDATEABLE) + " "
+            "ELSE " + QString::number(Package::INSTALLED) + " END ";
+    if (package.isEmpty())
+        sql += "WHERE STATUS <> " + QString::number(Package::NOT_INSTALLED) +
+                " OR NAME IN (SELECT PACKAGE FROM PACKAGE_VERSION "
+                "WHERE INSTALLED = 1)";
+    else
+        sql += "WHERE NAME = :NAME";
+
+    // the counts for a single package are adjusted, all counts are
+    // re-computed otherwise
+    if (!package.isEmpty())
+        err = adjustCategoryCounts(package, -1);
+
+    MySQLQuery* q = 0;
+    if (err.isEmpty())
+        q = getQuery(sql, &err);
+    if (err.isEmpty()) {
+        if (!package.isEmpty())
+            q->bindValue(":NAME", package);
+        if (!q->exec())
+            err = getErrorString(*q);
+        q->finish();
+    }
+
+    if (err.isEmpty()) {
+        if (package.isEmpty())
+            err = updateCategoryCounts();
+        else
+            err = adjustCategoryCounts(package, 1);
+    }
+
+    return err;
+}
+
+QString DBRepository::updateStatus(const QString& package)
+{
+    QMutexLocker locker(&mainConnectionMutex);
+
+    QString err = savepoint("UPDATE_STATUS");
+
+    if (err.isEmpty()) {
+        err = updateInstalledFlags(package);
+        if (err.isEmpty())
+            err = updateStatuses(package);
+
+        if (err.isEmpty())
+            err = releaseSavepoint("UPDATE_STATUS");
+        else
+            rollbackToSavepoint("UPDATE_STATUS");
+    }
 
     return err;
 }
@@ -1846,7 +3613,7 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
     if (job->shouldProceed()) {
         job->setTitle(initialTitle + " / " +
                 QObject::tr("Starting an SQL transaction"));
-        QString err = exec("BEGIN TRANSACTION");
+        QString err = beginTransaction();
         if (!err.isEmpty())
             job->setErrorMessage(err);
         else {
@@ -1870,24 +3637,43 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
                 QObject::tr("Transferring the data from the temporary database"));
 
         // exec("DROP INDEX PACKAGE_VERSION_PACKAGE_NAME");
-        QString err = exec("INSERT INTO PACKAGE(NAME, TITLE, URL, ICON, "
-                "DESCRIPTION, LICENSE, FULLTEXT, STATUS, SHORT_NAME, "
+        // the ROWID is preserved as it is referenced by PACKAGE_FTS.DOCID
+        QString err = exec("INSERT INTO PACKAGE(ROWID, NAME, TITLE, URL, ICON, "
+                "DESCRIPTION, LICENSE, STATUS, SHORT_NAME, "
                 "REPOSITORY, CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, "
-                "CATEGORY4) SELECT NAME, TITLE, URL, ICON, DESCRIPTION, "
-                "LICENSE, FULLTEXT, STATUS, SHORT_NAME, REPOSITORY, "
+                "CATEGORY4) SELECT ROWID, NAME, TITLE, URL, ICON, DESCRIPTION, "
+                "LICENSE, STATUS, SHORT_NAME, REPOSITORY, "
                 "CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4 "
                 "FROM tempdb.PACKAGE");
+        if (err.isEmpty())
+            err = exec("INSERT INTO PACKAGE_FTS(DOCID, TITLE, DESCRIPTION, "
+                    "NAME) SELECT DOCID, TITLE, DESCRIPTION, NAME "
+                    "FROM tempdb.PACKAGE_FTS");
         if (err.isEmpty())
             err = exec("INSERT INTO PACKAGE_VERSION(NAME, PACKAGE, URL, "
-                    "CONTENT, MSIGUID, DETECT_FILE_COUNT) SELECT NAME, "
-                    "PACKAGE, URL, CONTENT, MSIGUID, DETECT_FILE_COUNT "
+                    "CONTENT, MSIGUID, DETECT_FILE_COUNT, REPOSITORY, "
+                    "VERSION_KEY, HAS_DOWNLOAD, INSTALLED) "
+                    "SELECT NAME, "
+                    "PACKAGE, URL, CONTENT, MSIGUID, DETECT_FILE_COUNT, "
+                    "REPOSITORY, VERSION_KEY, HAS_DOWNLOAD, INSTALLED "
                     "FROM tempdb.PACKAGE_VERSION");
         if (err.isEmpty())
-            err = exec("INSERT INTO LICENSE(NAME, TITLE, DESCRIPTION, URL) "
-                    "SELECT NAME, TITLE, DESCRIPTION, URL FROM tempdb.LICENSE");
+            err = exec("INSERT INTO LICENSE(NAME, TITLE, DESCRIPTION, URL, "
+                    "REPOSITORY) "
+                    "SELECT NAME, TITLE, DESCRIPTION, URL, REPOSITORY "
+                    "FROM tempdb.LICENSE");
+        if (err.isEmpty())
+            err = exec("DELETE FROM REPOSITORY");
+        if (err.isEmpty())
+            err = exec("INSERT INTO REPOSITORY(ID, URL, SHA1) "
+                    "SELECT ID, URL, SHA1 FROM tempdb.REPOSITORY");
         if (err.isEmpty())
             err = exec("INSERT INTO CATEGORY(ID, NAME, PARENT, LEVEL) "
                     "SELECT ID, NAME, PARENT, LEVEL FROM tempdb.CATEGORY");
+        if (err.isEmpty())
+            err = exec("INSERT INTO CATEGORY_COUNT(LEVEL, PARENT, CATEGORY, "
+                    "STATUS, N) SELECT LEVEL, PARENT, CATEGORY, STATUS, N "
+                    "FROM tempdb.CATEGORY_COUNT");
         if (err.isEmpty())
             err = exec("INSERT INTO LINK(PACKAGE, INDEX_, REL, HREF) "
                     "SELECT PACKAGE, INDEX_, REL, HREF FROM tempdb.LINK");
@@ -1900,14 +3686,14 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
     if (job->shouldProceed()) {
         job->setTitle(initialTitle + " / " +
                 QObject::tr("Commiting the SQL transaction"));
-        QString err = exec("COMMIT");
+        QString err = commit();
         if (!err.isEmpty())
             job->setErrorMessage(err);
         else
             job->setProgress(0.99);
     } else {
         if (transactionStarted)
-            exec("ROLLBACK");
+            rollback();
     }
 
     /*
@@ -1952,7 +3738,7 @@ QString DBRepository::openDefault(const QString& databaseName, bool readOnly)
 
     path = QDir::toNativeSeparators(path);
 
-    QString err = open(databaseName, path, readOnly);
+    QString err = open(databaseName, path, readOnly, true);
 
     return err;
 }
@@ -1963,13 +3749,17 @@ QString DBRepository::updateDatabase()
 
     bool e = false;
 
+    // true if PACKAGE_VERSION had to be re-created
+    bool versionsDropped = false;
+
     if (err.isEmpty()) {
         e = tableExists(&db, "PACKAGE", &err);
     }
     if (err.isEmpty()) {
         if (!e) {
             // NULL should be stored in CATEGORYx if a package is not
-            // categorized
+            // categorized. FULLTEXT is not used anymore (see PACKAGE_FTS)
+            // and always NULL.
             db.exec("CREATE TABLE PACKAGE(NAME TEXT, "
                     "TITLE TEXT, "
                     "URL TEXT, "
@@ -1989,18 +3779,6 @@ QString DBRepository::updateDatabase()
             err = toString(db.lastError());
         }
     }
-    if (err.isEmpty()) {
-        if (!e) {
-            db.exec("CREATE UNIQUE INDEX PACKAGE_NAME ON PACKAGE(NAME)");
-            err = toString(db.lastError());
-        }
-    }
-    if (err.isEmpty()) {
-        if (!e) {
-            db.exec("CREATE INDEX PACKAGE_SHORT_NAME ON PACKAGE(SHORT_NAME)");
-            err = toString(db.lastError());
-        }
-    }
 
     if (err.isEmpty()) {
         e = tableExists(&db, "REPOSITORY", &err);
@@ -2030,10 +3808,23 @@ QString DBRepository::updateDatabase()
 
     if (err.isEmpty()) {
         if (e) {
-            // PACKAGE_VERSION.URL is new in 1.18.4
-            if (!columnExists(&db, "PACKAGE_VERSION", "URL", &err)) {
+            // PACKAGE_VERSION.URL is new in 1.18.4,
+            // PACKAGE_VERSION.VERSION_KEY is new in 1.20. The first
+            // versions of 1.20 stored VERSION_KEY as hexadecimal text and
+            // then as a key that started with a byte below 0x40 and did
+            // not order negative numbers correctly.
+            bool recreate = !columnExists(&db, "PACKAGE_VERSION", "URL",
+                    &err) || !columnExists(&db, "PACKAGE_VERSION",
+                    "VERSION_KEY", &err);
+            if (err.isEmpty() && !recreate) {
+                recreate = count("SELECT COUNT(*) FROM (SELECT 1 FROM "
+                        "PACKAGE_VERSION WHERE TYPEOF(VERSION_KEY) = 'text' "
+                        "OR VERSION_KEY < X'40' LIMIT 1)", &err) > 0;
+            }
+            if (err.isEmpty() && recreate) {
                 exec("DROP TABLE PACKAGE_VERSION");
                 e = false;
+                versionsDropped = true;
             }
         }
     }
@@ -2042,38 +3833,9 @@ QString DBRepository::updateDatabase()
         if (!e) {
             db.exec("CREATE TABLE PACKAGE_VERSION(NAME TEXT, "
                     "PACKAGE TEXT, URL TEXT, "
-                    "CONTENT BLOB, MSIGUID TEXT, DETECT_FILE_COUNT INTEGER)");
-            err = toString(db.lastError());
-        }
-    }
-
-    if (err.isEmpty()) {
-        if (!e) {
-            db.exec("CREATE INDEX PACKAGE_VERSION_PACKAGE ON PACKAGE_VERSION("
-                    "PACKAGE)");
-            err = toString(db.lastError());
-        }
-    }
-
-    if (err.isEmpty()) {
-        if (!e) {
-            db.exec("CREATE UNIQUE INDEX PACKAGE_VERSION_PACKAGE_NAME ON "
-                    "PACKAGE_VERSION("
-                    "PACKAGE, NAME)");
-            err = toString(db.lastError());
-        }
-    }
-
-    if (err.isEmpty()) {
-        db.exec("CREATE INDEX IF NOT EXISTS PACKAGE_VERSION_MSIGUID ON "
-                "PACKAGE_VERSION(MSIGUID)");
-        err = toString(db.lastError());
-    }
-
-    if (err.isEmpty()) {
-        if (!e) {
-            db.exec("CREATE INDEX PACKAGE_VERSION_DETECT_FILE_COUNT ON PACKAGE_VERSION("
-                    "DETECT_FILE_COUNT)");
+                    "CONTENT BLOB, MSIGUID TEXT, DETECT_FILE_COUNT INTEGER, "
+                    "REPOSITORY INTEGER, VERSION_KEY BLOB, "
+                    "HAS_DOWNLOAD INTEGER, INSTALLED INTEGER)");
             err = toString(db.lastError());
         }
     }
@@ -2087,16 +3849,20 @@ QString DBRepository::updateDatabase()
             db.exec("CREATE TABLE LICENSE(NAME TEXT, "
                     "TITLE TEXT, "
                     "DESCRIPTION TEXT, "
-                    "URL TEXT"
+                    "URL TEXT, "
+                    "REPOSITORY INTEGER"
                     ")");
             err = toString(db.lastError());
         }
     }
 
+    // LICENSE.REPOSITORY is new in 1.20
     if (err.isEmpty()) {
-        if (!e) {
-            db.exec("CREATE UNIQUE INDEX LICENSE_NAME ON LICENSE(NAME)");
-            err = toString(db.lastError());
+        if (e && !columnExists(&db, "LICENSE", "REPOSITORY", &err)) {
+            if (err.isEmpty()) {
+                db.exec("ALTER TABLE LICENSE ADD COLUMN REPOSITORY INTEGER");
+                err = toString(db.lastError());
+            }
         }
     }
 
@@ -2128,6 +3894,14 @@ QString DBRepository::updateDatabase()
             err = toString(db.lastError());
         }
     }
+
+    // the package versions must be re-loaded from all repositories
+    if (err.isEmpty()) {
+        if (e && versionsDropped) {
+            db.exec("UPDATE REPOSITORY SET SHA1 = NULL");
+            err = toString(db.lastError());
+        }
+    }
     if (err.isEmpty()) {
         err = readCategories();
     }
@@ -2145,10 +3919,50 @@ QString DBRepository::updateDatabase()
             err = toString(db.lastError());
         }
     }
+
+    if (err.isEmpty()) {
+        err = createIndexes();
+    }
+
+    // CATEGORY_COUNT. Number of packages per category and status. LEVEL 0
+    // entries count PACKAGE.CATEGORY0 (PARENT is always 0), LEVEL 1 entries
+    // count PACKAGE.CATEGORY1 for the PARENT category in
+    // PACKAGE.CATEGORY0. 0 is stored instead of NULL for un-categorized
+    // packages.
+    if (err.isEmpty()) {
+        e = tableExists(&db, "CATEGORY_COUNT", &err);
+    }
+    if (err.isEmpty()) {
+        if (!e) {
+            db.exec("CREATE TABLE CATEGORY_COUNT(LEVEL INTEGER NOT NULL, "
+                    "PARENT INTEGER NOT NULL, CATEGORY INTEGER NOT NULL, "
+                    "STATUS INTEGER NOT NULL, N INTEGER NOT NULL, "
+                    "PRIMARY KEY(LEVEL, PARENT, CATEGORY, STATUS))");
+            err = toString(db.lastError());
+        }
+    }
+    if (err.isEmpty()) {
+        if (!e)
+            err = updateCategoryCounts();
+    }
+
+    // PACKAGE_FTS. Full-text index for PACKAGE. DOCID is the ROWID of the
+    // corresponding entry in PACKAGE. All values are stored in lower case.
+    if (err.isEmpty()) {
+        e = tableExists(&db, "PACKAGE_FTS", &err);
+    }
+    if (err.isEmpty()) {
+        if (!e) {
+            db.exec("CREATE VIRTUAL TABLE PACKAGE_FTS USING fts4("
+                    "TITLE, DESCRIPTION, NAME, prefix=\"2,3\")");
+            err = toString(db.lastError());
+        }
+    }
     if (err.isEmpty()) {
         if (!e) {
-            db.exec("CREATE INDEX LINK_PACKAGE ON LINK("
-                    "PACKAGE)");
+            db.exec("INSERT INTO PACKAGE_FTS(DOCID, TITLE, DESCRIPTION, NAME) "
+                    "SELECT ROWID, LOWER(TITLE), LOWER(DESCRIPTION), "
+                    "LOWER(NAME) FROM PACKAGE");
             err = toString(db.lastError());
         }
     }
@@ -2157,7 +3971,7 @@ QString DBRepository::updateDatabase()
 }
 
 QString DBRepository::open(const QString& connectionName, const QString& file,
-        bool readOnly)
+        bool readOnly, bool shared)
 {
     QString err;
 
@@ -2170,6 +3984,17 @@ QString DBRepository::open(const QString& connectionName, const QString& file,
         }
     }
 
+    QMutexLocker locker(&mainConnectionMutex);
+
+    // the prepared statements belong to the previous connection
+    clearStatementCache();
+    closeReadConnection();
+    generation.fetchAndAddOrdered(1);
+
+    this->fileName = file;
+    this->connectionName = connectionName;
+    this->readPool = shared;
+
     QSqlDatabase::removeDatabase(connectionName);
     db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
     db.setDatabaseName(file);
@@ -2181,9 +4006,15 @@ QString DBRepository::open(const QString& connectionName, const QString& file,
     if (err.isEmpty())
         err = exec("PRAGMA busy_timeout = 30000");
 
+    // with WAL the readers are not blocked by a writer and see the last
+    // committed state
     if (err.isEmpty()) {
-        if (!readOnly)
-            err = exec("PRAGMA journal_mode = DELETE");
+        if (!readOnly) {
+            if (shared)
+                err = exec("PRAGMA journal_mode = WAL");
+            else
+                err = exec("PRAGMA journal_mode = DELETE");
+        }
     }
 
     if (err.isEmpty()) {
@@ -9,6 +9,13 @@
 #include <QWeakPointer>
 #include <QMultiMap>
 #include <QCache>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QThread>
+#include <QThreadStorage>
+#include <QTemporaryFile>
 
 #include "package.h"
 #include "repository.h"
@@ -16,6 +23,7 @@
 #include "license.h"
 #include "abstractrepository.h"
 #include "mysqlquery.h"
+#include "pipebuffer.h"
 
 /**
  * @brief A repository stored in an SQLite database.
@@ -35,24 +43,334 @@ private:
 
     QMap<int, QString> categories;
 
-    MySQLQuery* savePackageVersionQuery;
-    MySQLQuery* insertPackageQuery;
-    MySQLQuery* replacePackageQuery;
-    MySQLQuery* selectCategoryQuery;
-    MySQLQuery* insertLinkQuery;
-    MySQLQuery* deleteLinkQuery;
+    /**
+     * @brief prepared statements for this connection: SQL -> query.
+     *     See getQuery().
+     */
+    mutable QHash<QString, MySQLQuery*> statementCache;
+
+    /** number of getQuery() calls that found a prepared statement */
+    mutable QAtomicInt statementCacheHits;
+
+    /** number of getQuery() calls that had to prepare a new statement */
+    mutable QAtomicInt statementCacheMisses;
+
+    /**
+     * @brief read-only connection to the same database file that is only
+     *     used from one thread
+     */
+    struct ReadConnection {
+        /** name of the connection */
+        QString name;
+
+        /** value of DBRepository::generation when this object was created */
+        int generation;
+
+        QSqlDatabase db;
+
+        /** prepared statements: SQL -> query */
+        QHash<QString, MySQLQuery*> statements;
+
+        /**
+         * @brief closes and removes the connection. This must be called in
+         *     the thread that created the connection.
+         */
+        ~ReadConnection();
+    };
+
+    /** database file passed to open() */
+    QString fileName;
+
+    /** connection name passed to open() */
+    QString connectionName;
+
+    /** true = the read methods use the read-only connections */
+    bool readPool;
+
+    /**
+     * @brief read-only connection for the current thread. The connection
+     *     is deleted when the thread exits.
+     */
+    mutable QThreadStorage<ReadConnection*> readConnections;
+
+    /** used to create unique names for the read-only connections */
+    mutable QAtomicInt readConnectionCounter;
+
+    /**
+     * @brief incremented by open(). The read-only connections created for
+     *     a previous database are replaced.
+     */
+    QAtomicInt generation;
+
+    /**
+     * @brief protects the main connection "db", statementCache and the
+     *     prepared statements in it. A thread holds this mutex while it has
+     *     an active transaction or savepoint. Recursive.
+     */
+    mutable QMutex mainConnectionMutex;
+
+    /**
+     * @brief number of active transactions and savepoints on the main
+     *     connection started by the current thread. Only changed by
+     *     setTransactionLevel().
+     */
+    mutable QThreadStorage<int> transactionLevels;
+
+    /** protects licenses */
+    mutable QMutex licensesMutex;
+
+    /** true if the bulk ingest mode is active. See beginIngest(). */
+    bool ingesting;
+
+    /** PACKAGE.ROWID for the next package in the bulk ingest mode */
+    qlonglong ingestRowID;
+
+    /**
+     * @brief keys of the rows already stored in the bulk ingest mode. The
+     *     first row with a key wins as with INSERT OR IGNORE: package names,
+     *     "package@version" and license names.
+     */
+    QSet<QString> ingestedPackages, ingestedPackageVersions,
+            ingestedLicenses;
+
+    /**
+     * @brief "parent/level/name" -> CATEGORY.ID for the categories used in
+     *     the bulk ingest mode
+     */
+    QHash<QString, int> ingestCategories;
+
+    /**
+     * @brief values of the rows not yet written in the bulk ingest mode.
+     *     The values of all columns of one row follow each other.
+     */
+    QList<QVariant> ingestPackageRows, ingestFTSRows, ingestLinkRows,
+            ingestPackageVersionRows, ingestLicenseRows;
 
     QSqlDatabase db;
 
+    /**
+     * @brief returns a prepared statement for the specified SQL. The
+     *     statements are cached and re-used for the whole life time of the
+     *     connection. A statement returned by this method should be finished
+     *     via MySQLQuery::finish() after the results were read. The same SQL
+     *     should not be used recursively while the results are being read.
+     *     SQL created from variable data (e.g. a list of IDs) should not be
+     *     passed here as the cache is never shrinked.
+     *
+     *     The caller must hold mainConnectionMutex until the statement is
+     *     finished.
+     * @param sql SQL
+     * @param err error message will be stored here
+     * @return [ownership:this] prepared statement or 0 if an error occured
+     */
+    MySQLQuery* getQuery(const QString& sql, QString* err) const;
+
+    /**
+     * @brief deletes all cached prepared statements
+     */
+    void clearStatementCache();
+
+    /**
+     * @brief returns the read-only connection for the current thread. The
+     *     connection is created on the first call in a thread. The read-only
+     *     connections see the last committed state of the database and are
+     *     not blocked by a writer (WAL).
+     * @param err error message will be stored here
+     * @return [ownership:this] the connection or 0 if the main connection
+     *     should be used. This is the case if the pool is not enabled or if
+     *     the current thread has an active transaction. Uncommitted changes
+     *     should be visible to the writer. The current thread holds
+     *     mainConnectionMutex during its transaction.
+     */
+    ReadConnection* getReadConnection(QString* err) const;
+
+    /**
+     * @brief getQuery() for SELECT statements. The statement is prepared
+     *     for the read-only connection of the current thread if possible.
+     *     See getReadConnection().
+     * @param sql SQL
+     * @param err error message will be stored here
+     * @return [ownership:this] prepared statement or 0 if an error occured
+     */
+    MySQLQuery* getReadQuery(const QString& sql, QString* err) const;
+
+    /**
+     * @brief returns the connection for SELECT statements that are not
+     *     cached
+     * @param err error message will be stored here
+     * @return connection for the current thread. See getReadConnection().
+     */
+    QSqlDatabase getReadDatabase(QString* err) const;
+
+    /**
+     * @brief closes the read-only connection of the current thread. The
+     *     connections of the other threads are replaced on their next use
+     *     after open() or deleted when the threads exit.
+     */
+    void closeReadConnection();
+
+    /**
+     * @return number of active transactions and savepoints started by the
+     *     current thread
+     */
+    int getTransactionLevel() const;
+
+    /**
+     * @brief changes the number of active transactions and savepoints for
+     *     the current thread. mainConnectionMutex is locked if the level
+     *     changes from 0 and unlocked if it changes to 0.
+     * @param level new level
+     */
+    void setTransactionLevel(int level);
+
+    /**
+     * @brief sets PACKAGE_VERSION.INSTALLED according to the list of
+     *     installed package versions
+     * @param package full package name or "" for all packages
+     * @return error message
+     */
+    QString updateInstalledFlags(const QString& package);
+
+    /**
+     * @brief re-computes PACKAGE.STATUS from PACKAGE_VERSION.INSTALLED,
+     *     PACKAGE_VERSION.HAS_DOWNLOAD and PACKAGE_VERSION.VERSION_KEY
+     * @param package full package name or "" for all packages with
+     *     installed versions or a status other than NOT_INSTALLED
+     * @return error message
+     */
+    QString updateStatuses(const QString& package);
+
     QString readCategories();
     QString getCategoryPath(int c0, int c1, int c2, int c3, int c4) const;
     int insertCategory(int parent, int level,
             const QString &category, QString *err);
+
+    /**
+     * @brief inserts all levels of the first category of a package
+     * @param p a package
+     * @param ids IDs of the category levels 0 to 4 will be stored here.
+     *     0 is stored for missing levels.
+     * @return error message
+     */
+    QString insertCategories(Package* p, int* ids);
+
+    /**
+     * @brief writes rows with multi-row INSERT statements
+     * @param table table name
+     * @param columns comma separated column names
+     * @param ncolumns number of columns
+     * @param values values of the rows. The written values will be removed
+     *     from this list.
+     * @param all true = write all rows, false = only write complete batches
+     *     and leave the rest in the list
+     * @return error message
+     */
+    QString insertRows(const QString& table, const QString& columns,
+            int ncolumns, QList<QVariant>* values, bool all);
+
+    /**
+     * @brief creates all indexes that do not exist yet
+     * @return error message
+     */
+    QString createIndexes();
+
+    /**
+     * @brief deletes the indexes that are not necessary in the bulk ingest
+     *     mode
+     * @return error message
+     */
+    QString dropIndexes();
     QString findCategory(int cat) const;
 
     QStringList findPackagesWhere(const QString &where,
             const QList<QVariant> &params, QString *err) const;
 
+    /**
+     * @brief creates a package version from the PACKAGE_VERSION.CONTENT
+     *     column. The binary form created by PackageVersion::toBinary() is
+     *     decoded directly. XML is still accepted for the data stored by
+     *     older versions.
+     * @param content PACKAGE_VERSION.CONTENT
+     * @param err error message will be stored here
+     * @param validate true = validate the XML data
+     * @param headerOnly true = binary data is decoded lazily. See
+     *     PackageVersion::fromBinary()
+     * @return [ownership:caller] created object or 0
+     */
+    static PackageVersion* parsePackageVersion(const QByteArray& content,
+            QString* err, bool validate=true, bool headerOnly=false);
+
+    /**
+     * @brief reads all versions of a package
+     * @param package full package name
+     * @param err error message will be stored here
+     * @param headerOnly true = binary data is decoded lazily
+     * @return [ownership:caller] package versions sorted by version number
+     *     in descending order
+     */
+    QList<PackageVersion*> readPackageVersions(const QString& package,
+            QString *err, bool headerOnly) const;
+
+    /**
+     * @brief searches for packages using the full-text index. The found
+     *     packages are sorted by relevance and then by title.
+     * @param where WHERE clause. It must contain "PACKAGE_FTS MATCH ?"
+     * @param params parameters for the WHERE clause
+     * @param err error message will be stored here
+     * @return names of the found packages
+     */
+    QStringList findPackagesRanked(const QString &where,
+            const QList<QVariant> &params, QString *err) const;
+
+    /**
+     * @brief converts the search keywords in a query for PACKAGE_FTS MATCH.
+     *     Every keyword is split in tokens the same way as the "simple"
+     *     SQLite tokenizer does it and every token is searched as a prefix.
+     *     Keywords with only one character are ignored.
+     * @param query search query (keywords)
+     * @return full-text query like '"notepad*" "plus*"' or "" if there are
+     *     no usable keywords
+     */
+    static QString createFTSMatchQuery(const QString& query);
+
+    /**
+     * @brief computes the relevance of a full-text match
+     * @param matchinfo result of matchinfo(PACKAGE_FTS, 'pcx')
+     * @return relevance. Higher values are better.
+     */
+    static double rankFTSMatch(const QByteArray& matchinfo);
+
+    /**
+     * @brief adds a package to the full-text index
+     * @param rowid PACKAGE.ROWID
+     * @param p the package
+     * @return error message
+     */
+    QString saveFTS(qlonglong rowid, Package* p);
+
+    /**
+     * @brief removes a package from the full-text index
+     * @param name full package name
+     * @return error message
+     */
+    QString deleteFTS(const QString& name);
+
+    /**
+     * @brief re-computes the whole CATEGORY_COUNT table from PACKAGE
+     * @return error message
+     */
+    QString updateCategoryCounts();
+
+    /**
+     * @brief adds a value to the entries in CATEGORY_COUNT for the current
+     *     categories and status of a package
+     * @param package full package name. Nothing happens if the package does
+     *     not exist.
+     * @param delta 1 = count the package, -1 = un-count the package
+     * @return error message
+     */
+    QString adjustCategoryCounts(const QString& package, int delta);
+
     /**
      * @brief inserts or updates existing packages
      * @param r repository with packages
@@ -80,18 +398,155 @@ private:
      */
     QString saveLicenses(Repository* r, bool replace);
 
+    /**
+     * @brief executes an SQL statement on the main connection. Transactions
+     *     and savepoints should be managed via beginTransaction(), commit(),
+     *     rollback(), savepoint(), releaseSavepoint() and
+     *     rollbackToSavepoint() as they hold mainConnectionMutex.
+     * @param sql SQL
+     * @return error message
+     */
     QString exec(const QString& sql);
 
+    /**
+     * @brief starts a transaction. mainConnectionMutex is held by the current
+     *     thread until commit() or rollback() is called.
+     * @return error message
+     */
+    QString beginTransaction();
+
+    /**
+     * @brief commits the transaction started by beginTransaction(). If the
+     *     commit fails, the transaction is rolled back. The transaction is
+     *     always finished.
+     * @return error message
+     */
+    QString commit();
+
+    /**
+     * @brief rolls back the transaction started by beginTransaction(). The
+     *     transaction is always finished.
+     * @return error message
+     */
+    QString rollback();
+
+    /**
+     * @brief creates a savepoint. A savepoint outside of a transaction starts
+     *     a new transaction. mainConnectionMutex is held by the current
+     *     thread until releaseSavepoint() or rollbackToSavepoint() is called.
+     * @param name name of the savepoint
+     * @return error message
+     */
+    QString savepoint(const QString& name);
+
+    /**
+     * @brief releases a savepoint. If this fails, the changes since the
+     *     savepoint are rolled back. The savepoint is always finished.
+     * @param name name of the savepoint
+     * @return error message
+     */
+    QString releaseSavepoint(const QString& name);
+
+    /**
+     * @brief rolls back the changes since a savepoint and releases it. The
+     *     savepoint is always finished.
+     * @param name name of the savepoint
+     * @return error message
+     */
+    QString rollbackToSavepoint(const QString& name);
+
     /**
      * Loads the content from the URLs. None of the packages has the information
-     * about installation path after this method was called.
+     * about installation path after this method was called. The repositories
+     * are parsed in parallel while they are still being downloaded and
+     * written to the database from the calling thread in the order of their
+     * priority.
      *
      * @param job job for this method
      * @param useCache true = cache will be used
      */
     void load(Job *job, bool useCache);
 
-    void loadOne(Job *job, QFile *f);
+    /**
+     * @brief parses one repository. This method does not access the
+     *     database and can be called from any thread.
+     * @param job job
+     * @param f repository in XML or ZIP format
+     * @param r [ownership:caller] the parsed objects will be stored here in
+     *     the document order
+     */
+    static void loadOne(Job *job, QFile *f, Repository* r);
+
+    /**
+     * @brief parses one repository while it is being downloaded. XML is
+     *     parsed directly from the pipe. Other formats are written to a
+     *     temporary file first and parsed by loadOne(). This method does not
+     *     access the database and can be called from any thread.
+     * @param job job
+     * @param pipe the data. The pipe is read until the end.
+     * @param r [ownership:caller] the parsed objects will be stored here in
+     *     the document order
+     */
+    static void loadPipe(Job *job, PipeBuffer *pipe, Repository* r);
+
+    /**
+     * @brief stores a parsed repository in the bulk ingest mode using
+     *     currentRepository as the repository index
+     * @param r a repository created by loadOne()
+     * @return error message
+     */
+    QString ingest(Repository* r);
+
+    /**
+     * @brief checks whether updateF5Incremental() can be used. This is only
+     *     the case if the list of repositories was not changed since the
+     *     last update and SHA1 values are known for all of them.
+     * @param err error message will be stored here
+     * @return true = incremental update is possible
+     */
+    bool canUpdateIncrementally(QString* err);
+
+    /**
+     * @brief updates the database in place. The repositories are parsed
+     *     while they are downloaded. The parser is stopped for the
+     *     repositories with an unchanged SHA1 and only the changed rows are
+     *     written.
+     * @param job job
+     * @param useCache true = cache will be used
+     */
+    void updateF5Incremental(Job* job, bool useCache);
+
+    /**
+     * @brief stores one repository in a temporary database and merges it in
+     *     this one
+     * @param job job
+     * @param index index of the repository (0, 1, 2, ...). Repositories with
+     *     lower indexes have higher priority.
+     * @param r the parsed repository
+     * @param sha1 SHA1 of the repository data
+     * @param url repository URL
+     * @param removed will be set to true if some rows of this repository
+     *     were removed. Rows of repositories with lower priority that were
+     *     hidden by them may be visible now.
+     */
+    void syncRepository(Job* job, int index, Repository* r,
+            const QString& sha1, const QString& url, bool* removed);
+
+    /**
+     * @brief writes the differences between the rows of one repository
+     *     stored in the attached database "tempdb" and in this database.
+     *     Rows owned by repositories with higher priority are not changed.
+     * @param index index of the repository
+     * @param removed will be set to true if some rows were removed
+     * @return error message
+     */
+    QString mergeRepository(int index, bool* removed);
+
+    /**
+     * @brief deletes the packages without versions
+     * @return error message
+     */
+    QString deletePackagesWithoutVersions();
 
     int count(const QString &sql, QString *err);
     QString getRepositorySHA1(const QString &url, QString *err);
@@ -101,6 +556,14 @@ private:
     QString readLinks(Package *p);
     QString deleteLinks(const QString &name);
     QString updateDatabase();
+
+    /**
+     * @brief changes the connection settings for a fast bulk load: no
+     *     journal, no synchronous writes, bigger page cache. This should only
+     *     be used for temporary databases that are thrown away on errors.
+     * @return error message
+     */
+    QString optimizeForBulkLoad();
     void transferFrom(Job *job, const QString &databaseFilename);
 public:
     /** index of the current repository used for saving the packages */
@@ -148,7 +611,50 @@ public:
     QString savePackage(Package *p, bool replace);
 
     /**
-     * @brief opens the default database
+     * @brief starts the bulk ingest mode for an empty database. The
+     *     ingest*() methods collect the rows and write them in big batches
+     *     with multi-row INSERT statements. Secondary indexes are deleted and
+     *     re-created by endIngest().
+     * @return error message
+     */
+    QString beginIngest();
+
+    /**
+     * @brief stores a package in the bulk ingest mode. A package with the
+     *     same name that was already stored is not replaced.
+     * @param p a package
+     * @return error message
+     */
+    QString ingestPackage(Package* p);
+
+    /**
+     * @brief stores a package version in the bulk ingest mode. An already
+     *     stored package version is not replaced.
+     * @param p a package version
+     * @return error message
+     */
+    QString ingestPackageVersion(PackageVersion* p);
+
+    /**
+     * @brief stores a license in the bulk ingest mode. An already stored
+     *     license is not replaced.
+     * @param p a license
+     * @return error message
+     */
+    QString ingestLicense(License* p);
+
+    /**
+     * @brief writes all collected rows, re-creates the indexes and ends the
+     *     bulk ingest mode
+     * @return error message
+     */
+    QString endIngest();
+
+    /**
+     * @brief opens the default database. The database is shared with other
+     *     threads and processes: it is used in the WAL mode and the read
+     *     methods use a pool of read-only connections (one per thread), so
+     *     that they are not blocked by a long running update.
      * @param databaseName name for the database
      * @param readOnly true = open in read-only mode
      * @return error
@@ -161,10 +667,12 @@ public:
      * @param connectionName name for the database connection
      * @param file database file
      * @param readOnly true = open in read-only mode
+     * @param shared true = use the WAL mode and a pool of read-only
+     *     connections for the read methods
      * @return error
      */
     QString open(const QString &connectionName, const QString &file,
-            bool readOnly=false);
+            bool readOnly=false, bool shared=false);
 
     /**
      * @brief update the status for the specified package
@@ -187,7 +695,8 @@ public:
 
     /**
      * @brief updates the status for currently installed packages in
-     *     PACKAGE.STATUS
+     *     PACKAGE.STATUS. PACKAGE_VERSION.INSTALLED and PACKAGE.STATUS are
+     *     re-computed for all packages in one transaction.
      * @param job job
      */
     void updateStatusForInstalled(Job *job);
@@ -197,6 +706,55 @@ public:
     QList<PackageVersion*> getPackageVersions_(const QString& package,
             QString *err) const;
 
+    QList<PackageVersion*> getPackageVersionHeaders_(const QString& package,
+            QString *err) const;
+
+    /**
+     * @brief finds the newest package version with a download URL. Only one
+     *     row is read using the index on PACKAGE_VERSION.VERSION_KEY.
+     * @param package full package name
+     * @param err error message will be stored here
+     * @return [ownership:caller] found package version or 0
+     */
+    PackageVersion* findNewestInstallablePackageVersion_(
+            const QString& package, QString *err) const;
+
+    /**
+     * @brief searches for package versions with a download URL in a range
+     *     of version numbers. The range is resolved by the index on
+     *     PACKAGE_VERSION(PACKAGE, VERSION_KEY). Only the returned package
+     *     versions are decoded.
+     * @param package full package name
+     * @param min lower bound
+     * @param minIncluded true = min belongs to the range
+     * @param max upper bound
+     * @param maxIncluded true = max belongs to the range
+     * @param avoid these package versions are skipped. They are only
+     *     compared by the package name and version.
+     * @param limit maximum number of returned objects or -1 for all
+     * @param err error message will be stored here
+     * @return [ownership:caller] found package versions. The first returned
+     *     object has the highest version number. The objects are decoded
+     *     lazily (see PackageVersion::materialize()).
+     */
+    QList<PackageVersion*> findInstallableInRange_(const QString& package,
+            const Version& min, bool minIncluded,
+            const Version& max, bool maxIncluded,
+            const QList<PackageVersion*>& avoid, int limit,
+            QString *err) const;
+
+    /**
+     * @brief searches for the package versions with a download URL that
+     *     match a dependency using findInstallableInRange_()
+     * @param d a dependency
+     * @param avoid these package versions are skipped
+     * @param err error message will be stored here
+     * @return [ownership:caller] found package versions, newest first. The
+     *     objects are decoded lazily (see PackageVersion::materialize()).
+     */
+    QList<PackageVersion*> findInstallableMatches_(const Dependency& d,
+            const QList<PackageVersion*>& avoid, QString* err) const;
+
     /**
      * @brief returns all package versions with at least one <detect-file>
      *     entry
@@ -212,13 +770,15 @@ public:
      * @param status filter for the package status if filterByStatus is true
      * @param statusInclude true = only return packages with the given status,
      *     false = return all packages with the status not equal to the given
-     * @param query search query (keywords)
+     * @param query search query (keywords). Every keyword is searched as a
+     *     prefix of a word in the full-text index.
      * @param cat0 filter for the level 0 of categories. -1 means "All",
      *     0 means "Uncategorized"
      * @param cat1 filter for the level 1 of categories. -1 means "All",
      *     0 means "Uncategorized"
      * @param err error message will be stored here
-     * @return found packages
+     * @return found packages. If a query is specified, the packages are sorted
+     *     by relevance, otherwise by title.
      */
     QStringList findPackages(Package::Status status, bool filterByStatus,
             const QString &query, int cat0, int cat1, QString* err) const;
@@ -296,6 +856,21 @@ public:
      */
     QString saveRepositories(const QStringList& reps);
 
+    /**
+     * @return number of times a prepared statement was re-used
+     */
+    int getStatementCacheHits() const;
+
+    /**
+     * @return number of times a new statement had to be prepared
+     */
+    int getStatementCacheMisses() const;
+
+    /**
+     * @return one line with the number of statement cache hits and misses
+     */
+    QString dumpStatementCacheStatistics() const;
+
     /**
      * @brief searches for packages
      * @param names names for the packages
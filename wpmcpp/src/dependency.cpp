@@ -198,22 +198,17 @@ PackageVersion* Dependency::findBestMatchToInstall(
     DBRepository* r = DBRepository::getDefault();
     PackageVersion* res = 0;
 
-    QList<PackageVersion*> pvs = r->getPackageVersions_(this->package, err);
-    if (err->isEmpty()) {
-        for (int i = 0; i < pvs.count(); i++) {
-            PackageVersion* pv = pvs.at(i);
-            if (this->test(pv->version) &&
-                    pv->download.isValid() &&
-                    PackageVersion::indexOf(avoid, pv) < 0) {
-                if (res == 0 || pv->version.compare(res->version) > 0)
-                    res = pv;
-            }
+    QList<PackageVersion*> pvs = r->findInstallableInRange_(this->package,
+            this->min, this->minIncluded, this->max, this->maxIncluded,
+            avoid, 1, err);
+    if (err->isEmpty() && pvs.count() > 0) {
+        res = pvs.takeFirst();
+        *err = res->materialize();
+        if (!err->isEmpty()) {
+            delete res;
+            res = 0;
         }
     }
-
-    if (res) {
-        res = res->clone();
-    }
     qDeleteAll(pvs);
 
     return res;
@@ -223,22 +218,10 @@ QList<PackageVersion*> Dependency::findAllMatchesToInstall(
         const QList<PackageVersion*>& avoid, QString* err)
 {
     DBRepository* r = DBRepository::getDefault();
-    QList<PackageVersion*> res;
-
-    QList<PackageVersion*> pvs = r->getPackageVersions_(this->package, err);
-    if (err->isEmpty()) {
-        for (int i = 0; i < pvs.count(); i++) {
-            PackageVersion* pv = pvs.at(i);
-            if (this->test(pv->version) &&
-                    pv->download.isValid() &&
-                    PackageVersion::indexOf(avoid, pv) < 0) {
-                res.append(pv->clone());
-            }
-        }
-    }
-    qDeleteAll(pvs);
 
-    return res;
+    return r->findInstallableInRange_(this->package,
+            this->min, this->minIncluded, this->max, this->maxIncluded,
+            avoid, -1, err);
 }
 
 InstalledPackageVersion* Dependency::findHighestInstalledMatch() const
@@ -68,7 +68,9 @@ public:
      *     dependency by
      *     being installed. Returned objects should be destroyed later.
      *     The returned objects are sorted by the package version number. The
-     *     first returned object has the highest version number.
+     *     first returned object has the highest version number. Only the
+     *     header fields are decoded. PackageVersion::materialize() must be
+     *     called before the files or dependencies are accessed.
      */
     QList<PackageVersion *> findAllMatchesToInstall(
             const QList<PackageVersion *> &avoid, QString *err);
@@ -0,0 +1,832 @@
+#include "dependencysolver.h"
+
+#include <QObject>
+
+#include "abstractrepository.h"
+#include "reversedependencies.h"
+
+DependencySolver::DependencySolver(AbstractRepository* rep)
+{
+    this->rep = rep;
+    this->maxConflicts = 100000;
+    this->propagated = 0;
+    this->conflicts = 0;
+    this->decisions = 0;
+    this->firstNewVar = 0;
+}
+
+DependencySolver::~DependencySolver()
+{
+    clear();
+}
+
+void DependencySolver::setMaxConflicts(int maxConflicts)
+{
+    this->maxConflicts = maxConflicts;
+}
+
+void DependencySolver::clear()
+{
+    qDeleteAll(vars);
+    vars.clear();
+    var2index.clear();
+    installedVars.clear();
+    removable.clear();
+    installedByPackage.clear();
+    firstNewVar = 0;
+    var2requirements.clear();
+    requirements.clear();
+    goalVars.clear();
+    removeGoalVars.clear();
+    candidatesCache.clear();
+    clauses.clear();
+    watches.clear();
+    assigns.clear();
+    levels.clear();
+    reasons.clear();
+    trail.clear();
+    trailLimits.clear();
+    propagated = 0;
+    conflicts = 0;
+    decisions = 0;
+}
+
+QString DependencySolver::toKey(const QString& package,
+        const Version& version) const
+{
+    return package + "@" + version.getVersionString();
+}
+
+int DependencySolver::addVariable(PackageVersion* pv, bool installed)
+{
+    int r = vars.count();
+    vars.append(pv);
+    var2index.insert(toKey(pv->package, pv->version), r);
+    installedVars.append(installed);
+    removable.append(!installed);
+    if (installed)
+        installedByPackage.insert(pv->package, r);
+    var2requirements.append(QVector<int>());
+    watches.append(QVector<int>());
+    watches.append(QVector<int>());
+    assigns.append(-1);
+    levels.append(0);
+    reasons.append(-1);
+    return r;
+}
+
+bool DependencySolver::addClause(const QVector<int>& c)
+{
+    if (c.count() == 1) {
+        int v = value(c.at(0));
+        if (v == 0)
+            return false;
+        if (v < 0)
+            assign(c.at(0), -1);
+    } else {
+        int index = clauses.count();
+        clauses.append(c);
+        watches[c.at(0)].append(index);
+        watches[c.at(1)].append(index);
+    }
+    return true;
+}
+
+bool DependencySolver::findInstalledMatches(int var, const Dependency* d,
+        QVector<int>* matches) const
+{
+    bool fixed = false;
+    PackageVersion* pv = vars.at(var);
+    QMultiHash<QString, int>::const_iterator it =
+            installedByPackage.constFind(d->package);
+    while (it != installedByPackage.constEnd() && it.key() == d->package) {
+        int index = it.value();
+        PackageVersion* ipv = vars.at(index);
+        if ((ipv->package != pv->package || ipv->version != pv->version) &&
+                d->test(ipv->version)) {
+            matches->append(index);
+            if (!removable.at(index))
+                fixed = true;
+        }
+        ++it;
+    }
+    return fixed;
+}
+
+void DependencySolver::addRequirement(int var, Dependency* d,
+        const QVector<int>& candidates)
+{
+    Requirement r;
+    r.var = var;
+    r.dependency = d;
+    r.candidates = candidates;
+    var2requirements[var].append(requirements.count());
+    requirements.append(r);
+
+    QVector<int> c;
+    c.append(2 * var + 1);
+    for (int k = 0; k < candidates.count(); k++) {
+        c.append(2 * candidates.at(k));
+    }
+
+    // only unit clauses can be in conflict here and they may only
+    // exclude package versions that are not goals yet
+    addClause(c);
+}
+
+QString DependencySolver::addInstalled(const QList<PackageVersion*>& installed,
+        const QList<PackageVersion*>& remove)
+{
+    QString err;
+
+    for (int i = 0; i < installed.count(); i++) {
+        PackageVersion* pv = installed.at(i);
+        if (!var2index.contains(toKey(pv->package, pv->version)))
+            addVariable(pv->clone(), true);
+    }
+    firstNewVar = vars.count();
+
+    for (int i = 0; i < remove.count(); i++) {
+        PackageVersion* pv = remove.at(i);
+        int index = var2index.value(toKey(pv->package, pv->version), -1);
+        if (index >= 0 && !removeGoalVars.contains(index))
+            removeGoalVars.append(index);
+    }
+
+    if (removeGoalVars.count() > 0) {
+        // the dependencies of the installed package versions are only
+        // necessary if something is removed
+        QList<PackageVersion*> ipvs;
+        for (int i = 0; i < firstNewVar; i++) {
+            err = vars.at(i)->materialize();
+            if (!err.isEmpty())
+                break;
+            ipvs.append(vars.at(i));
+        }
+
+        // everything that depends on a removed package version directly or
+        // indirectly may be removed too
+        if (err.isEmpty()) {
+            ReverseDependencies rd(ipvs);
+            QVector<int> queue = removeGoalVars;
+            for (int i = 0; i < queue.count(); i++)
+                removable[queue.at(i)] = true;
+            for (int i = 0; i < queue.count(); i++) {
+                PackageVersion* pv = vars.at(queue.at(i));
+                QList<ReverseDependencies::Dependent> ds =
+                        rd.findDependents(pv->package, pv->version);
+                for (int j = 0; j < ds.count(); j++) {
+                    int index = var2index.value(toKey(ds.at(j).pv->package,
+                            ds.at(j).pv->version));
+                    if (!removable.at(index)) {
+                        removable[index] = true;
+                        queue.append(index);
+                    }
+                }
+            }
+        }
+    }
+
+    if (err.isEmpty()) {
+        for (int i = 0; i < firstNewVar; i++) {
+            if (!removable.at(i))
+                addClause(QVector<int>() << 2 * i);
+        }
+    }
+
+    return err;
+}
+
+void DependencySolver::addInstalledRequirements()
+{
+    QMultiHash<QString, int> newByPackage;
+    for (int i = firstNewVar; i < vars.count(); i++) {
+        newByPackage.insert(vars.at(i)->package, i);
+    }
+
+    for (int i = 0; i < firstNewVar; i++) {
+        if (!removable.at(i))
+            continue;
+
+        // an installed package version is removed if a dependency is
+        // satisfied neither by an installed package version that is kept nor
+        // by a new one. Dependencies that are not satisfied now are ignored.
+        PackageVersion* pv = vars.at(i);
+        for (int j = 0; j < pv->dependencies.count(); j++) {
+            Dependency* d = pv->dependencies.at(j);
+            QVector<int> matches;
+            if (findInstalledMatches(i, d, &matches) || matches.count() == 0)
+                continue;
+
+            QMultiHash<QString, int>::const_iterator it =
+                    newByPackage.constFind(d->package);
+            while (it != newByPackage.constEnd() && it.key() == d->package) {
+                if (d->test(vars.at(it.value())->version))
+                    matches.append(it.value());
+                ++it;
+            }
+
+            addRequirement(i, d, matches);
+        }
+    }
+}
+
+void DependencySolver::addExclusions()
+{
+    QMultiHash<QString, int> newByPackage;
+    for (int i = firstNewVar; i < vars.count(); i++) {
+        const QString& package = vars.at(i)->package;
+        QMultiHash<QString, int>::const_iterator it =
+                newByPackage.constFind(package);
+        while (it != newByPackage.constEnd() && it.key() == package) {
+            addClause(QVector<int>() << 2 * it.value() + 1 << 2 * i + 1);
+            ++it;
+        }
+        newByPackage.insert(package, i);
+    }
+}
+
+void DependencySolver::resetClauses(int count, const QVector<int>& units)
+{
+    clauses.resize(count);
+    for (int i = 0; i < watches.count(); i++) {
+        watches[i].clear();
+    }
+    for (int i = 0; i < clauses.count(); i++) {
+        watches[clauses.at(i).at(0)].append(i);
+        watches[clauses.at(i).at(1)].append(i);
+    }
+
+    for (int i = 0; i < assigns.count(); i++) {
+        assigns[i] = -1;
+        reasons[i] = -1;
+    }
+    trail.clear();
+    trailLimits.clear();
+    propagated = 0;
+
+    for (int i = 0; i < units.count(); i++) {
+        assign(units.at(i), -1);
+    }
+}
+
+QString DependencySolver::buildClauses(const QList<PackageVersion*>& avoid)
+{
+    QString err;
+
+    // breadth-first search. New variables are appended to "vars" while the
+    // loop is running.
+    for (int i = firstNewVar; i < vars.count(); i++) {
+        PackageVersion* pv = vars.at(i);
+
+        err = pv->materialize();
+        if (!err.isEmpty())
+            break;
+
+        for (int j = 0; j < pv->dependencies.count(); j++) {
+            Dependency* d = pv->dependencies.at(j);
+
+            // installed matches are preferred
+            QVector<int> candidates;
+            if (findInstalledMatches(i, d, &candidates))
+                continue;
+
+            QString key = d->package + " " + d->versionsToString();
+            QVector<int> matches;
+            if (candidatesCache.contains(key)) {
+                matches = candidatesCache.value(key);
+            } else {
+                QList<PackageVersion*> pvs = rep->findInstallableMatches_(
+                        *d, avoid, &err);
+                if (!err.isEmpty()) {
+                    err = QString(QObject::tr("Error searching for the dependency matches: %1")).
+                            arg(err);
+                    qDeleteAll(pvs);
+                    break;
+                }
+                for (int k = 0; k < pvs.count(); k++) {
+                    PackageVersion* m = pvs.at(k);
+                    int index = var2index.value(
+                            toKey(m->package, m->version), -1);
+                    if (index >= 0)
+                        delete m;
+                    else
+                        index = addVariable(m, false);
+                    matches.append(index);
+                }
+                candidatesCache.insert(key, matches);
+            }
+
+            // a package version cannot satisfy its own dependency
+            for (int k = 0; k < matches.count(); k++) {
+                int index = matches.at(k);
+                if (index != i && !candidates.contains(index))
+                    candidates.append(index);
+            }
+
+            addRequirement(i, d, candidates);
+        }
+
+        if (!err.isEmpty())
+            break;
+    }
+
+    return err;
+}
+
+int DependencySolver::value(int lit) const
+{
+    int a = assigns.at(lit >> 1);
+    if (a < 0)
+        return -1;
+    return (lit & 1) ? 1 - a : a;
+}
+
+void DependencySolver::assign(int lit, int reason)
+{
+    int v = lit >> 1;
+    assigns[v] = (lit & 1) ? 0 : 1;
+    levels[v] = trailLimits.count();
+    reasons[v] = reason;
+    trail.append(lit);
+}
+
+int DependencySolver::propagate()
+{
+    int conflict = -1;
+
+    while (conflict < 0 && propagated < trail.count()) {
+        // this literal is now false
+        int falseLit = trail.at(propagated++) ^ 1;
+
+        QVector<int>& ws = watches[falseLit];
+        int i = 0, j = 0;
+        while (i < ws.count()) {
+            int ci = ws.at(i++);
+            QVector<int>& c = clauses[ci];
+
+            // the false literal is always the second one
+            if (c.at(0) == falseLit) {
+                c[0] = c.at(1);
+                c[1] = falseLit;
+            }
+
+            if (value(c.at(0)) == 1) {
+                ws[j++] = ci;
+                continue;
+            }
+
+            // search for a new literal to watch
+            bool found = false;
+            for (int k = 2; k < c.count(); k++) {
+                if (value(c.at(k)) != 0) {
+                    c[1] = c.at(k);
+                    c[k] = falseLit;
+                    watches[c.at(1)].append(ci);
+                    found = true;
+                    break;
+                }
+            }
+            if (found)
+                continue;
+
+            ws[j++] = ci;
+            if (value(c.at(0)) == 0) {
+                conflict = ci;
+                while (i < ws.count())
+                    ws[j++] = ws.at(i++);
+            } else {
+                assign(c.at(0), ci);
+            }
+        }
+        ws.resize(j);
+    }
+
+    return conflict;
+}
+
+int DependencySolver::analyze(int conflict, QVector<int>* learnt)
+{
+    QVector<bool> seen(vars.count(), false);
+    int level = trailLimits.count();
+
+    learnt->clear();
+
+    // place for the asserting literal
+    learnt->append(-1);
+
+    int pathCount = 0;
+    int p = -1;
+    int index = trail.count() - 1;
+    int ci = conflict;
+    do {
+        const QVector<int>& c = clauses.at(ci);
+
+        // the first literal of a reason clause is the implied one
+        for (int k = (p < 0 ? 0 : 1); k < c.count(); k++) {
+            int q = c.at(k);
+            int v = q >> 1;
+            if (!seen.at(v) && levels.at(v) > 0) {
+                seen[v] = true;
+                if (levels.at(v) >= level)
+                    pathCount++;
+                else
+                    learnt->append(q);
+            }
+        }
+
+        // the next literal from the current decision level
+        while (!seen.at(trail.at(index) >> 1))
+            index--;
+        p = trail.at(index);
+        index--;
+        ci = reasons.at(p >> 1);
+        seen[p >> 1] = false;
+        pathCount--;
+    } while (pathCount > 0);
+
+    (*learnt)[0] = p ^ 1;
+
+    // the literal with the highest decision level is watched too
+    int backjump = 0;
+    if (learnt->count() > 1) {
+        int max = 1;
+        for (int k = 2; k < learnt->count(); k++) {
+            if (levels.at(learnt->at(k) >> 1) >
+                    levels.at(learnt->at(max) >> 1))
+                max = k;
+        }
+        int tmp = learnt->at(1);
+        (*learnt)[1] = learnt->at(max);
+        (*learnt)[max] = tmp;
+        backjump = levels.at(learnt->at(1) >> 1);
+    }
+
+    return backjump;
+}
+
+void DependencySolver::backtrack(int level)
+{
+    if (trailLimits.count() > level) {
+        int start = trailLimits.at(level);
+        for (int i = trail.count() - 1; i >= start; i--) {
+            int v = trail.at(i) >> 1;
+            assigns[v] = -1;
+            reasons[v] = -1;
+        }
+        trail.resize(start);
+        trailLimits.resize(level);
+        propagated = start;
+    }
+}
+
+int DependencySolver::pickBranchLiteral() const
+{
+    // an open dependency of a package version that will be installed is
+    // satisfied by the first possible match
+    for (int i = 0; i < requirements.count(); i++) {
+        const Requirement& r = requirements.at(i);
+        if (assigns.at(r.var) != 1)
+            continue;
+
+        int free = -1;
+        bool satisfied = false;
+        for (int j = 0; j < r.candidates.count(); j++) {
+            int a = assigns.at(r.candidates.at(j));
+            if (a == 1) {
+                satisfied = true;
+                break;
+            }
+            if (a < 0 && free < 0)
+                free = r.candidates.at(j);
+        }
+
+        if (!satisfied && free >= 0)
+            return 2 * free;
+    }
+
+    // installed package versions are kept, everything else is not
+    // installed
+    for (int i = 0; i < assigns.count(); i++) {
+        if (assigns.at(i) < 0)
+            return installedVars.at(i) ? 2 * i : 2 * i + 1;
+    }
+
+    return -1;
+}
+
+QString DependencySolver::solve(bool* unsat)
+{
+    QString err;
+    int start = conflicts;
+
+    if (unsat)
+        *unsat = false;
+
+    while (true) {
+        int conflict = propagate();
+        if (conflict >= 0) {
+            conflicts++;
+            if (trailLimits.count() == 0) {
+                err = explainFailure();
+                if (unsat)
+                    *unsat = true;
+                break;
+            }
+            if (conflicts - start > maxConflicts) {
+                err = QString(QObject::tr("The dependencies could not be resolved after %1 conflicts")).
+                        arg(maxConflicts);
+                break;
+            }
+
+            QVector<int> learnt;
+            int level = analyze(conflict, &learnt);
+            backtrack(level);
+            if (learnt.count() == 1) {
+                assign(learnt.at(0), -1);
+            } else {
+                int index = clauses.count();
+                clauses.append(learnt);
+                watches[learnt.at(0)].append(index);
+                watches[learnt.at(1)].append(index);
+                assign(learnt.at(0), index);
+            }
+        } else {
+            int lit = pickBranchLiteral();
+            if (lit < 0)
+                break;
+
+            decisions++;
+            trailLimits.append(trail.count());
+            assign(lit, -1);
+        }
+    }
+
+    return err;
+}
+
+QString DependencySolver::explainFailure() const
+{
+    // a dependency of a goal without any possible match
+    for (int i = 0; i < goalVars.count(); i++) {
+        const QVector<int>& rs = var2requirements.at(goalVars.at(i));
+        for (int j = 0; j < rs.count(); j++) {
+            const Requirement& r = requirements.at(rs.at(j));
+            bool possible = false;
+            for (int k = 0; k < r.candidates.count(); k++) {
+                if (assigns.at(r.candidates.at(k)) != 0) {
+                    possible = true;
+                    break;
+                }
+            }
+            if (!possible)
+                return QString(QObject::tr("Unsatisfied dependency: %1")).
+                        arg(getTitle(r.dependency->package) + " " +
+                        r.dependency->versionsToString());
+        }
+    }
+
+    if (goalVars.count() == 0)
+        return QObject::tr("Cannot resolve the dependencies");
+
+    int goal = goalVars.at(0);
+    for (int i = 0; i < goalVars.count(); i++) {
+        if (assigns.at(goalVars.at(i)) == 0) {
+            goal = goalVars.at(i);
+            break;
+        }
+    }
+
+    PackageVersion* pv = vars.at(goal);
+    return QString(QObject::tr("Cannot resolve the dependencies of %1")).
+            arg(getTitle(pv->package) + " " + pv->version.getVersionString());
+}
+
+QString DependencySolver::getTitle(const QString& package) const
+{
+    QString r = package;
+    Package* p = rep->findPackage_(package);
+    if (p)
+        r = p->title;
+    delete p;
+    return r;
+}
+
+void DependencySolver::sortTopologically(int var, int value,
+        QVector<bool>* visited, QVector<int>* order) const
+{
+    (*visited)[var] = true;
+
+    const QVector<int>& rs = var2requirements.at(var);
+    for (int i = 0; i < rs.count(); i++) {
+        const Requirement& r = requirements.at(rs.at(i));
+        for (int j = 0; j < r.candidates.count(); j++) {
+            int c = r.candidates.at(j);
+            if (assigns.at(c) == value && !visited->at(c))
+                sortTopologically(c, value, visited, order);
+        }
+    }
+
+    order->append(var);
+}
+
+bool DependencySolver::canReplace(int remove, int install) const
+{
+    // all other dependents of the old version must be satisfied by
+    // installed package versions that are kept
+    for (int i = 0; i < requirements.count(); i++) {
+        const Requirement& r = requirements.at(i);
+        if (r.var == remove || !installedVars.at(r.var) ||
+                !r.candidates.contains(remove))
+            continue;
+
+        if (assigns.at(r.var) != 1)
+            return false;
+
+        bool ok = false;
+        for (int j = 0; j < r.candidates.count(); j++) {
+            int c = r.candidates.at(j);
+            if (c != remove && installedVars.at(c) && assigns.at(c) == 1) {
+                ok = true;
+                break;
+            }
+        }
+        if (!ok)
+            return false;
+    }
+
+    // the new version only needs package versions that are already
+    // installed
+    const QVector<int>& rs = var2requirements.at(install);
+    for (int i = 0; i < rs.count(); i++) {
+        const Requirement& r = requirements.at(rs.at(i));
+        bool ok = false;
+        for (int j = 0; j < r.candidates.count(); j++) {
+            int c = r.candidates.at(j);
+            if (c != remove && installedVars.at(c) && assigns.at(c) == 1) {
+                ok = true;
+                break;
+            }
+        }
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+void DependencySolver::addOperation(int var, bool install,
+        QList<PackageVersion*>& installed,
+        QList<InstallOperation*>& ops) const
+{
+    PackageVersion* pv = vars.at(var);
+    InstallOperation* io = new InstallOperation();
+    io->install = install;
+    io->package = pv->package;
+    io->version = pv->version;
+    ops.append(io);
+
+    if (install) {
+        installed.append(pv->clone());
+    } else {
+        int index = PackageVersion::indexOf(installed, pv);
+        if (index >= 0)
+            installed.removeAt(index);
+    }
+}
+
+QString DependencySolver::plan(const QList<PackageVersion*>& install,
+        const QList<PackageVersion*>& remove,
+        QList<PackageVersion*>& installed,
+        QList<InstallOperation*>& ops,
+        const QList<PackageVersion*>& avoid)
+{
+    clear();
+
+    QString err = addInstalled(installed, remove);
+
+    if (err.isEmpty()) {
+        for (int i = 0; i < install.count(); i++) {
+            PackageVersion* pv = install.at(i);
+            int index = var2index.value(toKey(pv->package, pv->version), -1);
+            if (index < 0)
+                index = addVariable(pv->clone(), false);
+            if (!goalVars.contains(index))
+                goalVars.append(index);
+        }
+
+        err = buildClauses(avoid);
+    }
+
+    if (err.isEmpty())
+        addInstalledRequirements();
+
+    if (err.isEmpty()) {
+        bool ok = true;
+        for (int i = 0; i < removeGoalVars.count(); i++) {
+            if (!addClause(QVector<int>() << 2 * removeGoalVars.at(i) + 1))
+                ok = false;
+        }
+        for (int i = 0; i < goalVars.count(); i++) {
+            if (!addClause(QVector<int>() << 2 * goalVars.at(i)))
+                ok = false;
+        }
+
+        if (ok) {
+            // only unit clauses were assigned until now
+            int count = clauses.count();
+            QVector<int> units = trail;
+
+            // the exclusions are only dropped if they make the clauses
+            // unsatisfiable. The conflict budget is not spent twice.
+            addExclusions();
+            bool unsat;
+            err = solve(&unsat);
+            if (!err.isEmpty() && unsat) {
+                resetClauses(count, units);
+                err = solve();
+            }
+        } else {
+            err = explainFailure();
+        }
+    }
+
+    if (err.isEmpty()) {
+        QVector<bool> done(vars.count(), false);
+
+        // updates where the old version can be removed first
+        for (int i = 0; i < removeGoalVars.count(); i++) {
+            int r = removeGoalVars.at(i);
+            for (int j = 0; j < goalVars.count(); j++) {
+                int g = goalVars.at(j);
+                if (!done.at(g) && !installedVars.at(g) &&
+                        vars.at(g)->package == vars.at(r)->package &&
+                        canReplace(r, g)) {
+                    addOperation(r, false, installed, ops);
+                    addOperation(g, true, installed, ops);
+                    done[r] = true;
+                    done[g] = true;
+                    break;
+                }
+            }
+        }
+
+        // installations: dependencies first
+        QVector<bool> visited = done;
+        QVector<int> order;
+        for (int i = 0; i < goalVars.count(); i++) {
+            if (!visited.at(goalVars.at(i)))
+                sortTopologically(goalVars.at(i), 1, &visited, &order);
+        }
+        for (int i = firstNewVar; i < vars.count(); i++) {
+            if (assigns.at(i) == 1 && !visited.at(i))
+                sortTopologically(i, 1, &visited, &order);
+        }
+        for (int i = 0; i < order.count(); i++) {
+            if (!installedVars.at(order.at(i)))
+                addOperation(order.at(i), true, installed, ops);
+        }
+
+        // removals: dependents first
+        visited = done;
+        order.clear();
+        for (int i = 0; i < firstNewVar; i++) {
+            if (assigns.at(i) == 0 && !visited.at(i))
+                sortTopologically(i, 0, &visited, &order);
+        }
+        for (int i = order.count() - 1; i >= 0; i--) {
+            addOperation(order.at(i), false, installed, ops);
+        }
+    }
+
+    return err;
+}
+
+QString DependencySolver::planInstallation(const QList<PackageVersion*>& goals,
+        QList<PackageVersion*>& installed,
+        QList<InstallOperation*>& ops,
+        const QList<PackageVersion*>& avoid)
+{
+    return plan(goals, QList<PackageVersion*>(), installed, ops, avoid);
+}
+
+int DependencySolver::getVariableCount() const
+{
+    return vars.count();
+}
+
+int DependencySolver::getClauseCount() const
+{
+    return clauses.count();
+}
+
+int DependencySolver::getConflictCount() const
+{
+    return conflicts;
+}
+
+int DependencySolver::getDecisionCount() const
+{
+    return decisions;
+}
+
@@ -0,0 +1,371 @@
+#ifndef DEPENDENCYSOLVER_H
+#define DEPENDENCYSOLVER_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QMultiHash>
+
+#include "packageversion.h"
+#include "dependency.h"
+#include "installoperation.h"
+
+class AbstractRepository;
+
+/**
+ * @brief plans the installation and removal of package versions together
+ *     with all their dependencies and dependents.
+ *
+ * Every package version that is installed or could be installed is a
+ * boolean variable. A dependency of a package version is a clause
+ * "not pv or c1 or c2 or ..." where c1, c2, ... are the installed matches
+ * followed by the installable matches sorted by version number
+ * (newest first). Installed package versions that neither should be removed
+ * nor depend on one that should be removed are fixed. The goals are unit
+ * clauses. The clauses are solved by
+ * conflict-driven clause learning (CDCL): unit propagation with two watched
+ * literals, learning of first-UIP clauses and non-chronological
+ * backtracking. The decision heuristic always satisfies an open dependency
+ * by the newest candidate that is not yet excluded. Other variables are
+ * decided as "installed" for installed package versions and
+ * "not installed" otherwise.
+ *
+ * The first search allows at most one new version of every package so that
+ * the dependents share a common version where possible. If the clauses
+ * cannot be satisfied with this restriction, the search is repeated without
+ * it. The search is not repeated if it was aborted after too many conflicts.
+ *
+ * Each package version is decoded and each dependency range is queried only
+ * once per plan, regardless of how many paths lead to it.
+ */
+class DependencySolver
+{
+    /**
+     * @brief a dependency of a package version that is not satisfied by an
+     *     installed package version
+     */
+    struct Requirement
+    {
+        /** variable for the dependent package version */
+        int var;
+
+        /** [ownership:vars.at(var)] the dependency */
+        Dependency* dependency;
+
+        /** variables for the matching package versions, newest first */
+        QVector<int> candidates;
+    };
+
+    AbstractRepository* rep;
+
+    int maxConflicts;
+
+    /** [ownership:this] package versions for the variables */
+    QList<PackageVersion*> vars;
+
+    /** "package@version" -> variable */
+    QHash<QString, int> var2index;
+
+    /** variable -> true if the package version is installed */
+    QVector<bool> installedVars;
+
+    /** variable -> true if the variable is not fixed on level 0 */
+    QVector<bool> removable;
+
+    /** full package name -> variables for installed package versions */
+    QMultiHash<QString, int> installedByPackage;
+
+    /** index of the first variable that is not installed */
+    int firstNewVar;
+
+    /** variable -> indexes in requirements */
+    QVector<QVector<int> > var2requirements;
+
+    QList<Requirement> requirements;
+
+    /** variables for the package versions that should be installed */
+    QVector<int> goalVars;
+
+    /** variables for the package versions that should be removed */
+    QVector<int> removeGoalVars;
+
+    /** package + version range -> variables for the matches */
+    QHash<QString, QVector<int> > candidatesCache;
+
+    /**
+     * clauses. A literal is 2 * variable for "installed" and
+     * 2 * variable + 1 for "not installed".
+     */
+    QVector<QVector<int> > clauses;
+
+    /** literal -> clauses where this literal is one of the first two */
+    QVector<QVector<int> > watches;
+
+    /** variable -> -1: unassigned, 0: false, 1: true */
+    QVector<signed char> assigns;
+
+    /** variable -> decision level of the assignment */
+    QVector<int> levels;
+
+    /** variable -> index of the clause that implied the assignment or -1 */
+    QVector<int> reasons;
+
+    /** assigned literals in the order of assignment */
+    QVector<int> trail;
+
+    /** decision level -> first index in trail */
+    QVector<int> trailLimits;
+
+    /** index of the next literal in trail for the unit propagation */
+    int propagated;
+
+    int conflicts;
+    int decisions;
+
+    void clear();
+
+    QString toKey(const QString& package, const Version& version) const;
+
+    /**
+     * @param pv [ownership:this] a package version
+     * @param installed true if the package version is installed
+     * @return new variable
+     */
+    int addVariable(PackageVersion* pv, bool installed);
+
+    /**
+     * @brief searches for the installed package versions matching a
+     *     dependency
+     * @param var variable for the dependent package version
+     * @param d the dependency
+     * @param matches the variables for matching package versions will be
+     *     stored here
+     * @return true if one of the matches is fixed as installed
+     */
+    bool findInstalledMatches(int var, const Dependency* d,
+            QVector<int>* matches) const;
+
+    /**
+     * @brief adds a requirement and the corresponding clause
+     * @param var variable for the dependent package version
+     * @param d the dependency
+     * @param candidates variables for the matching package versions
+     */
+    void addRequirement(int var, Dependency* d, const QVector<int>& candidates);
+
+    /**
+     * @brief creates the variables for the installed package versions and
+     *     marks those that may be removed
+     * @param installed installed package versions
+     * @param remove package versions that should be removed
+     * @return error message
+     */
+    QString addInstalled(const QList<PackageVersion*>& installed,
+            const QList<PackageVersion*>& remove);
+
+    /**
+     * @brief adds the requirements for the installed package versions that
+     *     may be removed. Must be called after buildClauses().
+     */
+    void addInstalledRequirements();
+
+    /**
+     * @brief adds a clause. Unit clauses are assigned immediately.
+     * @param c literals
+     * @return false if the clause is in conflict on the decision level 0
+     */
+    bool addClause(const QVector<int>& c);
+
+    /**
+     * @brief adds clauses that allow at most one new version of every
+     *     package
+     */
+    void addExclusions();
+
+    /**
+     * @brief removes all clauses added after the specified number and
+     *     resets the assignments
+     * @param count number of clauses that should be kept
+     * @param units these literals are assigned on the decision level 0
+     */
+    void resetClauses(int count, const QVector<int>& units);
+
+    /**
+     * @brief creates the variables and clauses for all package versions
+     *     reachable from the goals
+     * @param avoid these package versions are not considered
+     * @return error message
+     */
+    QString buildClauses(const QList<PackageVersion*>& avoid);
+
+    /**
+     * @param lit a literal
+     * @return -1: unassigned, 0: false, 1: true
+     */
+    int value(int lit) const;
+
+    void assign(int lit, int reason);
+
+    /**
+     * @return index of the conflicting clause or -1
+     */
+    int propagate();
+
+    /**
+     * @brief computes the first UIP clause for a conflict
+     * @param conflict index of the conflicting clause
+     * @param learnt the learned clause will be stored here. The first
+     *     literal is the asserting one, the second has the highest decision
+     *     level among the others.
+     * @return decision level for the backjump
+     */
+    int analyze(int conflict, QVector<int>* learnt);
+
+    void backtrack(int level);
+
+    /**
+     * @return literal for the next decision or -1 if all variables are
+     *     assigned
+     */
+    int pickBranchLiteral() const;
+
+    /**
+     * @param unsat [ownership:caller] true will be stored here if the
+     *     clauses cannot be satisfied, false if the search was aborted after
+     *     too many conflicts. May be 0.
+     * @return error message
+     */
+    QString solve(bool* unsat = 0);
+
+    /**
+     * @return explanation why the goals cannot be installed
+     */
+    QString explainFailure() const;
+
+    /**
+     * @param package full package name
+     * @return package title from the repository or the package name
+     */
+    QString getTitle(const QString& package) const;
+
+    /**
+     * @brief appends a variable after all its dependencies with the same
+     *     value
+     * @param var a variable
+     * @param value 1 for installed or 0 for removed dependencies
+     * @param visited visited variables
+     * @param order the variables will be appended here
+     */
+    void sortTopologically(int var, int value, QVector<bool>* visited,
+            QVector<int>* order) const;
+
+    /**
+     * @param remove variable for an installed package version that will be
+     *     removed
+     * @param install variable for a new version of the same package
+     * @return true if "remove" can be uninstalled before "install" is
+     *     installed without breaking any other package version
+     */
+    bool canReplace(int remove, int install) const;
+
+    /**
+     * @brief appends an operation
+     * @param var a variable
+     * @param install true = install, false = remove
+     * @param installed list of installed package versions that will be
+     *     updated
+     * @param ops the operation will be appended here
+     */
+    void addOperation(int var, bool install, QList<PackageVersion*>& installed,
+            QList<InstallOperation*>& ops) const;
+public:
+    /**
+     * @param rep [ownership:caller] repository used to search for the
+     *     dependency matches
+     */
+    DependencySolver(AbstractRepository* rep);
+
+    ~DependencySolver();
+
+    /**
+     * @param maxConflicts maximum number of conflicts in one search before
+     *     it is aborted with an error. The default value is 100000.
+     */
+    void setMaxConflicts(int maxConflicts);
+
+    /**
+     * @brief plans the installation and removal of many package versions in
+     *     one pass. An update is the installation of the new and the removal
+     *     of the old version. At most one new version of every package is
+     *     preferred. This preference is dropped if no plan satisfies it.
+     * @param install [ownership:caller] these package versions should be
+     *     installed
+     * @param remove [ownership:caller] these package versions should be
+     *     removed. Installed package versions that depend on them are also
+     *     removed if the dependency is not satisfied otherwise.
+     * @param installed [ownership:caller] list of installed package
+     *     versions. The objects for newly installed package versions will be
+     *     appended. The objects for removed package versions will be removed
+     *     from the list, but not destroyed.
+     * @param ops [ownership:caller] the necessary operations will be
+     *     appended here. Every package version is installed or removed at
+     *     most once. If an old version can be removed without affecting
+     *     other package versions and the new version does not need any
+     *     other new package versions, the old version is removed first.
+     *     Other package versions are installed after their dependencies and
+     *     afterwards removed before their dependencies.
+     * @param avoid [ownership:caller] these package versions are not
+     *     considered as dependency matches
+     * @return error message or ""
+     */
+    QString plan(const QList<PackageVersion*>& install,
+            const QList<PackageVersion*>& remove,
+            QList<PackageVersion*>& installed,
+            QList<InstallOperation*>& ops,
+            const QList<PackageVersion*>& avoid=QList<PackageVersion*>());
+
+    /**
+     * @brief plans the installation of the specified package versions
+     * @param goals [ownership:caller] these package versions should be
+     *     installed. Package versions from the list "installed" are ignored.
+     * @param installed [ownership:caller] list of installed package
+     *     versions. The objects for newly installed package versions will be
+     *     appended.
+     * @param ops [ownership:caller] the necessary operations will be
+     *     appended here. A package version is always installed after its
+     *     dependencies.
+     * @param avoid [ownership:caller] these package versions are not
+     *     considered as dependency matches
+     * @return error message or ""
+     */
+    QString planInstallation(const QList<PackageVersion*>& goals,
+            QList<PackageVersion*>& installed,
+            QList<InstallOperation*>& ops,
+            const QList<PackageVersion*>& avoid);
+
+    /**
+     * @return number of variables (installed and installable package
+     *     versions) in the last plan
+     */
+    int getVariableCount() const;
+
+    /**
+     * @return number of clauses (including the learned ones) in the last
+     *     plan
+     */
+    int getClauseCount() const;
+
+    /**
+     * @return number of conflicts in the last plan (in both searches if the
+     *     first one failed)
+     */
+    int getConflictCount() const;
+
+    /**
+     * @return number of decisions in the last plan
+     */
+    int getDecisionCount() const;
+};
+
+#endif // DEPENDENCYSOLVER_H
@@ -11,6 +11,7 @@
 #include <QWaitCondition>
 #include <QMutex>
 #include <QCryptographicHash>
+#include <QFile>
 
 #include "downloader.h"
 #include "job.h"
@@ -19,10 +20,10 @@
 HWND defaultPasswordWindow = 0;
 
 int64_t Downloader::downloadWin(Job* job, const QUrl& url, LPCWSTR verb,
-        QFile* file,
+        QIODevice* file,
         QString* mime, QString* contentDisposition,
         HWND parentWindow, QString* sha1, bool useCache,
-        QCryptographicHash::Algorithm alg)
+        QCryptographicHash::Algorithm alg, DownloadState* state)
 {
     QString initialTitle = job->getTitle();
 
@@ -106,7 +107,8 @@ int64_t Downloader::downloadWin(Job* job, const QUrl& url, LPCWSTR verb,
         return -1L;
     }
 
-    if (!HttpAddRequestHeadersW(hResourceHandle,
+    // byte ranges of a compressed response cannot be resumed
+    if (!state && !HttpAddRequestHeadersW(hResourceHandle,
             L"Accept-Encoding: gzip, deflate", -1,
             HTTP_ADDREQ_FLAG_ADD)) {
         QString errMsg;
@@ -116,6 +118,19 @@ int64_t Downloader::downloadWin(Job* job, const QUrl& url, LPCWSTR verb,
         return -1L;
     }
 
+    if (state && state->isResumable()) {
+        QString headers = state->getRangeHeaders();
+        if (!HttpAddRequestHeadersW(hResourceHandle,
+                (WCHAR*) headers.utf16(), -1,
+                HTTP_ADDREQ_FLAG_ADD | HTTP_ADDREQ_FLAG_REPLACE)) {
+            QString errMsg;
+            WPMUtils::formatMessage(GetLastError(), &errMsg);
+            job->setErrorMessage(errMsg);
+            job->complete();
+            return -1L;
+        }
+    }
+
     // qDebug() << "download.5";
     while (true) {
         // qDebug() << "download.5.1";
@@ -219,6 +234,10 @@ int64_t Downloader::downloadWin(Job* job, const QUrl& url, LPCWSTR verb,
                 }
             } else if (dwStatus == HTTP_STATUS_OK) {
                 break;
+            } else if (state && (dwStatus == HTTP_STATUS_PARTIAL_CONTENT ||
+                    dwStatus == 416)) {
+                // 416 = Range Not Satisfiable is handled in startResumedData
+                break;
             } else {
                 job->setErrorMessage(QString(
                         QObject::tr("Cannot handle HTTP status code %1")).
@@ -314,9 +333,20 @@ out:
 
     job->setProgress(0.05);
 
+    if (state && file) {
+        startResumedData(job, hResourceHandle, file, gzip, contentLength,
+                state);
+        if (!job->getErrorMessage().isEmpty()) {
+            InternetCloseHandle(internet);
+            job->complete();
+            return -1L;
+        }
+    }
+
     Job* sub = job->newSubJob(0.95, QObject::tr("Reading the data"));
     if (file)
-        readData(sub, hResourceHandle, file, sha1, gzip, contentLength, alg);
+        readData(sub, hResourceHandle, file, sha1, gzip, contentLength, alg,
+                state);
     if (!sub->getErrorMessage().isEmpty())
         job->setErrorMessage(sub->getErrorMessage());
 
@@ -329,6 +359,71 @@ out:
     return contentLength;
 }
 
+QString Downloader::queryHeader(HINTERNET hResourceHandle, DWORD info)
+{
+    QString r;
+    WCHAR buffer[1024];
+    DWORD bufferLength = sizeof(buffer);
+    DWORD index = 0;
+    if (HttpQueryInfoW(hResourceHandle, info, buffer, &bufferLength, &index))
+        r.setUtf16((ushort*) buffer, bufferLength / 2);
+    return r;
+}
+
+void Downloader::startResumedData(Job* job, HINTERNET hResourceHandle,
+        QIODevice* file, bool gzip, int64_t contentLength,
+        DownloadState* state)
+{
+    DWORD status, statusSize = sizeof(status);
+    if (!HttpQueryInfo(hResourceHandle, HTTP_QUERY_FLAG_NUMBER |
+            HTTP_QUERY_STATUS_CODE, &status, &statusSize, NULL)) {
+        QString errMsg;
+        WPMUtils::formatMessage(GetLastError(), &errMsg);
+        job->setErrorMessage(errMsg);
+        return;
+    }
+
+    if (status == HTTP_STATUS_PARTIAL_CONTENT && !gzip) {
+        QString range = queryHeader(hResourceHandle,
+                HTTP_QUERY_CONTENT_RANGE);
+        qint64 start, total;
+        if (!DownloadState::parseContentRange(range, &start, &total) ||
+                start != state->bytes) {
+            job->setErrorMessage(QString(
+                    QObject::tr("Unexpected Content-Range: %1")).arg(range));
+
+            // the next try starts from the beginning
+            state->restart();
+        } else {
+            state->total = total;
+        }
+        return;
+    }
+
+    // the server sends the whole file
+    if (file->pos() > 0) {
+        QFile* f = qobject_cast<QFile*>(file);
+        if (!f || !f->resize(0) || !f->seek(0)) {
+            job->setErrorMessage(QObject::tr("Cannot truncate the file"));
+            return;
+        }
+    }
+    state->restart();
+
+    if (status == 416) {
+        job->setErrorMessage(
+                QObject::tr("The server cannot resume the download"));
+    } else if (status == HTTP_STATUS_PARTIAL_CONTENT) {
+        job->setErrorMessage(
+                QObject::tr("The server sent a compressed part of the file"));
+    } else if (!gzip) {
+        state->etag = queryHeader(hResourceHandle, HTTP_QUERY_ETAG);
+        state->lastModified = queryHeader(hResourceHandle,
+                HTTP_QUERY_LAST_MODIFIED);
+        state->total = contentLength;
+    }
+}
+
 bool Downloader::internetReadFileFully(HINTERNET resourceHandle,
         PVOID buffer, DWORD bufferSize, PDWORD bufferLength)
 {
@@ -355,13 +450,19 @@ bool Downloader::internetReadFileFully(HINTERNET resourceHandle,
     return result;
 }
 
-void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
-        QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg)
+void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle,
+        QIODevice* file,
+        QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg,
+        DownloadState* state)
 {
     QString initialTitle = job->getTitle();
 
     // download/compute SHA1 loop
-    QCryptographicHash hash(alg);
+    QCryptographicHash hash_(alg);
+    QCryptographicHash* hash = sha1 ? &hash_ : 0;
+    if (state && state->hash)
+        hash = state->hash;
+
     const int bufferSize = 512 * 1024;
     unsigned char* buffer = new unsigned char[bufferSize];
     const int buffer2Size = 512 * 1024;
@@ -497,12 +598,17 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
                 inflateEnd(&d_stream);
                 break;
             } else {
-                if (sha1)
-                    hash.addData((char*) buffer2,
-                            buffer2Size - d_stream.avail_out);
+                if (file->write((char*) buffer2,
+                        buffer2Size - d_stream.avail_out) < 0) {
+                    job->setErrorMessage(file->errorString());
+                    break;
+                }
 
-                file->write((char*) buffer2,
-                        buffer2Size - d_stream.avail_out);
+                if (hash)
+                    hash->addData((char*) buffer2,
+                            buffer2Size - d_stream.avail_out);
+                if (state)
+                    state->bytes += buffer2Size - d_stream.avail_out;
             }
         } while (d_stream.avail_out == 0);
 
@@ -530,8 +636,9 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
                 arg(err));
     }
 
-    if (sha1 && !job->isCancelled() && job->getErrorMessage().isEmpty())
-        *sha1 = hash.result().toHex().toLower();
+    if (hash && sha1 && !job->isCancelled() &&
+            job->getErrorMessage().isEmpty())
+        *sha1 = hash->result().toHex().toLower();
 
 // out:
     delete[] buffer;
@@ -543,13 +650,19 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
     job->complete();
 }
 
-void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
-        QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg)
+void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle,
+        QIODevice* file,
+        QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg,
+        DownloadState* state)
 {
     QString initialTitle = job->getTitle();
 
     // download/compute SHA1 loop
-    QCryptographicHash hash(alg);
+    QCryptographicHash hash_(alg);
+    QCryptographicHash* hash = sha1 ? &hash_ : 0;
+    if (state && state->hash)
+        hash = state->hash;
+
     const int bufferSize = 512 * 1024;
     unsigned char* buffer = new unsigned char[bufferSize];
 
@@ -568,11 +681,16 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
         if (bufferLength == 0)
             break;
 
-        // update SHA1 if necessary
-        if (sha1)
-            hash.addData((char*) buffer, bufferLength);
+        if (file->write((char*) buffer, bufferLength) < 0) {
+            job->setErrorMessage(file->errorString());
+            break;
+        }
 
-        file->write((char*) buffer, bufferLength);
+        // the hash sum and the state only contain the written data
+        if (hash)
+            hash->addData((char*) buffer, bufferLength);
+        if (state)
+            state->bytes += bufferLength;
 
         alreadyRead += bufferLength;
         if (contentLength > 0) {
@@ -589,28 +707,38 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
         }
     } while (bufferLength != 0 && !job->isCancelled());
 
+    if (!job->isCancelled() && job->getErrorMessage().isEmpty() &&
+            contentLength > 0 && alreadyRead < contentLength)
+        job->setErrorMessage(QString(
+                QObject::tr("The connection was closed after %L1 of %L2 bytes")).
+                arg(alreadyRead).arg(contentLength));
+
     if (!job->isCancelled() && job->getErrorMessage().isEmpty())
         job->setProgress(1);
 
-    if (sha1 && !job->isCancelled() && job->getErrorMessage().isEmpty())
-        *sha1 = hash.result().toHex().toLower();
+    if (hash && sha1 && !job->isCancelled() &&
+            job->getErrorMessage().isEmpty())
+        *sha1 = hash->result().toHex().toLower();
 
     delete[] buffer;
 
     job->complete();
 }
 
-void Downloader::readData(Job* job, HINTERNET hResourceHandle, QFile* file,
+void Downloader::readData(Job* job, HINTERNET hResourceHandle,
+        QIODevice* file,
         QString* sha1, bool gzip, int64_t contentLength,
-        QCryptographicHash::Algorithm alg)
+        QCryptographicHash::Algorithm alg, DownloadState* state)
 {
     if (gzip)
-        readDataGZip(job, hResourceHandle, file, sha1, contentLength, alg);
+        readDataGZip(job, hResourceHandle, file, sha1, contentLength, alg,
+                state);
     else
-        readDataFlat(job, hResourceHandle, file, sha1, contentLength, alg);
+        readDataFlat(job, hResourceHandle, file, sha1, contentLength, alg,
+                state);
 }
 
-void Downloader::download(Job* job, const QUrl& url, QFile* file,
+void Downloader::download(Job* job, const QUrl& url, QIODevice* file,
         QString* sha1, QCryptographicHash::Algorithm alg, bool useCache, QString *mime)
 {
     QString contentDisposition;
@@ -642,7 +770,91 @@ void Downloader::download(Job* job, const QUrl& url, QFile* file,
     }
 }
 
-void Downloader::copyFile(Job* job, const QString& source, QFile* file,
+void Downloader::downloadResumable(Job* job, const QUrl& url,
+        const QString& fileName, QString* sha1,
+        QCryptographicHash::Algorithm alg, int tries)
+{
+    if (url.scheme() != "http" && url.scheme() != "https") {
+        QFile file(fileName);
+        if (file.open(QFile::WriteOnly | QFile::Truncate)) {
+            download(job, url, &file, sha1, alg, false);
+            file.close();
+        } else {
+            job->setErrorMessage(QString(QObject::tr("Cannot open the file: %1")).
+                    arg(fileName));
+            job->complete();
+        }
+        return;
+    }
+
+    QString stateFile = fileName + ".state";
+    QCryptographicHash hash(alg);
+    DownloadState state;
+    QFile file(fileName);
+
+    // continue a download started earlier. The state of the hash sum cannot
+    // be stored and is computed again.
+    if (state.load(stateFile).isEmpty() && state.url == url.toString() &&
+            state.isResumable() && file.open(QFile::ReadWrite)) {
+        Job* sub = job->newSubJob(0.05,
+                QObject::tr("Computing the hash sum of the downloaded part"));
+        state.bytes = qMin(state.bytes, file.size());
+        qint64 rest = state.bytes;
+        while (rest > 0) {
+            QByteArray buffer = file.read(qMin(rest, (qint64) 512 * 1024));
+            if (buffer.isEmpty())
+                break;
+            hash.addData(buffer);
+            rest -= buffer.size();
+        }
+        if (rest != 0 || !file.resize(state.bytes) || !file.seek(state.bytes))
+            state.restart();
+        sub->completeWithProgress();
+    } else {
+        state = DownloadState();
+        state.url = url.toString();
+        if (!file.open(QFile::ReadWrite | QFile::Truncate))
+            job->setErrorMessage(QString(QObject::tr("Cannot open the file: %1")).
+                    arg(fileName));
+    }
+    state.hash = &hash;
+
+    QString err;
+    for (int i = 0; i < tries && job->shouldProceed(); i++) {
+        QString title;
+        if (state.bytes == 0)
+            title = QObject::tr("Downloading");
+        else
+            title = QString(QObject::tr("Resuming the download at %L1 bytes")).
+                    arg(state.bytes);
+
+        Job* sub = job->newSubJob(1 - job->getProgress(), title);
+        downloadWin(sub, url, L"GET", &file, 0, 0, defaultPasswordWindow, 0,
+                false, alg, &state);
+        err = sub->getErrorMessage();
+        if (err.isEmpty() && !sub->isCancelled())
+            break;
+
+        file.flush();
+        state.save(stateFile);
+    }
+
+    if (file.isOpen())
+        file.close();
+
+    if (!err.isEmpty()) {
+        job->setErrorMessage(err);
+    } else if (job->shouldProceed()) {
+        QFile::remove(stateFile);
+        if (sha1)
+            *sha1 = hash.result().toHex().toLower();
+        job->setProgress(1);
+    }
+
+    job->complete();
+}
+
+void Downloader::copyFile(Job* job, const QString& source, QIODevice* file,
          QString* sha1, QCryptographicHash::Algorithm alg) {
     QFile srcFile(source);
     if (!srcFile.open(QFile::ReadOnly)) {
@@ -662,7 +874,10 @@ void Downloader::copyFile(Job* job, const QString& source, QFile* file,
 
             if (sha1)
                 crypto.addData(data, c);
-            file->write(data, c);
+            if (file->write(data, c) < 0) {
+                job->setErrorMessage(file->errorString());
+                break;
+            }
 
             progress += c;
             if (srcSize != 0)
@@ -13,6 +13,7 @@
 #include <QCryptographicHash>
 
 #include "job.h"
+#include "downloadstate.h"
 
 /**
  * Blocks execution and downloads a file over http.
@@ -21,15 +22,41 @@ class Downloader: QObject
 {
     Q_OBJECT
 
-    static void readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
+    static void readDataFlat(Job* job, HINTERNET hResourceHandle,
+            QIODevice* file,
             QString* sha1, int64_t contentLength,
-            QCryptographicHash::Algorithm alg);
-    static void readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
+            QCryptographicHash::Algorithm alg, DownloadState* state);
+    static void readDataGZip(Job* job, HINTERNET hResourceHandle,
+            QIODevice* file,
             QString* sha1, int64_t contentLength,
-            QCryptographicHash::Algorithm alg);
-    static void readData(Job* job, HINTERNET hResourceHandle, QFile* file,
+            QCryptographicHash::Algorithm alg, DownloadState* state);
+    static void readData(Job* job, HINTERNET hResourceHandle,
+            QIODevice* file,
             QString* sha1, bool gzip, int64_t contentLength,
-            QCryptographicHash::Algorithm alg);
+            QCryptographicHash::Algorithm alg, DownloadState* state);
+
+    /**
+     * @param hResourceHandle request handle
+     * @param info HTTP_QUERY_* constant
+     * @return value of the response header or ""
+     */
+    static QString queryHeader(HINTERNET hResourceHandle, DWORD info);
+
+    /**
+     * @brief checks the response to a resumed request. If the server sent
+     *     the whole file, the file is truncated and the state is restarted.
+     *
+     * @param job the error message is set here
+     * @param hResourceHandle request handle
+     * @param file the file. This must be a QFile if data was already
+     *     downloaded.
+     * @param gzip true if the response uses the gzip or deflate encoding
+     * @param contentLength value of the Content-Length header or -1
+     * @param state state of the download
+     */
+    static void startResumedData(Job* job, HINTERNET hResourceHandle,
+            QIODevice* file, bool gzip, int64_t contentLength,
+            DownloadState* state);
 
     static bool internetReadFileFully(HINTERNET resourceHandle,
             PVOID buffer, DWORD bufferSize, PDWORD bufferLength);
@@ -53,13 +80,17 @@ class Downloader: QObject
      * @param sha1 if not null, SHA1 will be computed and stored here
      * @param useCache true = use Windows Internet cache on the local disk
      * @param alg algorithm that should be used to compute the hash sum
+     * @param state if not null, the download continues at state->bytes
+     *     using Range/If-Range requests. The compression is not used and
+     *     state->hash is updated instead of a new hash sum.
      * @return "content-length" or -1 if unknown
      */
     static int64_t downloadWin(Job* job, const QUrl& url,
-            LPCWSTR verb, QFile* file,
+            LPCWSTR verb, QIODevice* file,
             QString* mime, QString* contentDisposition,
             HWND parentWindow=0, QString* sha1=0, bool useCache=false,
-                               QCryptographicHash::Algorithm alg=QCryptographicHash::Sha1);
+                               QCryptographicHash::Algorithm alg=QCryptographicHash::Sha1,
+            DownloadState* state=0);
 
     /**
      * Copies a file.
@@ -76,7 +107,7 @@ class Downloader: QObject
      * @param sha1 if not null, SHA1 will be computed and stored here
      * @param alg algorithm that should be used to compute the hash sum
      */
-    static void copyFile(Job *job, const QString &source, QFile *file,
+    static void copyFile(Job *job, const QString &source, QIODevice *file,
             QString *sha1,
             QCryptographicHash::Algorithm alg);
 public:
@@ -118,17 +149,42 @@ public:
      * @param url this URL will be downloaded. http://, https://, file:// and
      *     data:image/png;base64, are supported
      * @param sha1 if not null, SHA1 will be computed and stored here
-     * @param file the content will be stored here
+     * @param file the content will be stored here. This can be any open
+     *     device, e.g. a PipeBuffer that is read by another thread while
+     *     the download is running. The download fails if writing to the
+     *     device fails.
      * @param alg algorithm that should be used for computing the hash sum
      * @param mime if not null, MIME type will be stored here
      * @param useCache true = use Windows Internet cache on the local disk
      */
-    static void download(Job* job, const QUrl& url, QFile* file,
+    static void download(Job* job, const QUrl& url, QIODevice* file,
             QString* sha1=0,
             QCryptographicHash::Algorithm alg=QCryptographicHash::Sha1,
             bool useCache=true,
             QString* mime=0);
 
+    /**
+     * Downloads a file and resumes the transfer with HTTP Range requests
+     * if the connection fails. The state of a failed download is stored in
+     * fileName + ".state" and a later call with the same URL and file
+     * continues where the previous one stopped. The hash sum of the
+     * already downloaded part is computed again in this case.
+     *
+     * URLs other than http:// and https:// are downloaded without resuming.
+     *
+     * @param job job for this method
+     * @param url this URL will be downloaded
+     * @param fileName the content will be stored in this file
+     * @param sha1 if not null, the hash sum of the whole file will be
+     *     stored here
+     * @param alg algorithm that should be used for computing the hash sum
+     * @param tries maximum number of connections used for the download
+     */
+    static void downloadResumable(Job* job, const QUrl& url,
+            const QString& fileName, QString* sha1=0,
+            QCryptographicHash::Algorithm alg=QCryptographicHash::Sha1,
+            int tries=3);
+
     /**
      * @brief retrieves the content-length header for an URL.
      * @param job job object
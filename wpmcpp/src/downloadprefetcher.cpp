@@ -0,0 +1,234 @@
+#include <QObject>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QMutexLocker>
+
+#include "downloadprefetcher.h"
+#include "downloader.h"
+#include "windowsregistry.h"
+
+void DownloadPrefetcher::Worker::run()
+{
+    prefetcher->work();
+}
+
+DownloadPrefetcher::DownloadPrefetcher(const QList<PackageVersion*>& pvs)
+{
+    this->pvs = pvs;
+    this->maxParallel = DEFAULT_MAX_PARALLEL;
+    this->diskBudget = ((qint64) DEFAULT_DISK_BUDGET) * 1024 * 1024;
+
+    int n = pvs.count();
+    states.fill(QUEUED, n);
+    jobs.fill(0, n);
+    files.resize(n);
+    sizes.fill(0, n);
+    diskUsed = 0;
+    next = 0;
+    cancelled = false;
+}
+
+DownloadPrefetcher::~DownloadPrefetcher()
+{
+    cancel();
+
+    for (int i = 0; i < files.count(); i++) {
+        if (states.at(i) == DONE && !files.at(i).isEmpty())
+            QFile::remove(files.at(i));
+    }
+
+    qDeleteAll(workers);
+    qDeleteAll(jobs);
+}
+
+void DownloadPrefetcher::readSettings()
+{
+    WindowsRegistry npackd;
+    QString err = npackd.open(
+            HKEY_LOCAL_MACHINE, "Software\\Npackd\\Npackd", false, KEY_READ);
+    if (err.isEmpty()) {
+        DWORD v = npackd.getDWORD("prefetchDownloads", &err);
+        if (err.isEmpty())
+            maxParallel = v;
+
+        v = npackd.getDWORD("prefetchDiskBudget", &err);
+        if (err.isEmpty())
+            diskBudget = ((qint64) v) * 1024 * 1024;
+    }
+}
+
+void DownloadPrefetcher::setMaxParallel(int maxParallel)
+{
+    this->maxParallel = maxParallel;
+}
+
+int DownloadPrefetcher::getMaxParallel() const
+{
+    return maxParallel;
+}
+
+void DownloadPrefetcher::setDiskBudget(qint64 diskBudget)
+{
+    this->diskBudget = diskBudget;
+}
+
+qint64 DownloadPrefetcher::getDiskBudget() const
+{
+    return diskBudget;
+}
+
+void DownloadPrefetcher::start()
+{
+    for (int i = 0; i < maxParallel && i < pvs.count(); i++) {
+        Worker* w = new Worker();
+        w->prefetcher = this;
+        workers.append(w);
+        w->start(QThread::LowestPriority);
+    }
+}
+
+void DownloadPrefetcher::cancel()
+{
+    mutex.lock();
+    cancelled = true;
+    for (int i = 0; i < jobs.count(); i++) {
+        if (states.at(i) == RUNNING)
+            jobs.at(i)->cancel();
+    }
+    condition.wakeAll();
+    mutex.unlock();
+
+    for (int i = 0; i < workers.count(); i++) {
+        workers.at(i)->wait();
+    }
+}
+
+bool DownloadPrefetcher::canStart() const
+{
+    return !cancelled && !workers.isEmpty() &&
+            (diskUsed == 0 || diskUsed < diskBudget);
+}
+
+int DownloadPrefetcher::startNext()
+{
+    QMutexLocker locker(&mutex);
+
+    while (!cancelled && !canStart()) {
+        condition.wait(&mutex);
+    }
+
+    // package versions that were taken before their download started are
+    // skipped
+    while (next < pvs.count() && states.at(next) != QUEUED) {
+        next++;
+    }
+
+    if (cancelled || next >= pvs.count())
+        return -1;
+
+    int index = next++;
+    states[index] = RUNNING;
+    jobs[index] = new Job(QString(QObject::tr("Downloading %1")).
+            arg(pvs.at(index)->toString()));
+
+    return index;
+}
+
+void DownloadPrefetcher::work()
+{
+    while (true) {
+        int index = startNext();
+        if (index < 0)
+            break;
+
+        qint64 size = 0;
+        QString file = download(jobs.at(index), pvs.at(index), &size);
+
+        mutex.lock();
+        files[index] = file;
+        sizes[index] = size;
+        if (!file.isEmpty())
+            diskUsed += size;
+        states[index] = DONE;
+        condition.wakeAll();
+        mutex.unlock();
+    }
+}
+
+QString DownloadPrefetcher::download(Job* job, PackageVersion* pv,
+        qint64* size)
+{
+    QString r;
+
+    // the same limit for the HTTP connections as in PackageVersion::install
+    bool httpConnectionAcquired = false;
+    while (!job->isCancelled()) {
+        httpConnectionAcquired =
+                PackageVersion::httpConnections.tryAcquire(1, 1000);
+        if (httpConnectionAcquired)
+            break;
+    }
+
+    if (httpConnectionAcquired) {
+        QTemporaryFile f(QDir::tempPath() + "\\NpackdPrefetchXXXXXX");
+        f.setAutoRemove(false);
+        if (f.open()) {
+            QString fileName = f.fileName();
+            f.close();
+
+            QString hashSum;
+            Downloader::downloadResumable(job, pv->download, fileName,
+                    pv->sha1.isEmpty() ? 0 : &hashSum, pv->hashSumType);
+            *size = QFileInfo(fileName).size();
+
+            if (!job->isCancelled() && job->getErrorMessage().isEmpty() &&
+                    hashSum.toLower() == pv->sha1.toLower()) {
+                r = fileName;
+            } else {
+                QFile::remove(fileName);
+                QFile::remove(fileName + ".state");
+            }
+        }
+
+        PackageVersion::httpConnections.release();
+    }
+
+    return r;
+}
+
+QString DownloadPrefetcher::take(PackageVersion* pv, Job* job)
+{
+    QString r;
+    QString initialTitle = job->getTitle();
+
+    mutex.lock();
+    int index = pvs.indexOf(pv);
+    if (index >= 0) {
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Waiting for the download"));
+
+        // a queued download is only waited for if it will be started
+        while (!job->isCancelled() && (states.at(index) == RUNNING ||
+                (states.at(index) == QUEUED && canStart()))) {
+            condition.wait(&mutex, 1000);
+        }
+
+        if (states.at(index) == DONE) {
+            r = files.at(index);
+            if (!r.isEmpty())
+                diskUsed -= sizes.at(index);
+            states[index] = TAKEN;
+        } else if (states.at(index) == QUEUED) {
+            // the caller downloads the file itself
+            states[index] = TAKEN;
+        }
+        condition.wakeAll();
+    }
+    mutex.unlock();
+
+    job->setTitle(initialTitle);
+
+    return r;
+}
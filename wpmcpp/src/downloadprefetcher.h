@@ -0,0 +1,178 @@
+#ifndef DOWNLOADPREFETCHER_H
+#define DOWNLOADPREFETCHER_H
+
+#include <QList>
+#include <QVector>
+#include <QString>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+
+#include "packageversion.h"
+#include "job.h"
+
+/**
+ * @brief downloads the binaries of package versions in the background before
+ *     they are installed.
+ *
+ * The binaries are downloaded in the order of the package versions by at
+ * most getMaxParallel() threads. A new download only starts if the already
+ * downloaded and not yet taken files use less than getDiskBudget() bytes.
+ * The running downloads may exceed the budget. The hash sums are verified
+ * and only correct files are handed over by take().
+ */
+class DownloadPrefetcher
+{
+    /** a download thread */
+    class Worker: public QThread
+    {
+    public:
+        DownloadPrefetcher* prefetcher;
+
+        void run();
+    };
+
+    /** state of a download */
+    enum State {
+        QUEUED, RUNNING, DONE, TAKEN
+    };
+
+    /** [ownership:caller] */
+    QList<PackageVersion*> pvs;
+
+    int maxParallel;
+    qint64 diskBudget;
+
+    /** protects all fields below */
+    QMutex mutex;
+
+    /** signalled if a download was finished or a file was taken */
+    QWaitCondition condition;
+
+    QVector<State> states;
+
+    /** [ownership:this] jobs for the running downloads */
+    QVector<Job*> jobs;
+
+    /** downloaded files. Empty if the download failed. */
+    QVector<QString> files;
+
+    /** sizes of the downloaded files */
+    QVector<qint64> sizes;
+
+    /** disk space used by the downloaded and not yet taken files */
+    qint64 diskUsed;
+
+    /** index of the next package version that should be downloaded */
+    int next;
+
+    bool cancelled;
+
+    /** [ownership:this] */
+    QList<Worker*> workers;
+
+    /**
+     * @brief downloads the binaries until all are downloaded or the
+     *     prefetcher is cancelled. This method is called from the worker
+     *     threads.
+     */
+    void work();
+
+    /**
+     * @brief checks whether the next download can be started. At least one
+     *     file can always be downloaded. The mutex must be locked.
+     * @return true if the disk budget is not exhausted and the prefetcher
+     *     is running
+     */
+    bool canStart() const;
+
+    /**
+     * @brief waits for a free place in the disk budget and marks the next
+     *     download as running
+     * @return index of the package version or -1 if there is nothing to do
+     */
+    int startNext();
+
+    /**
+     * @brief downloads one binary
+     * @param job job
+     * @param pv package version
+     * @param size the size of the file will be stored here
+     * @return path to the file or "" if an error occured
+     */
+    QString download(Job* job, PackageVersion* pv, qint64* size);
+public:
+    /** default maximum number of parallel downloads */
+    static const int DEFAULT_MAX_PARALLEL = 2;
+
+    /** default disk budget in MiB */
+    static const int DEFAULT_DISK_BUDGET = 2048;
+
+    /**
+     * @param pvs [ownership:caller] package versions in the order they will
+     *     be installed
+     */
+    DownloadPrefetcher(const QList<PackageVersion*>& pvs);
+
+    /**
+     * @brief cancels the running downloads and deletes the files that were
+     *     not taken
+     */
+    ~DownloadPrefetcher();
+
+    /**
+     * @brief reads the settings from the registry
+     *     (HKLM\Software\Npackd\Npackd, values "prefetchDownloads" and
+     *     "prefetchDiskBudget" in MiB). Missing values are not changed.
+     */
+    void readSettings();
+
+    /**
+     * @param maxParallel maximum number of parallel downloads. 0 disables
+     *     the prefetching.
+     */
+    void setMaxParallel(int maxParallel);
+
+    /**
+     * @return maximum number of parallel downloads
+     */
+    int getMaxParallel() const;
+
+    /**
+     * @param diskBudget disk space in bytes that may be used by the
+     *     downloaded files
+     */
+    void setDiskBudget(qint64 diskBudget);
+
+    /**
+     * @return disk space in bytes that may be used by the downloaded files
+     */
+    qint64 getDiskBudget() const;
+
+    /**
+     * @brief starts the downloads in the background
+     */
+    void start();
+
+    /**
+     * @brief cancels the downloads and waits for the worker threads
+     */
+    void cancel();
+
+    /**
+     * @brief returns the downloaded binary for a package version. If the
+     *     download is running or queued and can be started within the disk
+     *     budget, this method waits for it. This method can be called from
+     *     any thread.
+     * @param pv a package version passed to the constructor
+     * @param job the title of this job is changed while waiting. The
+     *     waiting stops if the job is cancelled.
+     * @return [ownership:caller] path to the downloaded file with the
+     *     correct hash sum or "" if the binary was not (yet) downloaded or
+     *     the download failed. The file should be moved or deleted by the
+     *     caller.
+     */
+    QString take(PackageVersion* pv, Job* job);
+};
+
+#endif // DOWNLOADPREFETCHER_H
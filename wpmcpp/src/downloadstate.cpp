@@ -0,0 +1,115 @@
+#include <QObject>
+#include <QFile>
+#include <QSettings>
+#include <QRegExp>
+
+#include "downloadstate.h"
+
+DownloadState::DownloadState()
+{
+    bytes = 0;
+    total = -1;
+    hash = 0;
+}
+
+QString DownloadState::getValidator() const
+{
+    // weak ETags cannot be used in If-Range
+    if (!etag.isEmpty() && !etag.startsWith("W/"))
+        return etag;
+    else
+        return lastModified;
+}
+
+bool DownloadState::isResumable() const
+{
+    return bytes > 0 && !getValidator().isEmpty();
+}
+
+QString DownloadState::getRangeHeaders() const
+{
+    return QString("Range: bytes=%1-\r\nIf-Range: %2").arg(bytes).
+            arg(getValidator());
+}
+
+void DownloadState::restart()
+{
+    bytes = 0;
+    total = -1;
+    etag.clear();
+    lastModified.clear();
+    if (hash)
+        hash->reset();
+}
+
+QString DownloadState::save(const QString& fileName) const
+{
+    QString err;
+
+    QSettings s(fileName, QSettings::IniFormat);
+    s.setValue("url", url);
+    s.setValue("bytes", bytes);
+    s.setValue("total", total);
+    s.setValue("etag", etag);
+    s.setValue("lastModified", lastModified);
+    s.sync();
+
+    if (s.status() != QSettings::NoError)
+        err = QString(QObject::tr("Cannot save the download state to %1")).
+                arg(fileName);
+
+    return err;
+}
+
+QString DownloadState::load(const QString& fileName)
+{
+    QString err;
+
+    if (!QFile::exists(fileName))
+        err = QString(QObject::tr("File not found: %1")).arg(fileName);
+
+    if (err.isEmpty()) {
+        QSettings s(fileName, QSettings::IniFormat);
+        if (s.status() != QSettings::NoError) {
+            err = QString(QObject::tr("Cannot read the download state from %1")).
+                    arg(fileName);
+        } else {
+            url = s.value("url").toString();
+            bytes = s.value("bytes", 0).toLongLong();
+            total = s.value("total", -1).toLongLong();
+            etag = s.value("etag").toString();
+            lastModified = s.value("lastModified").toString();
+        }
+    }
+
+    return err;
+}
+
+bool DownloadState::parseContentRange(const QString& value, qint64* start,
+        qint64* total)
+{
+    QRegExp re("^\\s*bytes\\s+(\\d+)-(\\d+)/(\\d+|\\*)\\s*$");
+    re.setCaseSensitivity(Qt::CaseInsensitive);
+    if (!re.exactMatch(value))
+        return false;
+
+    bool ok;
+    *start = re.cap(1).toLongLong(&ok);
+    if (!ok)
+        return false;
+
+    qint64 end = re.cap(2).toLongLong(&ok);
+    if (!ok || end < *start)
+        return false;
+
+    // only a partial response for the rest of the file can be appended
+    if (re.cap(3) == "*") {
+        *total = -1;
+    } else {
+        *total = re.cap(3).toLongLong(&ok);
+        if (!ok || end != *total - 1)
+            return false;
+    }
+
+    return true;
+}
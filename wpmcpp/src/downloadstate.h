@@ -0,0 +1,89 @@
+#ifndef DOWNLOADSTATE_H
+#define DOWNLOADSTATE_H
+
+#include <QString>
+#include <QCryptographicHash>
+
+/**
+ * @brief state of a partial HTTP download. It is stored next to the
+ *     partially downloaded file so that the download can be resumed with
+ *     Range/If-Range requests.
+ */
+class DownloadState
+{
+public:
+    /** downloaded URL */
+    QString url;
+
+    /** number of bytes received and written to the file */
+    qint64 bytes;
+
+    /** size of the whole file or -1 if unknown */
+    qint64 total;
+
+    /** ETag header from the server or "" */
+    QString etag;
+
+    /** Last-Modified header from the server or "" */
+    QString lastModified;
+
+    /**
+     * [ownership:caller] running hash sum over the first "bytes" bytes or 0.
+     * This object is not stored by save().
+     */
+    QCryptographicHash* hash;
+
+    DownloadState();
+
+    /**
+     * @return validator for the If-Range header: a strong ETag or the
+     *     Last-Modified date. "" if there is none.
+     */
+    QString getValidator() const;
+
+    /**
+     * @return true if the download can be resumed
+     */
+    bool isResumable() const;
+
+    /**
+     * @return Range and If-Range request headers separated by CRLF
+     */
+    QString getRangeHeaders() const;
+
+    /**
+     * @brief starts the download from the beginning. The validators are
+     *     removed and the hash sum is reset.
+     */
+    void restart();
+
+    /**
+     * @brief saves the state
+     * @param fileName name of the state file
+     * @return error message
+     */
+    QString save(const QString& fileName) const;
+
+    /**
+     * @brief loads the state saved by save()
+     * @param fileName name of the state file
+     * @return error message
+     */
+    QString load(const QString& fileName);
+
+    /**
+     * @brief parses the value of a Content-Range header like
+     *     "bytes 100-999/1000"
+     * @param value header value
+     * @param start the first byte position will be stored here
+     * @param total the complete length will be stored here or -1 if
+     *     unknown ("*")
+     * @return true if the value is valid. The last byte position must not
+     *     be smaller than the first one and must be the last byte of the
+     *     file if the complete length is known.
+     */
+    static bool parseContentRange(const QString& value, qint64* start,
+            qint64* total);
+};
+
+#endif // DOWNLOADSTATE_H
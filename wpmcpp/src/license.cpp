@@ -13,3 +13,15 @@ License *License::clone() const
     r->url = this->url;
     return r;
 }
+
+void License::toXML(QXmlStreamWriter *w) const
+{
+    w->writeStartElement("license");
+    w->writeAttribute("name", this->name);
+    w->writeTextElement("title", this->title);
+    if (!this->url.isEmpty())
+        w->writeTextElement("url", this->url);
+    if (!this->description.isEmpty())
+        w->writeTextElement("description", this->description);
+    w->writeEndElement();
+}
@@ -2,6 +2,7 @@
 #define LICENSE_H
 
 #include "qstring.h"
+#include <QXmlStreamWriter>
 
 /**
  * License description.
@@ -34,6 +35,13 @@ public:
      * @return [ownership:caller] copy
      */
     License* clone() const;
+
+    /**
+     * Stores this object as XML <license>.
+     *
+     * @param w output
+     */
+    void toXML(QXmlStreamWriter *w) const;
 };
 
 #endif // LICENSE_H
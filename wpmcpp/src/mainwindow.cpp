@@ -58,6 +58,7 @@
 #include "installedpackages.h"
 #include "flowlayout.h"
 #include "scandiskthirdpartypm.h"
+#include "mysqlquery.h"
 #include "scanharddrivesthread.h"
 #include "visiblejobs.h"
 #include "progresstree2.h"
@@ -1674,6 +1675,23 @@ void MainWindow::on_actionAbout_triggered()
             arg(NPACKD_VERSION), true);
 }
 
+void MainWindow::on_actionSQL_statistics_triggered()
+{
+    QString txt;
+    if (!MySQLQuery::isStatisticsEnabled())
+        txt = QObject::tr("The collection of SQL statistics is disabled. Use Help > Collect SQL statistics to enable it.") +
+                "\n\n";
+    txt.append(MySQLQuery::dumpStatistics());
+    txt.append(DBRepository::getDefault()->dumpStatementCacheStatistics());
+    addTextTab(QObject::tr("SQL statistics"), txt, false);
+}
+
+void MainWindow::on_actionCollect_SQL_statistics_toggled(bool checked)
+{
+    MySQLQuery::setStatisticsEnabled(checked);
+    MySQLQuery::setSlowQueryThreshold(checked ? 100 : 0);
+}
+
 void MainWindow::on_tabWidget_tabCloseRequested(int index)
 {
     QWidget* w = this->ui->tabWidget->widget(index);
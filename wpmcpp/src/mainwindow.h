@@ -296,6 +296,8 @@ private slots:
     void repositoryStatusChanged(const QString &, const Version &);
     void monitoredJobChanged(const JobState& state);
     void on_actionFile_an_Issue_triggered();
+    void on_actionSQL_statistics_triggered();
+    void on_actionCollect_SQL_statistics_toggled(bool checked);
     void updateActionsSlot();
     void applicationFocusChanged(QWidget* old, QWidget* now);
     void on_actionInstall_triggered();
@@ -1,32 +1,305 @@
 #include "mysqlquery.h"
 
-MySQLQuery::MySQLQuery(QSqlDatabase db) : QSqlQuery(db)
+#include <QList>
+#include <QPair>
+#include <QRegExp>
+#include <QStringList>
+#include <QtAlgorithms>
+#include <QSqlError>
+
+const char* const MySQLQuery::OTHER_STATEMENTS = "(other statements)";
+
+QMutex MySQLQuery::statisticsMutex;
+QAtomicInt MySQLQuery::statisticsEnabled(0);
+QAtomicInt MySQLQuery::slowQueryThreshold(0);
+QHash<QString, MySQLQuery::Statistics> MySQLQuery::statistics;
+QList<QString> MySQLQuery::slowExecutions;
+
+/**
+ * @brief replaces the literals in an SQL statement by "?". Lists of
+ *     parameters are shortened to "?, ...".
+ * @param sql SQL
+ * @return normalized SQL
+ */
+static QString normalizeSQL(const QString& sql)
+{
+    QString r = sql;
+    r.replace(QRegExp("'([^']|'')*'"), "?");
+    r.replace(QRegExp("\\b\\d+(\\.\\d+)?\\b"), "?");
+    r.replace(QRegExp("\\?(\\s*,\\s*\\?)+"), "?, ...");
+
+    // multi-row INSERT
+    r.replace(QRegExp("VALUES\\s*\\([^()]*\\)(\\s*,\\s*\\([^()]*\\))+",
+            Qt::CaseInsensitive), "VALUES (?, ...), ...");
+    return r;
+}
+
+MySQLQuery::Statistics::Statistics()
+{
+    executions = 0;
+    errors = 0;
+    slow = 0;
+    totalMicros = 0;
+    maxMicros = 0;
+    rows = 0;
+    for (int i = 0; i < HISTOGRAM_SIZE; i++) {
+        histogram[i] = 0;
+    }
+}
+
+MySQLQuery::MySQLQuery(QSqlDatabase database) : QSqlQuery(database),
+        db(database), measuring(false), ok(true), rows(0), nanos(0)
+{
+}
+
+MySQLQuery::~MySQLQuery()
 {
+    if (measuring)
+        record();
 }
 
 bool MySQLQuery::exec(const QString &query)
 {
-    //DWORD start = GetTickCount();
+    if (measuring)
+        record();
+
+    if (!statisticsEnabled.load())
+        return QSqlQuery::exec(query);
+
+    QElapsedTimer timer;
+    timer.start();
     bool r = QSqlQuery::exec(query);
-    // qDebug() << query << (GetTickCount() - start);
+    nanos = timer.nsecsElapsed();
+
+    // ad-hoc SQL often contains data (e.g. lists of IDs or file names)
+    measuring = true;
+    ok = r;
+    sql = query;
+    key = normalizeSQL(query);
+    rows = 0;
+
     return r;
 }
 
 bool MySQLQuery::exec()
 {
-    //DWORD start = GetTickCount();
+    if (measuring)
+        record();
+
+    if (!statisticsEnabled.load())
+        return QSqlQuery::exec();
+
+    QElapsedTimer timer;
+    timer.start();
     bool r = QSqlQuery::exec();
-    // qDebug() << this->lastQuery() << (GetTickCount() - start);
+    nanos = timer.nsecsElapsed();
+
+    measuring = true;
+    ok = r;
+    sql = this->lastQuery();
+    key = sql;
+    rows = 0;
+
     return r;
 }
 
 bool MySQLQuery::prepare(const QString& query)
 {
+    if (measuring)
+        record();
+
     return QSqlQuery::prepare(query);
 }
 
 bool MySQLQuery::next()
 {
-    return QSqlQuery::next();
+    if (!measuring)
+        return QSqlQuery::next();
+
+    QElapsedTimer timer;
+    timer.start();
+    bool r = QSqlQuery::next();
+    nanos += timer.nsecsElapsed();
+
+    if (r)
+        rows++;
+
+    return r;
+}
+
+void MySQLQuery::finish()
+{
+    if (measuring)
+        record();
+
+    QSqlQuery::finish();
+}
+
+void MySQLQuery::record()
+{
+    measuring = false;
+
+    qint64 micros = nanos / 1000;
+
+    // the plan is only computed once for every statement
+    int threshold = slowQueryThreshold.load();
+    bool slow = threshold > 0 && micros >= threshold * 1000;
+    bool needsPlan = false;
+    if (slow) {
+        statisticsMutex.lock();
+        needsPlan = statistics.value(key).plan.isEmpty() &&
+                (statistics.contains(key) ||
+                statistics.count() < MAX_STATEMENTS);
+        statisticsMutex.unlock();
+    }
+
+    QString plan;
+    if (needsPlan)
+        plan = explain();
+
+    int bucket = 0;
+    qint64 limit = 100;
+    while (bucket < HISTOGRAM_SIZE - 1 && micros >= limit) {
+        bucket++;
+        limit *= 10;
+    }
+
+    statisticsMutex.lock();
+    if (slow) {
+        slowExecutions.prepend(QString("%1 ms, %2 rows: %3").
+                arg(micros / 1000.0, 0, 'f', 1).arg(rows).
+                arg(key.simplified()));
+        if (slowExecutions.count() > MAX_SLOW_EXECUTIONS)
+            slowExecutions.removeLast();
+    }
+    QString k = key;
+    if (!statistics.contains(k) && statistics.count() >= MAX_STATEMENTS)
+        k = OTHER_STATEMENTS;
+    Statistics& s = statistics[k];
+    s.executions++;
+    if (!ok)
+        s.errors++;
+    if (slow)
+        s.slow++;
+    s.totalMicros += micros;
+    if (micros > s.maxMicros)
+        s.maxMicros = micros;
+    s.rows += rows;
+    s.histogram[bucket]++;
+    if (!plan.isEmpty() && s.plan.isEmpty())
+        s.plan = plan;
+    statisticsMutex.unlock();
+}
+
+QString MySQLQuery::explain() const
+{
+    // the parameters are not bound. This does not change the plan.
+    QSqlQuery q(db);
+    QStringList r;
+    if (q.exec("EXPLAIN QUERY PLAN " + sql)) {
+        while (q.next()) {
+            r.append(q.value(3).toString());
+        }
+    } else {
+        r.append(q.lastError().text());
+    }
+
+    return r.join("\n");
+}
+
+void MySQLQuery::setStatisticsEnabled(bool enabled)
+{
+    statisticsEnabled.store(enabled ? 1 : 0);
+}
+
+bool MySQLQuery::isStatisticsEnabled()
+{
+    return statisticsEnabled.load() != 0;
+}
+
+void MySQLQuery::setSlowQueryThreshold(int ms)
+{
+    slowQueryThreshold.store(ms);
+}
+
+QHash<QString, MySQLQuery::Statistics> MySQLQuery::getStatistics()
+{
+    statisticsMutex.lock();
+    QHash<QString, Statistics> r = statistics;
+    statisticsMutex.unlock();
+
+    return r;
+}
+
+void MySQLQuery::resetStatistics()
+{
+    statisticsMutex.lock();
+    statistics.clear();
+    slowExecutions.clear();
+    statisticsMutex.unlock();
+}
+
+static bool totalTimeGreaterThan(
+        const QPair<qint64, QString>& e1, const QPair<qint64, QString>& e2)
+{
+    return e1.first > e2.first;
 }
 
+QString MySQLQuery::dumpStatistics()
+{
+    QHash<QString, Statistics> all = getStatistics();
+
+    statisticsMutex.lock();
+    QList<QString> slowList = slowExecutions;
+    statisticsMutex.unlock();
+
+    QList<QPair<qint64, QString> > order;
+    QHashIterator<QString, Statistics> it(all);
+    while (it.hasNext()) {
+        it.next();
+        order.append(qMakePair(it.value().totalMicros, it.key()));
+    }
+    qSort(order.begin(), order.end(), totalTimeGreaterThan);
+
+    QString r;
+    qint64 total = 0;
+    for (int i = 0; i < order.count(); i++) {
+        const QString& sql = order.at(i).second;
+        const Statistics& s = all[sql];
+        total += s.totalMicros;
+
+        r.append(QString("%1 ms total, %2 executions, %3 ms average, "
+                "%4 ms max, %5 rows, %6 errors, %7 slow\n").
+                arg(s.totalMicros / 1000.0, 0, 'f', 1).
+                arg(s.executions).
+                arg(s.totalMicros / 1000.0 / s.executions, 0, 'f', 3).
+                arg(s.maxMicros / 1000.0, 0, 'f', 1).
+                arg(s.rows).
+                arg(s.errors).
+                arg(s.slow));
+        r.append(QString("    <0.1ms: %1, <1ms: %2, <10ms: %3, <100ms: %4, "
+                "<1s: %5, >=1s: %6\n").
+                arg(s.histogram[0]).arg(s.histogram[1]).
+                arg(s.histogram[2]).arg(s.histogram[3]).
+                arg(s.histogram[4]).arg(s.histogram[5]));
+        r.append("    ").append(sql.simplified()).append("\n");
+        if (!s.plan.isEmpty()) {
+            QStringList lines = s.plan.split('\n');
+            for (int j = 0; j < lines.count(); j++) {
+                r.append("    plan: ").append(lines.at(j)).append("\n");
+            }
+        }
+    }
+    r.prepend(QString("%1 SQL statements, %2 ms total\n").
+            arg(order.count()).arg(total / 1000.0, 0, 'f', 1));
+
+    if (slowList.count() > 0) {
+        r.append(QString("The last %1 slow executions:\n").
+                arg(slowList.count()));
+        for (int i = 0; i < slowList.count(); i++) {
+            r.append("    ").append(slowList.at(i)).append("\n");
+        }
+    }
+
+    return r;
+}
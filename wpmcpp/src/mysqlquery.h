@@ -3,14 +3,161 @@
 
 #include <QSqlQuery>
 #include <QSqlDatabase>
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QList>
 
+/**
+ * @brief QSqlQuery with optional statistics about the executed statements.
+ *     The statistics are collected per SQL text if they were enabled via
+ *     setStatisticsEnabled(). Literals in SQL passed to exec(const QString&)
+ *     are replaced by "?" so that such statements share one entry. At most
+ *     MAX_STATEMENTS different statements are recorded separately. One
+ *     execution lasts from exec() until finish(), the next exec() or the
+ *     destruction of the query and includes the time spent in next().
+ */
 class MySQLQuery: public QSqlQuery {
+public:
+    /** number of buckets in Statistics::histogram */
+    static const int HISTOGRAM_SIZE = 6;
+
+    /**
+     * maximum number of different statements in the statistics. Further
+     * statements are recorded under OTHER_STATEMENTS.
+     */
+    static const int MAX_STATEMENTS = 500;
+
+    /** maximum number of entries in the list of slow executions */
+    static const int MAX_SLOW_EXECUTIONS = 20;
+
+    /** key for the statements above MAX_STATEMENTS */
+    static const char* const OTHER_STATEMENTS;
+
+    /**
+     * @brief statistics for one SQL statement
+     */
+    struct Statistics {
+        /** number of executions */
+        int executions;
+
+        /** number of executions that failed */
+        int errors;
+
+        /** number of executions that were slower than the threshold */
+        int slow;
+
+        /** sum of the execution times in microseconds */
+        qint64 totalMicros;
+
+        /** longest execution time in microseconds */
+        qint64 maxMicros;
+
+        /** number of rows returned by next() */
+        qint64 rows;
+
+        /**
+         * number of executions that took less than 0.1 ms, 1 ms, 10 ms,
+         * 100 ms, 1 s and more
+         */
+        int histogram[HISTOGRAM_SIZE];
+
+        /**
+         * result of EXPLAIN QUERY PLAN for the first execution slower than
+         * the threshold or ""
+         */
+        QString plan;
+
+        Statistics();
+    };
+private:
+    static QMutex statisticsMutex;
+    static QAtomicInt statisticsEnabled;
+    static QAtomicInt slowQueryThreshold;
+    static QHash<QString, Statistics> statistics;
+
+    /** the last slow executions as text, the newest first */
+    static QList<QString> slowExecutions;
+
+    QSqlDatabase db;
+
+    /** true if an execution is not yet recorded */
+    bool measuring;
+
+    /** result of the last exec() */
+    bool ok;
+
+    /** SQL for the current execution */
+    QString sql;
+
+    /** key in the statistics for the current execution */
+    QString key;
+
+    /** number of rows returned by next() for the current execution */
+    qint64 rows;
+
+    /** time spent in exec() and next() for the current execution */
+    qint64 nanos;
+
+    /**
+     * @brief records the current execution in the statistics
+     */
+    void record();
+
+    /**
+     * @brief computes the query plan for the current SQL
+     * @return plan details separated by new lines
+     */
+    QString explain() const;
 public:
     explicit MySQLQuery(QSqlDatabase db);
+    ~MySQLQuery();
     bool exec(const QString& query);
     bool exec();
     bool next();
     bool prepare(const QString &query);
+    void finish();
+
+    /**
+     * @brief enables or disables the collection of statistics. This does not
+     *     change the already collected data.
+     * @param enabled true = collect statistics
+     */
+    static void setStatisticsEnabled(bool enabled);
+
+    /**
+     * @return true if the statistics are collected
+     */
+    static bool isStatisticsEnabled();
+
+    /**
+     * @brief the last executions slower than the threshold are listed by
+     *     dumpStatistics() and the query plan is computed for the first of
+     *     them
+     * @param ms threshold in milliseconds. 0 = no slow query log.
+     */
+    static void setSlowQueryThreshold(int ms);
+
+    /**
+     * @return collected statistics: SQL -> data
+     */
+    static QHash<QString, Statistics> getStatistics();
+
+    /**
+     * @brief deletes the collected statistics and the list of slow
+     *     executions
+     */
+    static void resetStatistics();
+
+    /**
+     * @brief formats the collected statistics as text. The statements are
+     *     sorted by the total execution time. The last slow executions are
+     *     listed at the end.
+     * @return multi-line text
+     */
+    static QString dumpStatistics();
 };
 
 
@@ -0,0 +1,172 @@
+#include <windows.h>
+
+#include <QObject>
+#include <QFile>
+#include <QFuture>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "operationexecutor.h"
+
+OperationExecutor::OperationExecutor(const QList<InstallOperation*>& ops,
+        const QList<PackageVersion*>& pvs)
+{
+    this->ops = ops;
+    this->pvs = pvs;
+    this->maxParallel = DEFAULT_MAX_PARALLEL;
+    this->prefetcher = 0;
+
+    int n = ops.count();
+    successors.resize(n);
+    predecessors.fill(0, n);
+
+    // only the direct relations are stored. Indirect dependencies are
+    // respected because an operation only starts after all its
+    // predecessors.
+    for (int j = 1; j < n; j++) {
+        InstallOperation* b = ops.at(j);
+        for (int i = 0; i < j; i++) {
+            InstallOperation* a = ops.at(i);
+            if (a->package == b->package ||
+                    dependsOn(pvs.at(j), a->package) ||
+                    dependsOn(pvs.at(i), b->package)) {
+                successors[i].append(j);
+                predecessors[j]++;
+            }
+        }
+    }
+}
+
+OperationExecutor::~OperationExecutor()
+{
+}
+
+bool OperationExecutor::dependsOn(PackageVersion* a, const QString& package)
+{
+    for (int i = 0; i < a->dependencies.count(); i++) {
+        if (a->dependencies.at(i)->package == package)
+            return true;
+    }
+    return false;
+}
+
+void OperationExecutor::setMaxParallel(int maxParallel)
+{
+    this->maxParallel = maxParallel;
+}
+
+int OperationExecutor::getMaxParallel() const
+{
+    return maxParallel;
+}
+
+void OperationExecutor::setPrefetcher(DownloadPrefetcher* prefetcher)
+{
+    this->prefetcher = prefetcher;
+}
+
+QList<int> OperationExecutor::getDependencies(int index) const
+{
+    QList<int> r;
+    for (int i = 0; i < index; i++) {
+        if (successors.at(i).contains(index))
+            r.append(i);
+    }
+    return r;
+}
+
+void OperationExecutor::processOperation(Job* job, InstallOperation* op,
+        PackageVersion* pv)
+{
+    if (op->install) {
+        QString prefetchedFile;
+        if (prefetcher)
+            prefetchedFile = prefetcher->take(pv, job);
+
+        pv->install(job, pv->getPreferredInstallationDirectory(),
+                prefetchedFile);
+
+        // the file is normally moved by install()
+        if (!prefetchedFile.isEmpty())
+            QFile::remove(prefetchedFile);
+    } else {
+        pv->uninstall(job);
+    }
+}
+
+void OperationExecutor::run(Job* job, int index)
+{
+    CoInitialize(NULL);
+    processOperation(job, ops.at(index), pvs.at(index));
+    CoUninitialize();
+
+    mutex.lock();
+    finished.append(index);
+    finishedCondition.wakeAll();
+    mutex.unlock();
+}
+
+void OperationExecutor::execute(Job* job, double part)
+{
+    int n = ops.count();
+    double start = job->getProgress();
+
+    QVector<int> waiting = predecessors;
+    QVector<Job*> subs(n, 0);
+    QList<QFuture<void> > futures;
+    int running = 0;
+
+    while (true) {
+        // the jobs are only created in this thread
+        for (int i = 0; i < n && running < maxParallel &&
+                job->shouldProceed(); i++) {
+            if (subs.at(i) == 0 && waiting.at(i) == 0) {
+                InstallOperation* op = ops.at(i);
+                PackageVersion* pv = pvs.at(i);
+                QString txt;
+                if (op->install)
+                    txt = QString(QObject::tr("Installing %1")).arg(
+                            pv->toString());
+                else
+                    txt = QString(QObject::tr("Uninstalling %1")).arg(
+                            pv->toString());
+
+                subs[i] = job->newSubJob(part / n, txt, false, true);
+                futures.append(QtConcurrent::run(this, &OperationExecutor::run,
+                        subs.at(i), i));
+                running++;
+            }
+        }
+
+        if (running == 0)
+            break;
+
+        int index = -1;
+        mutex.lock();
+        if (finished.isEmpty())
+            finishedCondition.wait(&mutex, 200);
+        if (!finished.isEmpty())
+            index = finished.takeFirst();
+        mutex.unlock();
+
+        if (index >= 0) {
+            running--;
+            const QVector<int>& s = successors.at(index);
+            for (int i = 0; i < s.count(); i++) {
+                waiting[s.at(i)]--;
+            }
+        }
+
+        // the sub-jobs do not update the progress of the parent job as they
+        // run concurrently
+        double progress = 0;
+        for (int i = 0; i < n; i++) {
+            if (subs.at(i))
+                progress += subs.at(i)->getProgress();
+        }
+        job->setProgress(start + progress * part / n);
+    }
+
+    for (int i = 0; i < futures.count(); i++) {
+        futures[i].waitForFinished();
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef OPERATIONEXECUTOR_H
+#define OPERATIONEXECUTOR_H
+
+#include <QList>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "installoperation.h"
+#include "packageversion.h"
+#include "job.h"
+#include "downloadprefetcher.h"
+
+/**
+ * @brief executes installation operations in parallel.
+ *
+ * The operations are ordered as a directed acyclic graph. An operation
+ * depends on an earlier one in the list if both change the same package or
+ * if one of the package versions depends on the package changed by the
+ * other. Operations without a path between them are executed concurrently
+ * by at most getMaxParallel() worker threads. The number of parallel
+ * downloads and installation scripts is additionally limited inside
+ * PackageVersion::install() and PackageVersion::uninstall().
+ */
+class OperationExecutor
+{
+    QList<InstallOperation*> ops;
+    QList<PackageVersion*> pvs;
+
+    int maxParallel;
+
+    DownloadPrefetcher* prefetcher;
+
+    /** operation -> later operations that depend on it */
+    QVector<QVector<int> > successors;
+
+    /** operation -> number of earlier operations it depends on */
+    QVector<int> predecessors;
+
+    /** protects "finished" */
+    QMutex mutex;
+
+    /** signalled if an operation was finished */
+    QWaitCondition finishedCondition;
+
+    /** indexes of finished operations */
+    QList<int> finished;
+
+    /**
+     * @param a a package version
+     * @param package full package name
+     * @return true if "a" depends on the package
+     */
+    static bool dependsOn(PackageVersion* a, const QString& package);
+
+    /**
+     * @brief runs in a worker thread
+     * @param job job for the operation
+     * @param index index of the operation
+     */
+    void run(Job* job, int index);
+protected:
+    /**
+     * @brief installs or uninstalls one package version. This method is
+     *     called from worker threads.
+     * @param job job for the operation
+     * @param op the operation
+     * @param pv the corresponding package version
+     */
+    virtual void processOperation(Job* job, InstallOperation* op,
+            PackageVersion* pv);
+public:
+    /** default maximum number of operations executed at the same time */
+    static const int DEFAULT_MAX_PARALLEL = 3;
+
+    /**
+     * @param ops [ownership:caller] operations in the order they could be
+     *     executed sequentially
+     * @param pvs [ownership:caller] package versions for the operations.
+     *     The dependencies must be available.
+     */
+    OperationExecutor(const QList<InstallOperation*>& ops,
+            const QList<PackageVersion*>& pvs);
+
+    virtual ~OperationExecutor();
+
+    /**
+     * @param maxParallel maximum number of operations executed at the same
+     *     time. 1 means sequential execution.
+     */
+    void setMaxParallel(int maxParallel);
+
+    /**
+     * @return maximum number of operations executed at the same time
+     */
+    int getMaxParallel() const;
+
+    /**
+     * @param prefetcher [ownership:caller] the binaries for the
+     *     installations will be taken from here or 0
+     */
+    void setPrefetcher(DownloadPrefetcher* prefetcher);
+
+    /**
+     * @param index index of an operation
+     * @return indexes of the operations that must be finished before this
+     *     one can start
+     */
+    QList<int> getDependencies(int index) const;
+
+    /**
+     * @brief executes all operations. A sub-job is created for every
+     *     operation. No new operations are started after an error or if the
+     *     job was cancelled, but the running ones are finished.
+     * @param job job. The job is not completed by this method.
+     * @param part part of the job's progress used by the operations
+     */
+    void execute(Job* job, double part);
+};
+
+#endif // OPERATIONEXECUTOR_H
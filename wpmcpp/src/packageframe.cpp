@@ -197,7 +197,7 @@ void PackageFrame::fillForm(Package* p)
 
     QString err;
     qDeleteAll(this->pvs);
-    pvs = dbr->getPackageVersions_(p->name, &err);
+    pvs = dbr->getPackageVersionHeaders_(p->name, &err);
 
     if (!err.isEmpty()) {
         MainWindow::getInstance()->addErrorMessage(err,
@@ -39,7 +39,8 @@ PackageItemModel::Info* PackageItemModel::createInfo(
 
     // error is ignored here
     QString err;
-    QList<PackageVersion*> pvs = rep->getPackageVersions_(p->name, &err);
+    QList<PackageVersion*> pvs = rep->getPackageVersionHeaders_(p->name,
+            &err);
 
     PackageVersion* newestInstallable = 0;
     PackageVersion* newestInstalled = 0;
@@ -23,6 +23,7 @@
 #include <QtConcurrent/QtConcurrentRun>
 #include <QFuture>
 #include <QFutureWatcher>
+#include <QDataStream>
 #include <zlib.h>
 
 //#include "msoav2.h"
@@ -41,6 +42,9 @@
 #include "installedpackages.h"
 #include "installedpackageversion.h"
 #include "dbrepository.h"
+#include "reversedependencies.h"
+#include "dependencysolver.h"
+#include "abstractrepository.h"
 
 QSemaphore PackageVersion::httpConnections(3);
 QSemaphore PackageVersion::installationScripts(1);
@@ -245,6 +249,7 @@ PackageVersion::PackageVersion(const QString& package)
     this->package = package;
     this->type = 0;
     this->hashSumType = QCryptographicHash::Sha1;
+    this->lazyOffset = 0;
 }
 
 PackageVersion::PackageVersion(const QString &package, const Version &version)
@@ -253,6 +258,7 @@ PackageVersion::PackageVersion(const QString &package, const Version &version)
     this->version = version;
     this->type = 0;
     this->hashSumType = QCryptographicHash::Sha1;
+    this->lazyOffset = 0;
 }
 
 PackageVersion::PackageVersion()
@@ -260,6 +266,7 @@ PackageVersion::PackageVersion()
     this->package = "unknown";
     this->type = 0;
     this->hashSumType = QCryptographicHash::Sha1;
+    this->lazyOffset = 0;
 }
 
 void PackageVersion::emitStatusChanged()
@@ -325,6 +332,8 @@ void PackageVersion::fillFrom(PackageVersion *pv)
     this->hashSumType = pv->hashSumType;
     this->download = pv->download;
     this->msiGUID = pv->msiGUID;
+    this->lazyData = pv->lazyData;
+    this->lazyOffset = pv->lazyOffset;
 
     qDeleteAll(this->files);
     this->files.clear();
@@ -671,144 +680,44 @@ void PackageVersion::removeDirectory(Job* job, const QString& dir)
 QString PackageVersion::planInstallation(QList<PackageVersion*>& installed,
         QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid)
 {
-    QString res;
-
-    avoid.append(this->clone());
-
-    for (int i = 0; i < this->dependencies.count(); i++) {
-        Dependency* d = this->dependencies.at(i);
-        bool depok = false;
-        for (int j = 0; j < installed.size(); j++) {
-            PackageVersion* pv = installed.at(j);
-            if ((pv->package != this->package || pv->version != this->version) &&
-                    pv->package == d->package &&
-                    d->test(pv->version)) {
-                depok = true;
-                break;
-            }
-        }
-        if (!depok) {
-            // we cannot just use Dependency->findBestMatchToInstall here as
-            // it is possible that the highest match cannot be installed because
-            // of unsatisfied dependencies. Example: the newest version depends
-            // on Windows Vista, but the current operating system is XP.
-
-            /* old code:
-            QString err;
-            QScopedPointer<PackageVersion> pv(d->findBestMatchToInstall(avoid,
-                    &err));
-            if (!err.isEmpty()) {
-                res = QString(QObject::tr("Error searching for the best dependency match: %1")).
-                           arg(err);
-                break;
-            }
-
-            if (!pv) {
-                res = QString(QObject::tr("Unsatisfied dependency: %1")).
-                           arg(d->toString());
-                break;
-            } else {
-                res = pv->planInstallation(installed, ops, avoid);
-                if (!res.isEmpty())
-                    break;
-            }
-            */
-
-            QString err;
-            QList<PackageVersion*> pvs = d->findAllMatchesToInstall(avoid, &err);
-            if (!err.isEmpty()) {
-                res = QString(QObject::tr("Error searching for the dependency matches: %1")).
-                           arg(err);
-                qDeleteAll(pvs);
-                break;
-            }
-            if (pvs.count() == 0) {
-                res = QString(QObject::tr("Unsatisfied dependency: %1")).
-                           arg(d->toString());
-                break;
-            } else {
-                bool found = false;
-                for (int j = 0; j < pvs.count(); j++) {
-                    PackageVersion* pv = pvs.at(j);
-                    int installedCount = installed.count();
-                    int opsCount = ops.count();
-                    int avoidCount = avoid.count();
-
-                    res = pv->planInstallation(installed, ops, avoid);
-                    if (!res.isEmpty()) {
-                        // rollback
-                        while (installed.count() > installedCount) {
-                            delete installed.takeLast();
-                        }
-                        while (ops.count() > opsCount) {
-                            delete ops.takeLast();
-                        }
-                        while (avoid.count() > avoidCount) {
-                            delete avoid.takeLast();
-                        }
-                    } else {
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    res = QString(QObject::tr("Unsatisfied dependency: %1")).
-                               arg(d->toString());
-                }
-            }
-            qDeleteAll(pvs);
-        }
-    }
+    DependencySolver solver(AbstractRepository::getDefault_());
+    QList<PackageVersion*> goals;
+    goals.append(this);
+    return solver.planInstallation(goals, installed, ops, avoid);
+}
 
-    if (res.isEmpty()) {
-        InstallOperation* io = new InstallOperation();
-        io->install = true;
-        io->package = this->package;
-        io->version = this->version;
-        ops.append(io);
-        installed.append(this->clone());
-    }
+QString PackageVersion::planUninstallation(QList<PackageVersion*>& installed,
+        QList<InstallOperation*>& ops)
+{
+    // the reverse dependencies are computed only once for the whole plan
+    ReverseDependencies rd(installed);
 
-    return res;
+    return planUninstallation(installed, ops, &rd);
 }
 
 QString PackageVersion::planUninstallation(QList<PackageVersion*>& installed,
-        QList<InstallOperation*>& ops)
+        QList<InstallOperation*>& ops, ReverseDependencies* rd)
 {
     // qDebug() << "PackageVersion::planUninstallation()" << this->toString();
     QString res;
 
-    if (!PackageVersion::contains(installed, this))
+    PackageVersion* self = rd->find(this->package, this->version);
+    if (!self)
         return res;
 
-    // this loop ensures that all the items in "installed" are processed
-    // even if changes in the list were done in nested calls to
-    // "planUninstallation"
+    // removing a dependent may reduce the number of matches for the
+    // dependencies of another one. This loop ends if nothing was removed.
     while (true) {
         int oldCount = installed.count();
-        for (int i = 0; i < installed.count(); i++) {
-            PackageVersion* pv = installed.at(i);
-            if (pv->package != this->package || pv->version != this->version) {
-                for (int j = 0; j < pv->dependencies.count(); j++) {
-                    Dependency* d = pv->dependencies.at(j);
-                    if (d->package == this->package && d->test(this->version)) {
-                        int n = 0;
-                        for (int k = 0; k < installed.count(); k++) {
-                            PackageVersion* pv2 = installed.at(k);
-                            if (d->package == pv2->package &&
-                                    d->test(pv2->version)) {
-                                n++;
-                            }
-                            if (n > 1)
-                                break;
-                        }
-                        if (n <= 1) {
-                            res = pv->planUninstallation(installed, ops);
-                            if (!res.isEmpty())
-                                break;
-                        }
-                    }
-                }
+        QList<ReverseDependencies::Dependent> ds = rd->findDependents(
+                this->package, this->version);
+        for (int i = 0; i < ds.count(); i++) {
+            const ReverseDependencies::Dependent& d = ds.at(i);
+            PackageVersion* pv = d.pv;
+            if ((pv->package != this->package ||
+                    pv->version != this->version) && rd->contains(pv) &&
+                    rd->countMatches(d.dependency) <= 1) {
+                res = pv->planUninstallation(installed, ops, rd);
                 if (!res.isEmpty())
                     break;
             }
@@ -824,6 +733,7 @@ QString PackageVersion::planUninstallation(QList<PackageVersion*>& installed,
         op->package = this->package;
         op->version = this->version;
         ops.append(op);
+        rd->remove(self);
         installed.removeAt(PackageVersion::indexOf(installed, this));
     }
 
@@ -984,7 +894,8 @@ QString PackageVersion::getPreferredInstallationDirectory()
                 this->version.getVersionString(), "");
 }
 
-void PackageVersion::install(Job* job, const QString& where)
+void PackageVersion::install(Job* job, const QString& where,
+        const QString& prefetchedFile)
 {
     if (installed()) {
         job->setProgress(1);
@@ -1030,9 +941,23 @@ void PackageVersion::install(Job* job, const QString& where)
     }
     job->setTitle(initialTitle);
 
+    // qDebug() << "install.3";
+    QFile* f = new QFile(npackdDir + "\\__NpackdPackageDownload");
+
+    // the hash sum of a prefetched file was already verified
+    bool prefetched = false;
+    if (!prefetchedFile.isEmpty() && !job->isCancelled() &&
+            job->getErrorMessage().isEmpty()) {
+        QFile::remove(f->fileName());
+        prefetched = QFile::rename(prefetchedFile, f->fileName());
+        if (prefetched)
+            job->setProgress(0.64);
+    }
+
     bool httpConnectionAcquired = false;
 
-    if (!job->isCancelled() && job->getErrorMessage().isEmpty()) {
+    if (!prefetched && !job->isCancelled() &&
+            job->getErrorMessage().isEmpty()) {
         job->setTitle(initialTitle + " / " +
                 QObject::tr("Waiting for a free HTTP connection"));
 
@@ -1052,53 +977,42 @@ void PackageVersion::install(Job* job, const QString& where)
     }
     job->setTitle(initialTitle);
 
-    // qDebug() << "install.3";
-    QFile* f = new QFile(npackdDir + "\\__NpackdPackageDownload");
-
     bool downloadOK = false;
     QString dsha1;
 
-    if (!job->isCancelled() && job->getErrorMessage().isEmpty()) {
-        if (!f->open(QIODevice::ReadWrite)) {
-            job->setErrorMessage(QString(QObject::tr("Cannot open the file: %0")).
-                    arg(f->fileName()));
-        } else {
-            Job* djob = job->newSubJob(0.58,
-                    QObject::tr("Downloading & computing hash sum"));
-            Downloader::download(djob, this->download, f,
-                    this->sha1.isEmpty() ? 0 : &dsha1, this->hashSumType);
-            downloadOK = !djob->isCancelled() &&
-                    djob->getErrorMessage().isEmpty();
-            f->close();
-        }
+    // an interrupted transfer is resumed from the last received byte
+    if (!prefetched && !job->isCancelled() &&
+            job->getErrorMessage().isEmpty()) {
+        Job* djob = job->newSubJob(0.58,
+                QObject::tr("Downloading & computing hash sum"));
+        Downloader::downloadResumable(djob, this->download, f->fileName(),
+                this->sha1.isEmpty() ? 0 : &dsha1, this->hashSumType);
+        downloadOK = !djob->isCancelled() &&
+                djob->getErrorMessage().isEmpty();
     }
 
     if (httpConnectionAcquired)
         httpConnections.release();
 
-    if (!job->isCancelled() && job->getErrorMessage().isEmpty()) {
+    if (!prefetched && !job->isCancelled() &&
+            job->getErrorMessage().isEmpty()) {
         if (!downloadOK) {
-            if (!f->open(QIODevice::ReadWrite)) {
-                job->setErrorMessage(QObject::tr("Cannot open the file: %0").
-                        arg(f->fileName()));
-            } else {
-                double rest = 0.63 - job->getProgress();
-                Job* djob = job->newSubJob(rest,
-                        QObject::tr("Downloading & computing hash sum (2nd try)"));
-                Downloader::download(djob, this->download, f,
-                        this->sha1.isEmpty() ? 0 : &dsha1, this->hashSumType);
-                if (!djob->getErrorMessage().isEmpty())
-                    job->setErrorMessage(QObject::tr("Error downloading %1: %2").
-                        arg(this->download.toString()).arg(
-                        djob->getErrorMessage()));
-                f->close();
-            }
+            double rest = 0.63 - job->getProgress();
+            Job* djob = job->newSubJob(rest,
+                    QObject::tr("Downloading & computing hash sum (2nd try)"));
+            Downloader::downloadResumable(djob, this->download, f->fileName(),
+                    this->sha1.isEmpty() ? 0 : &dsha1, this->hashSumType);
+            if (!djob->getErrorMessage().isEmpty())
+                job->setErrorMessage(QObject::tr("Error downloading %1: %2").
+                    arg(this->download.toString()).arg(
+                    djob->getErrorMessage()));
         } else {
             job->setProgress(0.63);
         }
     }
 
-    if (!job->isCancelled() && job->getErrorMessage().isEmpty()) {
+    if (!prefetched && !job->isCancelled() &&
+            job->getErrorMessage().isEmpty()) {
         if (!this->sha1.isEmpty()) {
             if (dsha1.toLower() != this->sha1.toLower()) {
                 job->setErrorMessage(QString(
@@ -1676,10 +1590,35 @@ PackageVersion* PackageVersion::clone() const
     r->hashSumType = this->hashSumType;
     r->download = this->download;
     r->msiGUID = this->msiGUID;
+    r->lazyData = this->lazyData;
+    r->lazyOffset = this->lazyOffset;
 
     return r;
 }
 
+bool PackageVersion::isMaterialized() const
+{
+    return this->lazyData.isEmpty();
+}
+
+QString PackageVersion::materialize()
+{
+    QString err;
+    if (!this->lazyData.isEmpty()) {
+        QDataStream in(this->lazyData);
+        in.setVersion(QDataStream::Qt_5_2);
+        if (in.skipRawData(this->lazyOffset) != this->lazyOffset)
+            err = QObject::tr("Unexpected end of binary package version data");
+        else
+            err = readBinaryLists(&in);
+
+        // the object is usable even if the data was broken
+        this->lazyData = QByteArray();
+        this->lazyOffset = 0;
+    }
+    return err;
+}
+
 PackageVersionFile* PackageVersion::createPackageVersionFile(QDomElement* e,
         QString* err)
 {
@@ -2107,6 +2046,183 @@ void PackageVersion::toXML(QXmlStreamWriter *w) const
     w->writeEndElement();
 }
 
+/** signature of the binary format: "NPVB" */
+static const quint32 BINARY_SIGNATURE = 0x4E505642;
+
+/** current version of the binary format */
+static const quint8 BINARY_FORMAT = 1;
+
+QByteArray PackageVersion::toBinary() const
+{
+    QByteArray r;
+    r.reserve(512);
+
+    QDataStream out(&r, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_2);
+
+    out << BINARY_SIGNATURE << BINARY_FORMAT;
+
+    out << this->package;
+    this->version.toBinary(&out);
+    out << (qint8) this->type;
+    out << this->sha1;
+    out << (qint8) (this->hashSumType == QCryptographicHash::Sha1 ? 0 : 1);
+    if (this->download.isValid())
+        out << this->download.toString();
+    else
+        out << QString();
+    out << this->msiGUID;
+    out << this->importantFiles << this->importantFilesTitles;
+
+    // the part that was not decoded is copied without changes
+    if (!this->lazyData.isEmpty()) {
+        out.writeRawData(this->lazyData.constData() + this->lazyOffset,
+                this->lazyData.size() - this->lazyOffset);
+        return r;
+    }
+
+    out << (qint32) this->files.count();
+    for (int i = 0; i < this->files.count(); i++) {
+        PackageVersionFile* f = this->files.at(i);
+        out << f->path << f->content;
+    }
+
+    out << (qint32) this->detectFiles.count();
+    for (int i = 0; i < this->detectFiles.count(); i++) {
+        DetectFile* df = this->detectFiles.at(i);
+        out << df->path << df->sha1;
+    }
+
+    out << (qint32) this->dependencies.count();
+    for (int i = 0; i < this->dependencies.count(); i++) {
+        Dependency* d = this->dependencies.at(i);
+        out << d->package << d->minIncluded;
+        d->min.toBinary(&out);
+        out << d->maxIncluded;
+        d->max.toBinary(&out);
+        out << d->var;
+    }
+
+    return r;
+}
+
+bool PackageVersion::isBinary(const QByteArray &data)
+{
+    if (data.size() < 5)
+        return false;
+
+    const uchar* p = (const uchar*) data.constData();
+    quint32 signature = (((quint32) p[0]) << 24) | (((quint32) p[1]) << 16) |
+            (((quint32) p[2]) << 8) | ((quint32) p[3]);
+    return signature == BINARY_SIGNATURE;
+}
+
+PackageVersion* PackageVersion::fromBinary(const QByteArray &data,
+        QString *err, bool headerOnly)
+{
+    *err = "";
+
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_2);
+
+    quint32 signature = 0;
+    quint8 format = 0;
+    in >> signature >> format;
+    if (signature != BINARY_SIGNATURE)
+        *err = QObject::tr("Invalid signature of binary package version data");
+    else if (format != BINARY_FORMAT)
+        *err = QString(QObject::tr(
+                "Unsupported format of binary package version data: %1")).
+                arg(format);
+
+    PackageVersion* a = 0;
+    if (err->isEmpty()) {
+        QString package;
+        in >> package;
+        a = new PackageVersion(package);
+        if (!a->version.fromBinary(&in))
+            *err = QObject::tr("Invalid version number in binary package version data");
+    }
+
+    if (err->isEmpty()) {
+        qint8 type, hashSumType;
+        QString url;
+        in >> type >> a->sha1 >> hashSumType >> url >> a->msiGUID;
+        a->type = type;
+        a->hashSumType = hashSumType == 0 ? QCryptographicHash::Sha1 :
+                QCryptographicHash::Sha256;
+        if (!url.isEmpty())
+            a->download.setUrl(url);
+        in >> a->importantFiles >> a->importantFilesTitles;
+    }
+
+    if (err->isEmpty()) {
+        if (in.status() != QDataStream::Ok)
+            *err = QObject::tr("Unexpected end of binary package version data");
+    }
+
+    if (err->isEmpty()) {
+        // the data is shared and not copied
+        if (headerOnly) {
+            a->lazyData = data;
+            a->lazyOffset = (int) in.device()->pos();
+        } else {
+            *err = a->readBinaryLists(&in);
+        }
+    }
+
+    if (err->isEmpty())
+        return a;
+    else {
+        delete a;
+        return 0;
+    }
+}
+
+QString PackageVersion::readBinaryLists(QDataStream* in)
+{
+    qint32 n = 0;
+    *in >> n;
+    for (int i = 0; i < n && in->status() == QDataStream::Ok; i++) {
+        QString path, content;
+        *in >> path >> content;
+        this->files.append(new PackageVersionFile(path, content));
+    }
+
+    n = 0;
+    *in >> n;
+    for (int i = 0; i < n && in->status() == QDataStream::Ok; i++) {
+        DetectFile* df = new DetectFile();
+        *in >> df->path >> df->sha1;
+        this->detectFiles.append(df);
+    }
+
+    n = 0;
+    *in >> n;
+    for (int i = 0; i < n && in->status() == QDataStream::Ok; i++) {
+        Dependency* d = new Dependency();
+        this->dependencies.append(d);
+        *in >> d->package >> d->minIncluded;
+        bool ok = d->min.fromBinary(in);
+        if (ok) {
+            *in >> d->maxIncluded;
+            ok = d->max.fromBinary(in);
+        }
+        if (!ok) {
+            in->setStatus(QDataStream::ReadCorruptData);
+            break;
+        }
+        *in >> d->var;
+    }
+
+    QString err;
+    if (in->status() == QDataStream::ReadCorruptData)
+        err = QObject::tr("Invalid dependency version in binary package version data");
+    else if (in->status() != QDataStream::Ok)
+        err = QObject::tr("Unexpected end of binary package version data");
+    return err;
+}
+
 QString PackageVersion::serialize() const
 {
     QDomDocument doc;
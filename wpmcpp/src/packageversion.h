@@ -24,6 +24,7 @@
 DEFINE_GUID(UUID_ClientID,0x30ed381dL,0x59ea,0x4ca5,0xbd,0x1d,0x5e,0xe8,0xec,0x97,0xb2,0xbe);
 
 class InstallOperation;
+class ReverseDependencies;
 
 /**
  * One version of a package (installed or not).
@@ -31,6 +32,9 @@ class InstallOperation;
 class PackageVersion
 {
 private:    
+    /** DownloadPrefetcher uses httpConnections */
+    friend class DownloadPrefetcher;
+
     static QSemaphore httpConnections;
     static QSemaphore installationScripts;
 
@@ -105,6 +109,35 @@ private:
 
     QString addBasicVars(QStringList *env);
     void addDependencyVars(QStringList* vars);
+
+    /**
+     * @brief data created by toBinary() if the files, detection information
+     *     and dependencies were not yet decoded or an empty array
+     */
+    QByteArray lazyData;
+
+    /** position of the not yet decoded part in lazyData */
+    int lazyOffset;
+
+    /**
+     * @brief plans un-installation of this package and all the dependent
+     *     recursively
+     * @param installed see planUninstallation(installed, ops)
+     * @param ops see planUninstallation(installed, ops)
+     * @param rd index of the reverse dependencies in "installed". It is
+     *     updated together with "installed".
+     * @return error message or ""
+     */
+    QString planUninstallation(QList<PackageVersion*>& installed,
+            QList<InstallOperation*>& ops, ReverseDependencies* rd);
+
+    /**
+     * @brief reads the files, detection information and dependencies
+     *     stored by toBinary()
+     * @param in input stream
+     * @return error message
+     */
+    QString readBinaryLists(QDataStream* in);
 public:
     /**
      * @param job job to monitor the progress. The error message will be set
@@ -152,6 +185,28 @@ public:
     static PackageVersion* parse(QDomElement* e, QString* err,
             bool validate=true);
 
+    /**
+     * @brief creates a package version from the binary data created by
+     *     toBinary(). No validation is performed as the data was already
+     *     validated before it was stored.
+     * @param data binary data
+     * @param err error message will be stored here
+     * @param headerOnly true = only decode the fields stored directly in this
+     *     object (package, version, download URL, hash sum etc.). The files,
+     *     detection information and dependencies are decoded by
+     *     materialize().
+     * @return [ownership:caller] created object or 0
+     */
+    static PackageVersion* fromBinary(const QByteArray& data, QString* err,
+            bool headerOnly=false);
+
+    /**
+     * @param data some data
+     * @return true if the data was created by toBinary() and not, for
+     *     example, by toXML()
+     */
+    static bool isBinary(const QByteArray& data);
+
     /**
      * @brief searches for a package version only using the package name and
      *     version number
@@ -298,6 +353,7 @@ public:
 
     /**
      * Plans installation of this package and all the dependencies recursively.
+     * The dependencies are resolved by DependencySolver.
      *
      * @param installed [ownership:caller] list of installed packages.
      *     This list should be
@@ -307,9 +363,8 @@ public:
      *     The existing
      *     elements will not be modified in any way.
      * @param avoid [ownership:caller] list of package versions that cannot be
-     *     installed. The list
-     *     will be changed by this method. Normally this is an empty list and
-     *     objects will be added to it on different recursion levels.
+     *     installed. The list is not changed by this method. Normally this is
+     *     an empty list.
      * @return error message or ""
      */
     QString planInstallation(QList<PackageVersion*>& installed,
@@ -362,8 +417,12 @@ public:
      *
      * @param job job for this method
      * @param where a non-existing directory
+     * @param prefetchedFile path to an already downloaded binary with the
+     *     correct hash sum (see DownloadPrefetcher) or "". The file will be
+     *     moved.
      */
-    void install(Job* job, const QString& where);
+    void install(Job* job, const QString& where,
+            const QString& prefetchedFile=QString());
 
     /**
      * Uninstalls this package version.
@@ -396,11 +455,34 @@ public:
      */
     void toXML(QXmlStreamWriter* w) const;
 
+    /**
+     * @brief stores this object in a compact binary form that can be read
+     *     much faster than XML. The data starts with a signature and a
+     *     format version.
+     * @return binary data
+     */
+    QByteArray toBinary() const;
+
     /**
      * @return a copy
      */
     PackageVersion* clone() const;
 
+    /**
+     * @return false if this object was created by fromBinary() with
+     *     headerOnly=true and files, detectFiles and dependencies are not yet
+     *     available
+     */
+    bool isMaterialized() const;
+
+    /**
+     * @brief decodes files, detectFiles and dependencies if this object was
+     *     created by fromBinary() with headerOnly=true. Does nothing
+     *     otherwise.
+     * @return error message
+     */
+    QString materialize();
+
     /**
      * @return true if this package is in c:\Windows or one of the nested
      *     directories
@@ -0,0 +1,141 @@
+#include "pipebuffer.h"
+
+#include <QObject>
+#include <QMutexLocker>
+
+PipeBuffer::PipeBuffer(qint64 capacity, QCryptographicHash::Algorithm alg) :
+        hash(alg)
+{
+    this->offset = 0;
+    this->size = 0;
+    this->capacity = capacity;
+    this->writeClosed = false;
+    this->aborted = false;
+
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+bool PipeBuffer::isSequential() const
+{
+    return true;
+}
+
+qint64 PipeBuffer::bytesAvailable() const
+{
+    QMutexLocker locker(&mutex);
+    return size + QIODevice::bytesAvailable();
+}
+
+bool PipeBuffer::atEnd() const
+{
+    QMutexLocker locker(&mutex);
+    return writeClosed && size == 0 && QIODevice::bytesAvailable() == 0;
+}
+
+void PipeBuffer::closeWrite(const QString& err)
+{
+    QMutexLocker locker(&mutex);
+    if (!writeClosed) {
+        writeClosed = true;
+        writeError = err;
+        if (err.isEmpty() && !aborted)
+            hashSum = hash.result().toHex().toLower();
+        notEmpty.wakeAll();
+    }
+}
+
+void PipeBuffer::abort()
+{
+    QMutexLocker locker(&mutex);
+    aborted = true;
+    chunks.clear();
+    offset = 0;
+    size = 0;
+    notFull.wakeAll();
+}
+
+QByteArray PipeBuffer::lookAhead(int n)
+{
+    QMutexLocker locker(&mutex);
+    while (size < n && !writeClosed && !aborted)
+        notEmpty.wait(&mutex);
+
+    QByteArray r;
+    for (int i = 0; i < chunks.count() && r.size() < n; i++) {
+        const QByteArray& c = chunks.at(i);
+        int from = i == 0 ? offset : 0;
+        r.append(c.constData() + from, qMin(n - r.size(), c.size() - from));
+    }
+    return r;
+}
+
+void PipeBuffer::waitForWriter()
+{
+    while (!writeClosed)
+        notEmpty.wait(&mutex);
+}
+
+QString PipeBuffer::getWriteError()
+{
+    QMutexLocker locker(&mutex);
+    waitForWriter();
+    return writeError;
+}
+
+QString PipeBuffer::getHashSum()
+{
+    QMutexLocker locker(&mutex);
+    waitForWriter();
+    return hashSum;
+}
+
+qint64 PipeBuffer::readData(char* data, qint64 maxSize)
+{
+    QMutexLocker locker(&mutex);
+    while (size == 0 && !writeClosed && !aborted)
+        notEmpty.wait(&mutex);
+
+    qint64 r = 0;
+    while (r < maxSize && !chunks.isEmpty()) {
+        const QByteArray& c = chunks.head();
+        int n = (int) qMin(maxSize - r, (qint64) (c.size() - offset));
+        memcpy(data + r, c.constData() + offset, n);
+        r += n;
+        offset += n;
+        if (offset == c.size()) {
+            chunks.dequeue();
+            offset = 0;
+        }
+    }
+    size -= r;
+
+    if (r > 0)
+        notFull.wakeAll();
+
+    return r;
+}
+
+qint64 PipeBuffer::writeData(const char* data, qint64 maxSize)
+{
+    QMutexLocker locker(&mutex);
+
+    // a chunk bigger than the capacity is accepted if the buffer is empty
+    while (size > 0 && size + maxSize > capacity && !aborted)
+        notFull.wait(&mutex);
+
+    if (aborted) {
+        setErrorString(QObject::tr("The reader has stopped"));
+        return -1;
+    }
+    if (writeClosed) {
+        setErrorString(QObject::tr("The pipe is closed for writing"));
+        return -1;
+    }
+
+    hash.addData(data, maxSize);
+    chunks.enqueue(QByteArray(data, maxSize));
+    size += maxSize;
+    notEmpty.wakeAll();
+
+    return maxSize;
+}
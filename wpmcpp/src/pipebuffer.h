@@ -0,0 +1,97 @@
+#ifndef PIPEBUFFER_H
+#define PIPEBUFFER_H
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QCryptographicHash>
+#include <QString>
+
+/**
+ * @brief bounded in-memory pipe between 2 threads.
+ *
+ * One thread writes the data (e.g. a download) and another thread reads it
+ * at the same time (e.g. the XML parser). write() blocks while the buffer is
+ * full and read() blocks until some data is available or the writer has
+ * finished. The hash sum of all written data is computed on the fly.
+ *
+ * The device is opened in the constructor. Only the methods of this class
+ * (and not close()) may be called from the writer thread.
+ */
+class PipeBuffer: public QIODevice
+{
+    mutable QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+
+    /** written, but not yet read chunks */
+    QQueue<QByteArray> chunks;
+
+    /** number of bytes already read from the first chunk */
+    int offset;
+
+    /** number of bytes in the buffer */
+    qint64 size;
+
+    qint64 capacity;
+
+    bool writeClosed;
+    bool aborted;
+    QString writeError;
+
+    QCryptographicHash hash;
+    QString hashSum;
+public:
+    /**
+     * @param capacity maximum number of bytes in the buffer
+     * @param alg algorithm for the hash sum
+     */
+    PipeBuffer(qint64 capacity=4 * 1024 * 1024,
+            QCryptographicHash::Algorithm alg=QCryptographicHash::Sha1);
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+    bool atEnd() const;
+
+    /**
+     * @brief should be called by the writer after the last chunk. Wakes up
+     *     the reader.
+     * @param err error message or "" if the data is complete
+     */
+    void closeWrite(const QString& err="");
+
+    /**
+     * @brief should be called by the reader if it will not read the rest of
+     *     the data. All further writes fail.
+     */
+    void abort();
+
+    /**
+     * @brief blocks until n bytes are available or the writer has finished.
+     *     The data is not removed from the buffer.
+     * @param n number of bytes
+     * @return first n (or less at the end of the data) bytes
+     */
+    QByteArray lookAhead(int n);
+
+    /**
+     * @return error passed to closeWrite(). Blocks until the writer has
+     *     finished.
+     */
+    QString getWriteError();
+
+    /**
+     * @return hash sum of all written data as lower case hex string. Blocks
+     *     until the writer has finished. "" if the data is not complete.
+     */
+    QString getHashSum();
+protected:
+    qint64 readData(char* data, qint64 maxSize);
+    qint64 writeData(const char* data, qint64 maxSize);
+private:
+    void waitForWriter();
+};
+
+#endif // PIPEBUFFER_H
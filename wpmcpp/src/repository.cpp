@@ -5,8 +5,6 @@
 #include <QTemporaryFile>
 #include <qdom.h>
 #include <QDebug>
-#include <QXmlSimpleReader>
-#include <QXmlInputSource>
 
 #include "downloader.h"
 #include "repository.h"
@@ -19,7 +17,10 @@
 #include "wpmutils.h"
 #include "installedpackages.h"
 #include "dbrepository.h"
-#include "repositoryxmlhandler.h"
+#include "repositorysnapshot.h"
+#include "quazip.h"
+#include "quazipfile.h"
+#include "quagzipfile.h"
 
 Repository Repository::def;
 QMutex Repository::mutex;
@@ -207,35 +208,97 @@ QString Repository::writeTo(const QString& filename) const
 {
     QString r;
 
-    QDomDocument doc;
-    QDomElement root = doc.createElement("root");
-    doc.appendChild(root);
+    if (filename.endsWith(".gz", Qt::CaseInsensitive)) {
+        QuaGzipFile file(filename);
+        if (file.open(QIODevice::WriteOnly)) {
+            r = writeTo(&file);
+            file.close();
+        } else {
+            r = QString(QObject::tr("Cannot open %1 for writing")).
+                    arg(filename);
+        }
+    } else if (filename.endsWith(".zip", Qt::CaseInsensitive)) {
+        QuaZip zip(filename);
+        if (zip.open(QuaZip::mdCreate)) {
+            QuaZipFile file(&zip);
+            if (file.open(QIODevice::WriteOnly, QuaZipNewInfo("Rep.xml"))) {
+                r = writeTo(&file);
+                file.close();
+                if (r.isEmpty() && file.getZipError() != UNZ_OK)
+                    r = QString(QObject::tr("Error %1 writing %2")).
+                            arg(file.getZipError()).arg(filename);
+            } else {
+                r = QString(QObject::tr("Error %1 writing %2")).
+                        arg(file.getZipError()).arg(filename);
+            }
+            zip.close();
+            if (r.isEmpty() && zip.getZipError() != UNZ_OK)
+                r = QString(QObject::tr("Error %1 writing %2")).
+                        arg(zip.getZipError()).arg(filename);
+        } else {
+            r = QString(QObject::tr("Cannot open %1 for writing: %2")).
+                    arg(filename).arg(zip.getZipError());
+        }
+    } else {
+        QFile file(filename);
+        if (file.open(QIODevice::WriteOnly)) {
+            r = writeTo(&file);
+            file.close();
+        } else {
+            r = QString(QObject::tr("Cannot open %1 for writing")).
+                    arg(filename);
+        }
+    }
 
-    XMLUtils::addTextTag(root, "spec-version", "3.3");
+    return r;
+}
+
+QString Repository::writeTo(QIODevice* out) const
+{
+    QXmlStreamWriter w(out);
+    w.setAutoFormatting(true);
+    w.setAutoFormattingIndent(4);
+
+    w.writeStartDocument();
+    w.writeStartElement("root");
+    w.writeTextElement("spec-version", "3.3");
+
+    for (int i = 0; i < this->licenses.count(); i++) {
+        this->licenses.at(i)->toXML(&w);
+    }
 
     for (int i = 0; i < this->packages.count(); i++) {
-        Package* p = packages.at(i);
-        QDomElement package = doc.createElement("package");
-        p->saveTo(package);
-        root.appendChild(package);
+        this->packages.at(i)->toXML(&w);
     }
 
     for (int i = 0; i < this->packageVersions.count(); i++) {
-        PackageVersion* pv = this->packageVersions.at(i);
-        QDomElement version = doc.createElement("version");
-        root.appendChild(version);
-        pv->toXML(&version);
+        this->packageVersions.at(i)->toXML(&w);
     }
 
+    w.writeEndElement();
+    w.writeEndDocument();
+
+    QString r;
+    if (w.hasError())
+        r = QString(QObject::tr("Error writing the repository: %1")).
+                arg(out->errorString());
+
+    return r;
+}
+
+QString Repository::writeSnapshotTo(const QString& filename) const
+{
+    QString r;
+
     QFile file(filename);
     if (file.open(QIODevice::WriteOnly)) {
-        QTextStream s(&file);
-        doc.save(s, 4);
+        r = RepositorySnapshot::write(this, &file);
+        file.close();
     } else {
         r = QString(QObject::tr("Cannot open %1 for writing")).arg(filename);
     }
 
-    return "";
+    return r;
 }
 
 PackageVersion* Repository::findPackageVersion(const QString& package,
@@ -128,13 +128,33 @@ public:
     Package* findPackage_(const QString& name);
 
     /**
-     * Writes this repository to an XML file.
+     * Writes this repository to an XML file. The data is streamed and the
+     * memory usage does not depend on the size of the repository.
      *
-     * @param filename output file name
+     * @param filename output file name. If the name ends with ".gz", the
+     *     file will be compressed using gzip. If the name ends with ".zip",
+     *     a ZIP file with the only entry "Rep.xml" will be created.
      * @return error message or ""
      */
     QString writeTo(const QString& filename) const;
 
+    /**
+     * Writes this repository as XML.
+     *
+     * @param out [ownership:caller] output device opened for writing
+     * @return error message or ""
+     */
+    QString writeTo(QIODevice* out) const;
+
+    /**
+     * Writes this repository to a binary snapshot file. See
+     * RepositorySnapshot for the format.
+     *
+     * @param filename output file name
+     * @return error message or ""
+     */
+    QString writeSnapshotTo(const QString& filename) const;
+
     QList<PackageVersion*> getPackageVersions_(const QString& package,
             QString *err) const;
 
@@ -0,0 +1,438 @@
+#include "repositorysnapshot.h"
+
+#include <QHash>
+#include <QVector>
+#include <QObject>
+#include <QtEndian>
+
+#include "package.h"
+#include "packageversion.h"
+#include "license.h"
+#include "wpmutils.h"
+
+const quint32 RepositorySnapshot::FORMAT;
+
+/** number of entries in the header */
+static const int HEADER_SIZE = 16;
+
+/** number of entries in a package record */
+static const int PACKAGE_SIZE = 16;
+
+/** number of entries in a package version record */
+static const int VERSION_SIZE = 4;
+
+/** number of entries in a license record */
+static const int LICENSE_SIZE = 8;
+
+/**
+ * @brief collects the tables of a snapshot
+ */
+class SnapshotWriter
+{
+public:
+    /** UTF-16LE characters */
+    QByteArray strings;
+
+    /** string -> index of the first character in "strings" */
+    QHash<QString, quint32> stringIndex;
+
+    QVector<quint32> arrays;
+
+    QByteArray blobs;
+
+    /**
+     * @brief adds a string reference. Equal strings are only stored once.
+     * @param v the index and the length of the string will be appended here
+     * @param s a string
+     */
+    void addString(QVector<quint32>* v, const QString& s);
+};
+
+void SnapshotWriter::addString(QVector<quint32>* v, const QString& s)
+{
+    if (s.isEmpty()) {
+        v->append(0);
+        v->append(0);
+        return;
+    }
+
+    QHash<QString, quint32>::const_iterator it = stringIndex.constFind(s);
+    quint32 index;
+    if (it == stringIndex.constEnd()) {
+        index = strings.size() / 2;
+        stringIndex.insert(s, index);
+
+        int start = strings.size();
+        strings.resize(start + s.length() * 2);
+        uchar* p = (uchar*) strings.data() + start;
+        const QChar* c = s.constData();
+        for (int i = 0; i < s.length(); i++) {
+            qToLittleEndian<quint16>(c[i].unicode(), p + i * 2);
+        }
+    } else {
+        index = it.value();
+    }
+
+    v->append(index);
+    v->append(s.length());
+}
+
+/**
+ * @brief appends numbers in little-endian format
+ * @param out output
+ * @param v numbers
+ */
+static void appendNumbers(QByteArray* out, const QVector<quint32>& v)
+{
+    int start = out->size();
+    out->resize(start + v.count() * 4);
+    uchar* p = (uchar*) out->data() + start;
+    for (int i = 0; i < v.count(); i++) {
+        qToLittleEndian<quint32>(v.at(i), p + i * 4);
+    }
+}
+
+/**
+ * @param n a size in bytes
+ * @return n rounded up to a multiple of 4
+ */
+static quint32 align4(quint32 n)
+{
+    return (n + 3) & ~3u;
+}
+
+bool RepositorySnapshot::isSnapshot(const QByteArray &header)
+{
+    return header.startsWith("NPKS");
+}
+
+QString RepositorySnapshot::write(const Repository* r, QIODevice* out)
+{
+    SnapshotWriter w;
+
+    QVector<quint32> packages;
+    packages.reserve(r->packages.count() * PACKAGE_SIZE);
+    for (int i = 0; i < r->packages.count(); i++) {
+        Package* p = r->packages.at(i);
+        w.addString(&packages, p->name);
+        w.addString(&packages, p->title);
+        w.addString(&packages, p->url);
+        w.addString(&packages, p->getIcon());
+        w.addString(&packages, p->description);
+        w.addString(&packages, p->license);
+
+        packages.append(w.arrays.count());
+        packages.append(p->categories.count());
+        for (int j = 0; j < p->categories.count(); j++) {
+            w.addString(&w.arrays, p->categories.at(j));
+        }
+
+        QList<QString> rels = p->links.uniqueKeys();
+        QVector<quint32> links;
+        for (int j = 0; j < rels.count(); j++) {
+            const QString& rel = rels.at(j);
+
+            // QMultiMap returns the values in the reverse insertion order
+            QList<QString> hrefs = p->links.values(rel);
+            for (int k = hrefs.count() - 1; k >= 0; k--) {
+                w.addString(&links, rel);
+                w.addString(&links, hrefs.at(k));
+            }
+        }
+        packages.append(w.arrays.count());
+        packages.append(links.count() / 4);
+        w.arrays += links;
+    }
+
+    QVector<quint32> versions;
+    versions.reserve(r->packageVersions.count() * VERSION_SIZE);
+    for (int i = 0; i < r->packageVersions.count(); i++) {
+        PackageVersion* pv = r->packageVersions.at(i);
+        QByteArray data = pv->toBinary();
+        w.addString(&versions, pv->package);
+        versions.append(w.blobs.size());
+        versions.append(data.size());
+        w.blobs.append(data);
+    }
+
+    QVector<quint32> licenses;
+    licenses.reserve(r->licenses.count() * LICENSE_SIZE);
+    for (int i = 0; i < r->licenses.count(); i++) {
+        License* lic = r->licenses.at(i);
+        w.addString(&licenses, lic->name);
+        w.addString(&licenses, lic->title);
+        w.addString(&licenses, lic->description);
+        w.addString(&licenses, lic->url);
+    }
+
+    quint32 packagesOffset = HEADER_SIZE * 4;
+    quint32 versionsOffset = packagesOffset + packages.count() * 4;
+    quint32 licensesOffset = versionsOffset + versions.count() * 4;
+    quint32 stringsOffset = licensesOffset + licenses.count() * 4;
+    quint32 arraysOffset = align4(stringsOffset + w.strings.size());
+    quint32 blobsOffset = arraysOffset + w.arrays.count() * 4;
+    quint32 size = align4(blobsOffset + w.blobs.size());
+
+    QByteArray data;
+    data.reserve(size);
+    data.append("NPKS", 4);
+
+    QVector<quint32> header;
+    header << FORMAT <<
+            r->packages.count() << packagesOffset <<
+            r->packageVersions.count() << versionsOffset <<
+            r->licenses.count() << licensesOffset <<
+            stringsOffset << w.strings.size() / 2 <<
+            arraysOffset << w.arrays.count() <<
+            blobsOffset << w.blobs.size() <<
+            size << 0;
+    appendNumbers(&data, header);
+    appendNumbers(&data, packages);
+    appendNumbers(&data, versions);
+    appendNumbers(&data, licenses);
+    data.append(w.strings);
+    data.append(QByteArray(arraysOffset - data.size(), 0));
+    appendNumbers(&data, w.arrays);
+    data.append(w.blobs);
+    data.append(QByteArray(size - data.size(), 0));
+
+    QString err;
+    if (out->write(data) != data.size())
+        err = out->errorString();
+
+    return err;
+}
+
+/**
+ * @brief access to the tables of a snapshot
+ */
+class SnapshotReader
+{
+public:
+    const uchar* data;
+    qint64 size;
+
+    const uchar* strings;
+    quint32 nstrings;
+
+    const uchar* arrays;
+    quint32 narrays;
+
+    const uchar* blobs;
+    quint32 blobsSize;
+
+    /**
+     * @param index index of a number in the header
+     * @return the number
+     */
+    quint32 header(int index) const;
+
+    /**
+     * @brief checks that a section is inside of the data
+     * @param offset offset of the section
+     * @param count number of entries
+     * @param entrySize size of an entry in bytes
+     * @return true if the section is valid
+     */
+    bool isValid(quint32 offset, quint32 count, quint32 entrySize) const;
+
+    /**
+     * @brief reads a string
+     * @param ref string reference (2 numbers)
+     * @param s the string will be stored here
+     * @return true if the reference is valid
+     */
+    bool getString(const uchar* ref, QString* s) const;
+};
+
+quint32 SnapshotReader::header(int index) const
+{
+    return qFromLittleEndian<quint32>(data + index * 4);
+}
+
+bool SnapshotReader::isValid(quint32 offset, quint32 count,
+        quint32 entrySize) const
+{
+    return (offset & 3) == 0 &&
+            ((qint64) offset) + ((qint64) count) * entrySize <= size;
+}
+
+bool SnapshotReader::getString(const uchar* ref, QString* s) const
+{
+    quint32 index = qFromLittleEndian<quint32>(ref);
+    quint32 length = qFromLittleEndian<quint32>(ref + 4);
+    if (((qint64) index) + length > nstrings)
+        return false;
+
+    const uchar* p = strings + index * 2;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    *s = QString((const QChar*) p, length);
+#else
+    s->resize(length);
+    for (quint32 i = 0; i < length; i++) {
+        (*s)[i] = QChar(qFromLittleEndian<quint16>(p + i * 2));
+    }
+#endif
+
+    return true;
+}
+
+QString RepositorySnapshot::read(const uchar* data, qint64 size, Repository* r)
+{
+    QString err;
+
+    SnapshotReader sr;
+    sr.data = data;
+    sr.size = size;
+
+    if (size < HEADER_SIZE * 4 || !isSnapshot(QByteArray::fromRawData(
+            (const char*) data, 4)))
+        err = QObject::tr("the file is not a repository snapshot");
+    else if (sr.header(1) != FORMAT)
+        err = QObject::tr("unsupported format version %1").arg(sr.header(1));
+    else if (sr.header(14) != size)
+        err = QObject::tr("the file is incomplete");
+
+    quint32 npackages = 0, nversions = 0, nlicenses = 0;
+    const uchar* packages = 0;
+    const uchar* versions = 0;
+    const uchar* licenses = 0;
+    if (err.isEmpty()) {
+        npackages = sr.header(2);
+        nversions = sr.header(4);
+        nlicenses = sr.header(6);
+        sr.nstrings = sr.header(9);
+        sr.narrays = sr.header(11);
+        sr.blobsSize = sr.header(13);
+        if (!sr.isValid(sr.header(3), npackages, PACKAGE_SIZE * 4) ||
+                !sr.isValid(sr.header(5), nversions, VERSION_SIZE * 4) ||
+                !sr.isValid(sr.header(7), nlicenses, LICENSE_SIZE * 4) ||
+                !sr.isValid(sr.header(8), sr.nstrings, 2) ||
+                !sr.isValid(sr.header(10), sr.narrays, 4) ||
+                !sr.isValid(sr.header(12), sr.blobsSize, 1)) {
+            err = QObject::tr("invalid section offset");
+        } else {
+            packages = data + sr.header(3);
+            versions = data + sr.header(5);
+            licenses = data + sr.header(7);
+            sr.strings = data + sr.header(8);
+            sr.arrays = data + sr.header(10);
+            sr.blobs = data + sr.header(12);
+        }
+    }
+
+    for (quint32 i = 0; i < npackages && err.isEmpty(); i++) {
+        const uchar* rec = packages + i * PACKAGE_SIZE * 4;
+
+        QString name, title, url, icon, description, license;
+        if (!sr.getString(rec, &name) ||
+                !sr.getString(rec + 8, &title) ||
+                !sr.getString(rec + 16, &url) ||
+                !sr.getString(rec + 24, &icon) ||
+                !sr.getString(rec + 32, &description) ||
+                !sr.getString(rec + 40, &license)) {
+            err = QObject::tr("invalid string reference");
+            break;
+        }
+
+        err = WPMUtils::validateFullPackageName(name);
+        if (!err.isEmpty())
+            break;
+
+        Package* p = new Package(name, title);
+        p->url = url;
+        p->setIcon(icon);
+        p->description = description;
+        p->license = license;
+        r->packages.append(p);
+
+        quint32 catStart = qFromLittleEndian<quint32>(rec + 48);
+        quint32 catCount = qFromLittleEndian<quint32>(rec + 52);
+        quint32 linkStart = qFromLittleEndian<quint32>(rec + 56);
+        quint32 linkCount = qFromLittleEndian<quint32>(rec + 60);
+        if (((qint64) catStart) + ((qint64) catCount) * 2 > sr.narrays ||
+                ((qint64) linkStart) + ((qint64) linkCount) * 4 >
+                sr.narrays) {
+            err = QObject::tr("invalid array reference");
+            break;
+        }
+
+        for (quint32 j = 0; j < catCount; j++) {
+            QString c;
+            if (!sr.getString(sr.arrays + (catStart + j * 2) * 4, &c)) {
+                err = QObject::tr("invalid string reference");
+                break;
+            }
+            p->categories.append(c);
+        }
+
+        for (quint32 j = 0; j < linkCount && err.isEmpty(); j++) {
+            const uchar* link = sr.arrays + (linkStart + j * 4) * 4;
+            QString rel, href;
+            if (!sr.getString(link, &rel) || !sr.getString(link + 8, &href)) {
+                err = QObject::tr("invalid string reference");
+                break;
+            }
+            p->links.insert(rel, href);
+        }
+    }
+
+    for (quint32 i = 0; i < nversions && err.isEmpty(); i++) {
+        const uchar* rec = versions + i * VERSION_SIZE * 4;
+
+        QString package;
+        if (!sr.getString(rec, &package)) {
+            err = QObject::tr("invalid string reference");
+            break;
+        }
+
+        quint32 offset = qFromLittleEndian<quint32>(rec + 8);
+        quint32 length = qFromLittleEndian<quint32>(rec + 12);
+        if (((qint64) offset) + length > sr.blobsSize) {
+            err = QObject::tr("invalid package version data reference");
+            break;
+        }
+
+        // the data is not copied
+        QByteArray blob = QByteArray::fromRawData(
+                (const char*) sr.blobs + offset, length);
+        PackageVersion* pv = PackageVersion::fromBinary(blob, &err);
+        if (!err.isEmpty())
+            break;
+
+        if (pv->package != package)
+            err = QObject::tr("inconsistent package name %1").arg(package);
+        else
+            err = WPMUtils::validateFullPackageName(package);
+        if (!err.isEmpty()) {
+            delete pv;
+            break;
+        }
+
+        r->packageVersions.append(pv);
+        r->package2versions.insert(pv->package, pv);
+    }
+
+    for (quint32 i = 0; i < nlicenses && err.isEmpty(); i++) {
+        const uchar* rec = licenses + i * LICENSE_SIZE * 4;
+
+        QString name, title, description, url;
+        if (!sr.getString(rec, &name) ||
+                !sr.getString(rec + 8, &title) ||
+                !sr.getString(rec + 16, &description) ||
+                !sr.getString(rec + 24, &url)) {
+            err = QObject::tr("invalid string reference");
+            break;
+        }
+
+        License* lic = new License(name, title);
+        lic->description = description;
+        lic->url = url;
+        r->licenses.append(lic);
+    }
+
+    if (!err.isEmpty())
+        err = QObject::tr("Invalid repository snapshot: %1").arg(err);
+
+    return err;
+}
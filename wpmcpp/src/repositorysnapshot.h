@@ -0,0 +1,78 @@
+#ifndef REPOSITORYSNAPSHOT_H
+#define REPOSITORYSNAPSHOT_H
+
+#include <QString>
+#include <QByteArray>
+#include <QIODevice>
+
+#include "repository.h"
+
+/**
+ * @brief binary snapshot of a repository. The format is designed to be
+ *     used directly from a memory mapped file.
+ *
+ * All numbers are 32 bit little-endian unsigned integers. The file starts
+ * with a header of 16 numbers:
+ *     0: magic bytes "NPKS"
+ *     1: format version (1)
+ *     2, 3: number of packages, offset of the package records
+ *     4, 5: number of package versions, offset of the package version records
+ *     6, 7: number of licenses, offset of the license records
+ *     8, 9: offset and number of characters of the string table
+ *     10, 11: offset and number of entries of the array table
+ *     12, 13: offset and size in bytes of the package version data
+ *     14: size of the whole file in bytes
+ *     15: reserved (0)
+ *
+ * The string table contains UTF-16LE characters. A string is referenced by
+ * 2 numbers: the index of the first character and the length.
+ *
+ * A package record has 16 entries: 6 string references for name, title,
+ * URL, icon, description and license followed by the index and count of
+ * the categories (string references in the array table) and the index and
+ * count of the links (rel and href string references in the array table).
+ *
+ * A package version record has 4 entries: string reference for the package
+ * name and the offset and size of the data in the format of
+ * PackageVersion::toBinary(). The data contains the files, detection
+ * information and dependencies.
+ *
+ * A license record has 8 entries: string references for name, title,
+ * description and URL.
+ *
+ * All sections start at offsets divisible by 4.
+ */
+class RepositorySnapshot
+{
+    RepositorySnapshot();
+public:
+    /** format version */
+    static const quint32 FORMAT = 1;
+
+    /**
+     * @param header the first bytes of a file
+     * @return true if the data starts with the magic bytes of a snapshot
+     */
+    static bool isSnapshot(const QByteArray& header);
+
+    /**
+     * @brief writes a snapshot
+     * @param r repository
+     * @param out [ownership:caller] output device opened for writing
+     * @return error message
+     */
+    static QString write(const Repository* r, QIODevice* out);
+
+    /**
+     * @brief reads a snapshot. The strings are copied from the data and no
+     *     text parsing is done.
+     * @param data the whole snapshot, for example a memory mapped file
+     * @param size size of the data in bytes
+     * @param r [ownership:caller] the packages, package versions and
+     *     licenses will be appended here
+     * @return error message
+     */
+    static QString read(const uchar* data, qint64 size, Repository* r);
+};
+
+#endif // REPOSITORYSNAPSHOT_H
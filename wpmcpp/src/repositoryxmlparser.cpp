@@ -0,0 +1,484 @@
+#include "repositoryxmlparser.h"
+
+#include <QObject>
+#include <QVector>
+#include <QXmlStreamReader>
+#include <QLatin1String>
+
+#include "repository.h"
+#include "wpmutils.h"
+#include "packageversionfile.h"
+
+/**
+ * @brief entry in the perfect hash table for the element names
+ */
+struct ElementName
+{
+    const char* name;
+    int value;
+};
+
+int RepositoryXMLParser::findName(const QStringRef& name)
+{
+    int len = name.length();
+    if (len == 0)
+        return -1;
+
+    // element names indexed by the hash value. The hash function was chosen
+    // so that all known names have different values.
+    static const ElementName NAMES[32] = {
+        {0, -1},
+        {"icon", NAME_ICON},
+        {"title", NAME_TITLE},
+        {"variable", NAME_VARIABLE},
+        {0, -1},
+        {0, -1},
+        {"important-file", NAME_IMPORTANT_FILE},
+        {"version", NAME_VERSION},
+        {"package", NAME_PACKAGE},
+        {0, -1},
+        {"category", NAME_CATEGORY},
+        {"detect-msi", NAME_DETECT_MSI},
+        {"license", NAME_LICENSE},
+        {0, -1},
+        {"sha1", NAME_SHA1},
+        {"file", NAME_FILE},
+        {0, -1},
+        {0, -1},
+        {0, -1},
+        {0, -1},
+        {0, -1},
+        {0, -1},
+        {0, -1},
+        {"link", NAME_LINK},
+        {"detect-file", NAME_DETECT_FILE},
+        {"hash-sum", NAME_HASH_SUM},
+        {"url", NAME_URL},
+        {"dependency", NAME_DEPENDENCY},
+        {"path", NAME_PATH},
+        {"description", NAME_DESCRIPTION},
+        {0, -1},
+        {"spec-version", NAME_SPEC_VERSION}
+    };
+
+    const QChar* d = name.unicode();
+    int h = (len + d[0].unicode() * 15 + d[len - 1].unicode() * 29) & 31;
+
+    const ElementName& e = NAMES[h];
+    if (e.name && name == QLatin1String(e.name))
+        return e.value;
+    else
+        return -1;
+}
+
+int RepositoryXMLParser::transition(int state, int name)
+{
+    switch (state) {
+        case TAG_ROOT:
+            switch (name) {
+                case NAME_VERSION:
+                    return TAG_VERSION;
+                case NAME_PACKAGE:
+                    return TAG_PACKAGE;
+                case NAME_LICENSE:
+                    return TAG_LICENSE;
+                case NAME_SPEC_VERSION:
+                    return TAG_SPEC_VERSION;
+            }
+            break;
+        case TAG_VERSION:
+            switch (name) {
+                case NAME_IMPORTANT_FILE:
+                    return TAG_VERSION_IMPORTANT_FILE;
+                case NAME_FILE:
+                    return TAG_VERSION_FILE;
+                case NAME_DEPENDENCY:
+                    return TAG_VERSION_DEPENDENCY;
+                case NAME_DETECT_FILE:
+                    return TAG_VERSION_DETECT_FILE;
+                case NAME_URL:
+                    return TAG_VERSION_URL;
+                case NAME_SHA1:
+                    return TAG_VERSION_SHA1;
+                case NAME_HASH_SUM:
+                    return TAG_VERSION_HASH_SUM;
+                case NAME_DETECT_MSI:
+                    return TAG_VERSION_DETECT_MSI;
+            }
+            break;
+        case TAG_PACKAGE:
+            switch (name) {
+                case NAME_TITLE:
+                    return TAG_PACKAGE_TITLE;
+                case NAME_URL:
+                    return TAG_PACKAGE_URL;
+                case NAME_DESCRIPTION:
+                    return TAG_PACKAGE_DESCRIPTION;
+                case NAME_ICON:
+                    return TAG_PACKAGE_ICON;
+                case NAME_LICENSE:
+                    return TAG_PACKAGE_LICENSE;
+                case NAME_CATEGORY:
+                    return TAG_PACKAGE_CATEGORY;
+                case NAME_LINK:
+                    return TAG_PACKAGE_LINK;
+            }
+            break;
+        case TAG_LICENSE:
+            switch (name) {
+                case NAME_TITLE:
+                    return TAG_LICENSE_TITLE;
+                case NAME_URL:
+                    return TAG_LICENSE_URL;
+                case NAME_DESCRIPTION:
+                    return TAG_LICENSE_DESCRIPTION;
+            }
+            break;
+        case TAG_VERSION_DEPENDENCY:
+            if (name == NAME_VARIABLE)
+                return TAG_VERSION_DEPENDENCY_VARIABLE;
+            break;
+        case TAG_VERSION_DETECT_FILE:
+            switch (name) {
+                case NAME_PATH:
+                    return TAG_VERSION_DETECT_FILE_PATH;
+                case NAME_SHA1:
+                    return TAG_VERSION_DETECT_FILE_SHA1;
+            }
+            break;
+    }
+    return TAG_UNKNOWN;
+}
+
+bool RepositoryXMLParser::isText(int state)
+{
+    switch (state) {
+        case TAG_VERSION_FILE:
+        case TAG_VERSION_URL:
+        case TAG_VERSION_SHA1:
+        case TAG_VERSION_HASH_SUM:
+        case TAG_VERSION_DETECT_MSI:
+        case TAG_VERSION_DEPENDENCY_VARIABLE:
+        case TAG_VERSION_DETECT_FILE_PATH:
+        case TAG_VERSION_DETECT_FILE_SHA1:
+        case TAG_PACKAGE_TITLE:
+        case TAG_PACKAGE_URL:
+        case TAG_PACKAGE_DESCRIPTION:
+        case TAG_PACKAGE_ICON:
+        case TAG_PACKAGE_LICENSE:
+        case TAG_PACKAGE_CATEGORY:
+        case TAG_LICENSE_TITLE:
+        case TAG_LICENSE_URL:
+        case TAG_LICENSE_DESCRIPTION:
+        case TAG_SPEC_VERSION:
+            return true;
+        default:
+            return false;
+    }
+}
+
+RepositoryXMLParser::RepositoryXMLParser(Repository *rep) :
+        lic(0), p(0), pv(0), pvf(0), dep(0), df(0)
+{
+    this->rep = rep;
+}
+
+RepositoryXMLParser::~RepositoryXMLParser()
+{
+    delete p;
+    delete pv;
+    delete lic;
+}
+
+QString RepositoryXMLParser::parse(QIODevice* device)
+{
+    QString error;
+
+    if (!device->isOpen() && !device->open(QIODevice::ReadOnly))
+        error = device->errorString();
+
+    QXmlStreamReader reader(device);
+
+    // states of all open elements
+    QVector<int> states;
+    states.reserve(8);
+
+    while (error.isEmpty() && !reader.atEnd()) {
+        QXmlStreamReader::TokenType t = reader.readNext();
+        if (t == QXmlStreamReader::StartElement) {
+            int state;
+            if (states.isEmpty())
+                state = TAG_ROOT;
+            else if (states.last() == TAG_UNKNOWN)
+                state = TAG_UNKNOWN;
+            else
+                state = transition(states.last(), findName(reader.name()));
+
+            error = startElement(state, reader.attributes());
+
+            if (error.isEmpty()) {
+                if (isText(state)) {
+                    QString text = reader.readElementText(
+                            QXmlStreamReader::IncludeChildElements);
+                    if (reader.hasError())
+                        break;
+                    error = endElement(state, text);
+                } else {
+                    states.append(state);
+                }
+            }
+        } else if (t == QXmlStreamReader::EndElement) {
+            error = endElement(states.last(), QString());
+            states.removeLast();
+        }
+    }
+
+    if (error.isEmpty() && reader.hasError()) {
+        error = QObject::tr("XML parsing error at line %1, column %2: %3").
+                arg(reader.lineNumber()).arg(reader.columnNumber()).
+                arg(reader.errorString());
+    }
+
+    return error;
+}
+
+QString RepositoryXMLParser::startElement(int state,
+        const QXmlStreamAttributes& atts)
+{
+    QString error;
+
+    if (state == TAG_VERSION) {
+        pv = new PackageVersion();
+        QString packageName = atts.value("package").toString();
+        error = WPMUtils::validateFullPackageName(packageName);
+        if (!error.isEmpty()) {
+            error = QObject::tr("Error in the attribute 'package' in <version>: %1").
+                    arg(error);
+        } else {
+            pv->package = packageName;
+        }
+
+        if (error.isEmpty()) {
+            QString name = atts.value("name").toString();
+            if (name.isEmpty())
+                name = "1.0";
+
+            if (pv->version.setVersion(name)) {
+                pv->version.normalize();
+            } else {
+                error = QObject::tr("Not a valid version for %1: %2").
+                        arg(pv->package).arg(name);
+            }
+        }
+
+        if (error.isEmpty()) {
+            QStringRef type = atts.value("type");
+            if (type.isEmpty() || type == QLatin1String("zip"))
+                pv->type = 0;
+            else if (type == QLatin1String("one-file"))
+                pv->type = 1;
+            else {
+                error = QObject::tr("Wrong value for the attribute 'type' for %1: %3").
+                        arg(pv->toString()).arg(type.toString());
+            }
+        }
+    } else if (state == TAG_VERSION_IMPORTANT_FILE) {
+        QString p = atts.value("path").toString();
+        if (p.isEmpty())
+            p = atts.value("name").toString();
+
+        if (p.isEmpty()) {
+            error = QObject::tr("Empty 'path' attribute value for <important-file> for %1").
+                    arg(pv->toString());
+        }
+
+        if (error.isEmpty()) {
+            if (pv->importantFiles.contains(p)) {
+                error = QObject::tr("More than one <important-file> with the same 'path' attribute %1 for %2").
+                        arg(p).arg(pv->toString());
+            }
+        }
+
+        if (error.isEmpty()) {
+            pv->importantFiles.append(p);
+        }
+
+        QString title = atts.value("title").toString();
+        if (error.isEmpty()) {
+            if (title.isEmpty()) {
+                error = QObject::tr("Empty 'title' attribute value for <important-file> for %1").
+                        arg(pv->toString());
+            }
+        }
+
+        if (error.isEmpty()) {
+            pv->importantFilesTitles.append(title);
+        }
+    } else if (state == TAG_VERSION_FILE) {
+        QString path = atts.value("path").toString();
+        pvf = new PackageVersionFile(path, "");
+        pv->files.append(pvf);
+    } else if (state == TAG_VERSION_HASH_SUM) {
+        QStringRef type = atts.value("type").trimmed();
+        if (type.isEmpty() || type == QLatin1String("SHA-256"))
+            pv->hashSumType = QCryptographicHash::Sha256;
+        else if (type == QLatin1String("SHA-1"))
+            pv->hashSumType = QCryptographicHash::Sha1;
+        else
+            error = QObject::tr("Error in attribute 'type' in <hash-sum> in %1").
+                    arg(pv->toString());
+    } else if (state == TAG_VERSION_DEPENDENCY) {
+        dep = new Dependency();
+        pv->dependencies.append(dep);
+        dep->package = atts.value("package").toString();
+        if (!dep->setVersions(atts.value("versions").toString()))
+            error = QObject::tr("Error in attribute 'versions' in <dependency> in %1").
+                    arg(pv->toString());
+    } else if (state == TAG_VERSION_DETECT_FILE) {
+        df = new DetectFile();
+        pv->detectFiles.append(df);
+    } else if (state == TAG_PACKAGE) {
+        QString name = atts.value("name").toString();
+        p = new Package(name, name);
+
+        error = WPMUtils::validateFullPackageName(name);
+        if (!error.isEmpty()) {
+            error.prepend(QObject::tr("Error in attribute 'name' in <package>: "));
+        }
+    } else if (state == TAG_PACKAGE_LINK) {
+        QString rel = atts.value("rel").trimmed().toString();
+        QString href = atts.value("href").trimmed().toString();
+
+        if (rel.isEmpty()) {
+            error = QObject::tr("Empty 'rel' attribute value for <link> for %1").
+                    arg(p->name);
+        }
+
+        if (error.isEmpty()) {
+            if (!Package::isValidURL(href))
+                error = QObject::tr("Not a valid href URL in <link> for %1: %2").
+                        arg(p->name).arg(href);
+        }
+
+        if (error.isEmpty())
+            p->links.insert(rel, href);
+    } else if (state == TAG_LICENSE) {
+        QString name = atts.value("name").toString();
+        lic = new License(name, name);
+
+        error = WPMUtils::validateFullPackageName(name);
+        if (!error.isEmpty()) {
+            error.prepend(QObject::tr("Error in attribute 'name' in <package>: "));
+        }
+    }
+
+    return error;
+}
+
+QString RepositoryXMLParser::endElement(int state, const QString& text)
+{
+    QString error;
+
+    if (state == TAG_VERSION) {
+        rep->packageVersions.append(pv);
+        rep->package2versions.insert(pv->package, pv);
+        pv = 0;
+    } else if (state == TAG_VERSION_FILE) {
+        pvf->content = text;
+        pvf = 0;
+    } else if (state == TAG_VERSION_URL) {
+        QString url = text.trimmed();
+        if (!url.isEmpty()) {
+            if (Package::isValidURL(url))
+                pv->download.setUrl(url);
+            else
+                error = QObject::tr("Not a valid download URL for %1: %2").
+                        arg(pv->package).arg(url);
+        }
+    } else if (state == TAG_VERSION_SHA1) {
+        pv->sha1 = text.trimmed().toLower();
+        pv->hashSumType = QCryptographicHash::Sha1;
+        if (!pv->sha1.isEmpty()) {
+            error = WPMUtils::validateSHA1(pv->sha1);
+            if (!error.isEmpty()) {
+                error = QObject::tr("Invalid SHA1 for %1: %2").
+                        arg(pv->toString()).arg(error);
+            }
+        }
+    } else if (state == TAG_VERSION_HASH_SUM) {
+        pv->sha1 = text.trimmed().toLower();
+        if (!pv->sha1.isEmpty()) {
+            error = WPMUtils::validateSHA256(pv->sha1);
+            if (!error.isEmpty()) {
+                error = QObject::tr("Invalid SHA-256 for %1: %2").
+                        arg(pv->toString()).arg(error);
+            }
+        }
+    } else if (state == TAG_VERSION_DETECT_MSI) {
+        pv->msiGUID = text.trimmed().toLower();
+        if (!pv->msiGUID.isEmpty()) {
+            error = WPMUtils::validateGUID(pv->msiGUID);
+            if (!error.isEmpty())
+                error = QObject::tr("Wrong MSI GUID for %1: %2 (%3)").
+                        arg(pv->toString()).arg(pv->msiGUID).arg(error);
+        }
+    } else if (state == TAG_VERSION_DEPENDENCY_VARIABLE) {
+        dep->var = text.trimmed();
+    } else if (state == TAG_VERSION_DETECT_FILE_PATH) {
+        df->path = text.trimmed();
+        df->path.replace('/', '\\');
+        if (df->path.isEmpty()) {
+            error = QObject::tr("Empty tag <path> under <detect-file>");
+        }
+    } else if (state == TAG_VERSION_DETECT_FILE_SHA1) {
+        df->sha1 = text.trimmed();
+        error = WPMUtils::validateSHA1(df->sha1);
+        if (!error.isEmpty()) {
+            error = QObject::tr("Wrong SHA1 in <detect-file>: ").arg(error);
+        }
+    } else if (state == TAG_PACKAGE) {
+        rep->packages.append(p);
+        p = 0;
+    } else if (state == TAG_PACKAGE_TITLE) {
+        p->title = text.trimmed();
+    } else if (state == TAG_PACKAGE_URL) {
+        p->url = text.trimmed();
+    } else if (state == TAG_PACKAGE_DESCRIPTION) {
+        p->description = text.trimmed();
+    } else if (state == TAG_PACKAGE_ICON) {
+        p->setIcon(text.trimmed());
+        if (!p->getIcon().isEmpty()) {
+            if (!Package::isValidURL(p->getIcon())) {
+                error = QString(
+                        QObject::tr("Invalid icon URL for %1: %2")).
+                        arg(p->title).arg(p->getIcon());
+            }
+        }
+    } else if (state == TAG_PACKAGE_LICENSE) {
+        p->license = text.trimmed();
+    } else if (state == TAG_PACKAGE_CATEGORY) {
+        QString err;
+        QString c = Repository::checkCategory(text.trimmed(), &err);
+        if (!err.isEmpty()) {
+            error = QObject::tr("Error in category tag for %1: %2").
+                    arg(p->title).arg(err);
+        } else if (p->categories.contains(c)) {
+            error = QObject::tr("More than one <category> %1").arg(c);
+        } else {
+            p->categories.append(c);
+        }
+    } else if (state == TAG_LICENSE) {
+        rep->licenses.append(lic);
+        lic = 0;
+    } else if (state == TAG_LICENSE_TITLE) {
+        lic->title = text.trimmed();
+    } else if (state == TAG_LICENSE_URL) {
+        lic->url = text.trimmed();
+    } else if (state == TAG_LICENSE_DESCRIPTION) {
+        lic->description = text.trimmed();
+    } else if (state == TAG_SPEC_VERSION) {
+        error = Repository::checkSpecVersion(text.trimmed());
+    }
+
+    return error;
+}
@@ -0,0 +1,148 @@
+#ifndef REPOSITORYXMLPARSER_H
+#define REPOSITORYXMLPARSER_H
+
+#include <QString>
+#include <QStringRef>
+#include <QIODevice>
+#include <QXmlStreamAttributes>
+
+#include "license.h"
+#include "package.h"
+#include "packageversion.h"
+#include "repository.h"
+
+/**
+ * @brief pull parser for the repository XML based on QXmlStreamReader.
+ *
+ * Element names are mapped to numbers using a perfect hash without
+ * allocating a QString. The position in the document is tracked by a state
+ * machine where each state is a known path like /root/version/file.
+ */
+class RepositoryXMLParser
+{
+    /**
+     * @brief known element names
+     */
+    enum NAME {
+        NAME_VERSION,
+        NAME_PACKAGE,
+        NAME_LICENSE,
+        NAME_SPEC_VERSION,
+        NAME_IMPORTANT_FILE,
+        NAME_FILE,
+        NAME_DEPENDENCY,
+        NAME_DETECT_FILE,
+        NAME_URL,
+        NAME_SHA1,
+        NAME_HASH_SUM,
+        NAME_DETECT_MSI,
+        NAME_TITLE,
+        NAME_DESCRIPTION,
+        NAME_ICON,
+        NAME_CATEGORY,
+        NAME_LINK,
+        NAME_VARIABLE,
+        NAME_PATH
+    };
+
+    /**
+     * @brief states of the parser. TAG_UNKNOWN is used for unknown elements
+     *     and all their children.
+     */
+    enum STATE {
+        TAG_UNKNOWN,
+        TAG_ROOT,
+        TAG_VERSION,
+        TAG_VERSION_IMPORTANT_FILE,
+        TAG_VERSION_FILE,
+        TAG_VERSION_DEPENDENCY,
+        TAG_VERSION_DETECT_FILE,
+        TAG_PACKAGE,
+        TAG_LICENSE,
+        TAG_VERSION_URL,
+        TAG_VERSION_SHA1,
+        TAG_VERSION_HASH_SUM,
+        TAG_VERSION_DETECT_MSI,
+        TAG_VERSION_DEPENDENCY_VARIABLE,
+        TAG_VERSION_DETECT_FILE_PATH,
+        TAG_VERSION_DETECT_FILE_SHA1,
+        TAG_PACKAGE_TITLE,
+        TAG_PACKAGE_URL,
+        TAG_PACKAGE_DESCRIPTION,
+        TAG_PACKAGE_ICON,
+        TAG_PACKAGE_LICENSE,
+        TAG_PACKAGE_CATEGORY,
+        TAG_PACKAGE_LINK,
+        TAG_LICENSE_TITLE,
+        TAG_LICENSE_URL,
+        TAG_LICENSE_DESCRIPTION,
+        TAG_SPEC_VERSION
+    };
+
+    Repository* rep;
+
+    License* lic;
+    Package* p;
+    PackageVersion* pv;
+    PackageVersionFile* pvf;
+    Dependency* dep;
+    DetectFile* df;
+
+    /**
+     * @brief maps an element name to a number
+     * @param name element name
+     * @return NAME_* or -1 for unknown elements
+     */
+    static int findName(const QStringRef& name);
+
+    /**
+     * @brief computes the state for a child element
+     * @param state state of the parent element
+     * @param name NAME_* of the child element or -1
+     * @return state for the child element
+     */
+    static int transition(int state, int name);
+
+    /**
+     * @param state a state
+     * @return true if the element only contains text that should be read at
+     *     once
+     */
+    static bool isText(int state);
+
+    /**
+     * @brief processes the start of an element
+     * @param state state for the element
+     * @param atts attributes
+     * @return error message
+     */
+    QString startElement(int state, const QXmlStreamAttributes& atts);
+
+    /**
+     * @brief processes the end of an element
+     * @param state state for the element
+     * @param text text content of the element for isText(state) == true
+     * @return error message
+     */
+    QString endElement(int state, const QString& text);
+public:
+    /**
+     * -
+     *
+     * @param rep [ownership:caller] data will be stored here. All parsed
+     *     objects are appended in the document order, including duplicates.
+     */
+    RepositoryXMLParser(Repository* rep);
+
+    ~RepositoryXMLParser();
+
+    /**
+     * @brief parses the repository XML
+     * @param device [ownership:caller] the data will be read from here. The
+     *     device will be opened if necessary.
+     * @return error message
+     */
+    QString parse(QIODevice* device);
+};
+
+#endif // REPOSITORYXMLPARSER_H
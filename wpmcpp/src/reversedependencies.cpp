@@ -0,0 +1,72 @@
+#include "reversedependencies.h"
+
+ReverseDependencies::ReverseDependencies(const QList<PackageVersion*>& pvs)
+{
+    for (int i = 0; i < pvs.count(); i++) {
+        PackageVersion* pv = pvs.at(i);
+        packageVersions.insert(pv->package, pv);
+
+        for (int j = 0; j < pv->dependencies.count(); j++) {
+            Dependent d;
+            d.pv = pv;
+            d.dependency = pv->dependencies.at(j);
+            dependents.insert(d.dependency->package, d);
+        }
+    }
+}
+
+PackageVersion* ReverseDependencies::find(const QString& package,
+        const Version& version) const
+{
+    PackageVersion* r = 0;
+    QMultiHash<QString, PackageVersion*>::const_iterator it =
+            packageVersions.constFind(package);
+    while (it != packageVersions.constEnd() && it.key() == package) {
+        PackageVersion* pv = it.value();
+        if (pv->version == version && !removed.contains(pv)) {
+            r = pv;
+            break;
+        }
+        ++it;
+    }
+    return r;
+}
+
+bool ReverseDependencies::contains(PackageVersion* pv) const
+{
+    return packageVersions.contains(pv->package, pv) && !removed.contains(pv);
+}
+
+QList<ReverseDependencies::Dependent> ReverseDependencies::findDependents(
+        const QString& package, const Version& version) const
+{
+    QList<Dependent> r;
+    QMultiHash<QString, Dependent>::const_iterator it =
+            dependents.constFind(package);
+    while (it != dependents.constEnd() && it.key() == package) {
+        const Dependent& d = it.value();
+        if (!removed.contains(d.pv) && d.dependency->test(version))
+            r.append(d);
+        ++it;
+    }
+    return r;
+}
+
+int ReverseDependencies::countMatches(const Dependency* d) const
+{
+    int n = 0;
+    QMultiHash<QString, PackageVersion*>::const_iterator it =
+            packageVersions.constFind(d->package);
+    while (it != packageVersions.constEnd() && it.key() == d->package) {
+        PackageVersion* pv = it.value();
+        if (!removed.contains(pv) && d->test(pv->version))
+            n++;
+        ++it;
+    }
+    return n;
+}
+
+void ReverseDependencies::remove(PackageVersion* pv)
+{
+    removed.insert(pv);
+}
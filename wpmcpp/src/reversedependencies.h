@@ -0,0 +1,95 @@
+#ifndef REVERSEDEPENDENCIES_H
+#define REVERSEDEPENDENCIES_H
+
+#include <QString>
+#include <QList>
+#include <QMultiHash>
+#include <QSet>
+
+#include "packageversion.h"
+#include "dependency.h"
+#include "version.h"
+
+/**
+ * @brief index of reverse dependencies between package versions (normally
+ *     the installed ones). A package name is mapped to the package versions
+ *     that depend on it together with the required version range.
+ *
+ * The index is built once and updated by remove() so that the question "who
+ * depends on this package version" can be answered without scanning all
+ * package versions and their dependencies.
+ */
+class ReverseDependencies
+{
+public:
+    /**
+     * @brief a package version depending on another package
+     */
+    struct Dependent
+    {
+        /** the dependent package version */
+        PackageVersion* pv;
+
+        /** [ownership:pv] the dependency */
+        Dependency* dependency;
+    };
+private:
+    /** required package name -> dependents */
+    QMultiHash<QString, Dependent> dependents;
+
+    /** package name -> package versions */
+    QMultiHash<QString, PackageVersion*> packageVersions;
+
+    /** package versions removed by remove() */
+    QSet<PackageVersion*> removed;
+public:
+    /**
+     * @param pvs [ownership:caller] package versions. The objects must not be
+     *     destroyed while this index is used. The dependencies must be
+     *     available (see PackageVersion::materialize()).
+     */
+    ReverseDependencies(const QList<PackageVersion*>& pvs);
+
+    /**
+     * @param package full package name
+     * @param version version number
+     * @return [ownership:caller of the constructor] found package version
+     *     or 0
+     */
+    PackageVersion* find(const QString& package,
+            const Version& version) const;
+
+    /**
+     * @param pv a package version
+     * @return true if the package version was passed to the constructor and
+     *     was not removed
+     */
+    bool contains(PackageVersion* pv) const;
+
+    /**
+     * @brief searches for the package versions that depend on the specified
+     *     package version
+     * @param package full package name
+     * @param version version number
+     * @return dependents with a dependency matching the specified version.
+     *     A package version is returned once for every matching dependency.
+     */
+    QList<Dependent> findDependents(const QString& package,
+            const Version& version) const;
+
+    /**
+     * @param d a dependency
+     * @return number of package versions in this index that match the
+     *     dependency
+     */
+    int countMatches(const Dependency* d) const;
+
+    /**
+     * @brief removes a package version from this index. The object itself is
+     *     not destroyed.
+     * @param pv a package version from this index
+     */
+    void remove(PackageVersion* pv);
+};
+
+#endif // REVERSEDEPENDENCIES_H
@@ -1,14 +1,106 @@
+#include <limits.h>
+
 #include "qstringlist.h"
+#include "qdatastream.h"
 
 #include "version.h"
 
 const Version Version::EMPTY(-1, -1);
 
+/**
+ * @brief parses one part of a version number like QString::toInt() would do
+ *     it: whitespace around the number and a sign are allowed
+ * @param data characters
+ * @param len number of characters
+ * @param pos current position. This will be changed to the position of the
+ *     next dot or to len.
+ * @param value the number will be stored here
+ * @return true if the number is valid
+ */
+static bool parsePart(const QChar* data, int len, int* pos, int* value)
+{
+    int i = *pos;
+    while (i < len && data[i].isSpace())
+        i++;
+
+    bool negative = false;
+    if (i < len && (data[i] == '-' || data[i] == '+')) {
+        negative = data[i] == '-';
+        i++;
+    }
+
+    qint64 v = 0;
+    int ndigits = 0;
+    while (i < len) {
+        ushort c = data[i].unicode();
+        if (c < '0' || c > '9')
+            break;
+
+        v = v * 10 + (c - '0');
+        if (v > ((qint64) INT_MAX) + 1)
+            return false;
+        ndigits++;
+        i++;
+    }
+    if (ndigits == 0)
+        return false;
+    if (negative)
+        v = -v;
+    if (v > INT_MAX || v < INT_MIN)
+        return false;
+
+    while (i < len && data[i].isSpace())
+        i++;
+    if (i < len && data[i] != '.')
+        return false;
+
+    *pos = i;
+    *value = (int) v;
+    return true;
+}
+
+/**
+ * @param v a number
+ * @return number of characters in the decimal representation
+ */
+static int formattedLength(int v)
+{
+    int r = v < 0 ? 2 : 1;
+    quint32 u = v < 0 ? 0u - (quint32) v : (quint32) v;
+    while (u >= 10) {
+        u /= 10;
+        r++;
+    }
+    return r;
+}
+
+/**
+ * @brief writes the decimal representation of a number
+ * @param v a number
+ * @param out output. There must be space for formattedLength(v)
+ *     characters.
+ * @return number of written characters
+ */
+static int formatPart(int v, QChar* out)
+{
+    int len = formattedLength(v);
+    quint32 u = v < 0 ? 0u - (quint32) v : (quint32) v;
+    int i = len;
+    do {
+        out[--i] = QChar((ushort) ('0' + u % 10));
+        u /= 10;
+    } while (u != 0);
+    if (v < 0)
+        out[0] = '-';
+    return len;
+}
+
 Version::Version()
 {
     this->parts = &this->basic[0];
     this->parts[0] = 1;
     this->nparts = 1;
+    this->nnormalized = 1;
 }
 
 Version::Version(const QString &v)
@@ -16,6 +108,7 @@ Version::Version(const QString &v)
     this->parts = &this->basic[0];
     this->parts[0] = 1;
     this->nparts = 1;
+    this->nnormalized = 1;
 
     setVersion(v);
 }
@@ -26,6 +119,7 @@ Version::Version(int a, int b)
     this->parts[0] = a;
     this->parts[1] = b;
     this->nparts = 2;
+    updateNormalized();
 }
 
 Version::Version(const Version &v)
@@ -35,6 +129,7 @@ Version::Version(const Version &v)
     else
         this->parts = new int[v.nparts];
     this->nparts = v.nparts;
+    this->nnormalized = v.nnormalized;
     memcpy(parts, v.parts, sizeof(parts[0]) * nparts);
 }
 
@@ -48,6 +143,7 @@ Version& Version::operator =(const Version& v)
         else
             this->parts = new int[v.nparts];
         this->nparts = v.nparts;
+        this->nnormalized = v.nnormalized;
         memcpy(parts, v.parts, sizeof(parts[0]) * nparts);
     }
     return *this;
@@ -84,6 +180,14 @@ Version::~Version()
         delete[] this->parts;
 }
 
+void Version::updateNormalized()
+{
+    int n = this->nparts;
+    while (n > 1 && this->parts[n - 1] == 0)
+        n--;
+    this->nnormalized = n;
+}
+
 void Version::setVersion(int a, int b)
 {
     if (this->parts != this->basic)
@@ -92,6 +196,7 @@ void Version::setVersion(int a, int b)
     this->parts[0] = a;
     this->parts[1] = b;
     this->nparts = 2;
+    updateNormalized();
 }
 
 void Version::setVersion(int a, int b, int c)
@@ -103,6 +208,7 @@ void Version::setVersion(int a, int b, int c)
     this->parts[1] = b;
     this->parts[2] = c;
     this->nparts = 3;
+    updateNormalized();
 }
 
 void Version::setVersion(int a, int b, int c, int d)
@@ -115,38 +221,65 @@ void Version::setVersion(int a, int b, int c, int d)
     this->parts[2] = c;
     this->parts[3] = d;
     this->nparts = 4;
+    updateNormalized();
 }
 
 bool Version::setVersion(const QString& v)
 {
-    bool result = false;
-    if (!v.trimmed().isEmpty()) {
-        QStringList sl = v.split(".", QString::KeepEmptyParts);
-
-        if (sl.count() > 0) {
-            bool ok = true;
-            for (int i = 0; i < sl.count(); i++) {
-                sl.at(i).toInt(&ok);
-                if (!ok)
-                    break;
-            }
-
-            if (ok) {
-                if (this->parts != basic)
-                    delete[] this->parts;
-                this->nparts = sl.count();
-                if (nparts <= BASIC_PARTS)
-                    this->parts = basic;
-                else
-                    this->parts = new int[nparts];
-                for (int i = 0; i < nparts; i++) {
-                    this->parts[i] = sl.at(i).toInt();
-                }
-                result = true;
-            }
+    return setVersion(v.constData(), v.length());
+}
+
+bool Version::setVersion(const QChar* data, int len)
+{
+    // the parts are parsed into a buffer on the stack first as the current
+    // value should not be changed if the version is invalid
+    int buffer[BASIC_PARTS];
+    int* p = buffer;
+    int capacity = BASIC_PARTS;
+    int n = 0;
+
+    bool ok = true;
+    int pos = 0;
+    while (true) {
+        int value;
+        if (!parsePart(data, len, &pos, &value)) {
+            ok = false;
+            break;
+        }
+
+        if (n == capacity) {
+            int* bigger = new int[capacity * 2];
+            memcpy(bigger, p, sizeof(p[0]) * n);
+            if (p != buffer)
+                delete[] p;
+            p = bigger;
+            capacity *= 2;
         }
+        p[n++] = value;
+
+        if (pos == len)
+            break;
+
+        // skip the dot
+        pos++;
     }
-    return result;
+
+    if (ok) {
+        if (this->parts != basic)
+            delete[] this->parts;
+        if (p == buffer) {
+            this->parts = basic;
+            memcpy(this->parts, buffer, sizeof(buffer[0]) * n);
+        } else {
+            this->parts = p;
+        }
+        this->nparts = n;
+        updateNormalized();
+    } else if (p != buffer) {
+        delete[] p;
+    }
+
+    return ok;
 }
 
 void Version::prepend(int number)
@@ -157,39 +290,88 @@ void Version::prepend(int number)
     else
         newParts = new int[nparts + 1];
 
-    newParts[0] = number;
     memmove(newParts + 1, this->parts, sizeof(parts[0]) * (this->nparts));
-    if (this->parts != basic)
+    newParts[0] = number;
+    if (this->parts != basic && this->parts != newParts)
         delete[] this->parts;
     this->parts = newParts;
     this->nparts = this->nparts + 1;
+    updateNormalized();
 }
 
-QString Version::getVersionString(int nparts) const
+QString Version::format(int n) const
 {
-    QString r;
-    for (int i = 0; i < nparts; i++) {
+    // the exact length is computed first so that only one QString is
+    // allocated
+    int len = n > 0 ? n - 1 : 0;
+    for (int i = 0; i < n; i++)
+        len += i < this->nparts ? formattedLength(this->parts[i]) : 1;
+
+    QString r(len, Qt::Uninitialized);
+    QChar* out = r.data();
+    for (int i = 0; i < n; i++) {
         if (i != 0)
-            r.append(".");
+            *out++ = '.';
         if (i >= this->nparts)
-            r.append('0');
+            *out++ = '0';
         else
-            r.append(QString::number(this->parts[i]));
+            out += formatPart(this->parts[i], out);
     }
     return r;
 }
 
-QString Version::getVersionString() const
+QString Version::getVersionString(int nparts) const
 {
-    QString r;
-    for (int i = 0; i < this->nparts; i++) {
-        if (i != 0)
-            r.append('.');
-        r.append(QString::number(this->parts[i]));
+    return format(nparts);
+}
+
+QByteArray Version::getSortKey() const
+{
+    int n = this->nnormalized;
+    if (n == 1 && this->parts[0] == 0)
+        n = 0;
+
+    QByteArray r;
+    r.reserve(n * 5 + 1);
+    for (int i = 0; i < n; i++) {
+        int v = this->parts[i];
+        if (v < 0) {
+            // the bias moves INT_MIN to 0
+            quint32 u = ((quint32) v) ^ 0x80000000u;
+            r.append((char) 0x40);
+            for (int j = 3; j >= 0; j--)
+                r.append((char) (u >> (j * 8)));
+        } else if (v == 0) {
+            // the last part of a normalized version is not 0
+            int next = i + 1;
+            while (this->parts[next] == 0)
+                next++;
+            r.append((char) (this->parts[next] < 0 ? 0x7f : 0x81));
+        } else {
+            // a longer number has more significant bytes and a bigger first
+            // byte
+            quint32 u = (quint32) v;
+            int len = 0;
+            for (quint32 t = u; t != 0; t >>= 8)
+                len++;
+
+            r.append((char) (0x81 + len));
+            for (int j = len - 1; j >= 0; j--)
+                r.append((char) (u >> (j * 8)));
+        }
     }
+
+    // the end stands for the trailing zeros
+    r.append((char) 0x80);
+
     return r;
 }
 
+QString Version::getVersionString() const
+{
+    return format(this->nparts);
+}
+
 int Version::getNParts() const
 {
     return this->nparts;
@@ -197,25 +379,18 @@ int Version::getNParts() const
 
 void Version::normalize()
 {
-    int n = 0;
-    for (int i = this->nparts - 1; i > 0; i--) {
-        if (this->parts[i] == 0)
-            n++;
-        else
-            break;
-    }
-
-    if (n > 0) {
+    int n = this->nnormalized;
+    if (n < this->nparts) {
         int* newParts;
-        if (this->nparts - n <= BASIC_PARTS)
+        if (n <= BASIC_PARTS)
             newParts = basic;
         else
-            newParts = new int[this->nparts - n];
-        memmove(newParts, this->parts, sizeof(parts[0]) * (this->nparts - n));
+            newParts = new int[n];
+        memmove(newParts, this->parts, sizeof(parts[0]) * n);
         if (this->parts != basic)
             delete[] this->parts;
         this->parts = newParts;
-        this->nparts = this->nparts - n;
+        this->nparts = n;
     }
 }
 
@@ -224,12 +399,46 @@ bool Version::isNormalized() const
     return this->parts[this->nparts - 1] != 0;
 }
 
+void Version::toBinary(QDataStream *out) const
+{
+    *out << (qint32) this->nparts;
+    for (int i = 0; i < this->nparts; i++) {
+        *out << (qint32) this->parts[i];
+    }
+}
+
+bool Version::fromBinary(QDataStream *in)
+{
+    qint32 n = 0;
+    *in >> n;
+    if (in->status() != QDataStream::Ok || n <= 0 || n > 1000)
+        return false;
+
+    if (this->parts != this->basic)
+        delete[] this->parts;
+    if (n <= BASIC_PARTS)
+        this->parts = basic;
+    else
+        this->parts = new int[n];
+    this->nparts = n;
+
+    for (int i = 0; i < n; i++) {
+        qint32 p = 0;
+        *in >> p;
+        this->parts[i] = p;
+    }
+    updateNormalized();
+
+    return in->status() == QDataStream::Ok;
+}
+
 
 int Version::compare(const Version &other) const
 {
-    int nmax = nparts;
-    if (other.nparts > nmax)
-        nmax = other.nparts;
+    // the parts after the trailing zeros do not need to be compared
+    int nmax = nnormalized;
+    if (other.nnormalized > nmax)
+        nmax = other.nnormalized;
 
     int r = 0;
     for (int i = 0; i < nmax; i++) {
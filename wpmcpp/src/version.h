@@ -3,14 +3,20 @@
 
 #include "qstring.h"
 
+class QDataStream;
+
 class Version
 {
 private:
-    const static int BASIC_PARTS = 4;
+    /**
+     * version numbers with up to 6 parts are used in practically all
+     * repositories
+     */
+    const static int BASIC_PARTS = 6;
 
     /**
      * this is used instead of allocating memory on the heap for performance.
-     * Version numbers with more than 4 parts are still stored on the heap.
+     * Version numbers with more than 6 parts are still stored on the heap.
      */
     int basic[BASIC_PARTS];
 
@@ -18,6 +24,20 @@ private:
     int* parts;
 
     int nparts;
+
+    /**
+     * number of parts without the trailing zeros (at least 1). This is
+     * updated by every method that changes the parts.
+     */
+    int nnormalized;
+
+    void updateNormalized();
+
+    /**
+     * @param n number of parts. Missing parts are formatted as 0.
+     * @return "1.2.3"
+     */
+    QString format(int n) const;
 public:
     static const Version EMPTY;
 
@@ -60,6 +80,19 @@ public:
      */
     bool setVersion(const QString& version);
 
+    /**
+     * Changes the version without allocating memory for the version
+     * numbers with up to 6 parts. The text is parsed like with
+     * QString::split(".") and QString::toInt().
+     *
+     * @param data "1.2.3". This may point into a bigger string, e.g. from
+     *     QStringRef::unicode().
+     * @param len number of characters in data
+     * @return true if it was a valid version. The internal value is not changed
+     *     if a not-valid version was supplied
+     */
+    bool setVersion(const QChar* data, int len);
+
     /**
      * Changes the version.
      *
@@ -98,6 +131,23 @@ public:
      */
     QString getVersionString(int nparts) const;
 
+    /**
+     * @brief computes a key for this version that can be compared byte by
+     *     byte (e.g. as a BLOB in SQLite). Trailing zeros are ignored ("1.2"
+     *     and "1.2.0" have the same key).
+     *
+     * Every part of the normalized version is stored as one byte for the
+     * type. Positive numbers use 0x81 + the number of significant bytes (1
+     * to 4), followed by these bytes in big-endian order. Negative numbers
+     * use 0x40 followed by 4 bytes for the number + 2^31. A zero is stored
+     * as 0x7F if the next non-zero part is negative and as 0x81 otherwise.
+     * The key ends with 0x80, which stands for the trailing zeros. "1.2" is
+     * stored in 5 bytes: 82 01 82 02 80.
+     *
+     * @return key
+     */
+    QByteArray getSortKey() const;
+
     /**
      * Prepends a number before the version.
      * Example: Version("1.2").prepend(5) => "5.1.2"
@@ -131,6 +181,19 @@ public:
      *     trailing zeros)
      */
     bool isNormalized() const;
+
+    /**
+     * @brief writes this version number in a compact binary form
+     * @param out output stream
+     */
+    void toBinary(QDataStream* out) const;
+
+    /**
+     * @brief reads a version number stored by toBinary()
+     * @param in input stream
+     * @return true if the data was valid
+     */
+    bool fromBinary(QDataStream* in);
 };
 
 #endif // VERSION_H
@@ -46,7 +46,14 @@ SOURCES += main.cpp \
     flowlayout.cpp \
     scandiskthirdpartypm.cpp \
     mysqlquery.cpp \
-    repositoryxmlhandler.cpp \
+    repositoryxmlparser.cpp \
+    repositorysnapshot.cpp \
+    pipebuffer.cpp \
+    reversedependencies.cpp \
+    dependencysolver.cpp \
+    operationexecutor.cpp \
+    downloadprefetcher.cpp \
+    downloadstate.cpp \
     cbsthirdpartypm.cpp \
     scanharddrivesthread.cpp \
     visiblejobs.cpp \
@@ -94,7 +101,14 @@ HEADERS += mainwindow.h \
     flowlayout.h \
     scandiskthirdpartypm.h \
     mysqlquery.h \
-    repositoryxmlhandler.h \
+    repositoryxmlparser.h \
+    repositorysnapshot.h \
+    pipebuffer.h \
+    reversedependencies.h \
+    dependencysolver.h \
+    operationexecutor.h \
+    downloadprefetcher.h \
+    downloadstate.h \
     cbsthirdpartypm.h \
     msoav2.h \
     scanharddrivesthread.h \